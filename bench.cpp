@@ -0,0 +1,813 @@
+// Microbenchmarks for the simulation kernels and phases; prints CSV (kernel, variant, n, ns/op, ops/s) to stdout
+//
+// Usage: bob-bench [--threads T]
+//
+// Each case is run repeatedly, with its (untimed) setup before each run, and the fastest run is reported. The
+// meaning of "op" is per kernel: one segment pair for the segment tests, one segment for nearest hits, and one particle
+// for everything else. Exits with 1 if the BVH nearest hit disagrees with a full search (reported on stderr).
+
+// C++ Standard Library
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Simulation core
+#include "simulation.inl"
+
+
+// Every case runs at least BENCH_RUNS_MIN times, and then until BENCH_SECONDS_MIN of timed work
+static const int BENCH_RUNS_MIN = 5;
+static const int BENCH_RUNS_MAX = 1000;
+static const double BENCH_SECONDS_MIN = 0.25;
+
+// Typical number of boundary candidates tested per particle by the collision broadphase
+static const int BENCH_SEGMENTS_BOUNDARY_COUNT = 64;
+static const int BENCH_SEGMENTS_PARTICLE_COUNT = 4096;
+
+// Boundary counts for full searches (without broadphase), up to a dense level
+static const int BENCH_SEARCH_BOUNDARY_COUNTS[] = {64, 1024, 8192};
+
+// Largest particle count for which the quadratic contact reference is run
+static const int N_CONTACTS_BRUTE_FORCE_PARTICLES_MAX = 10000;
+
+// Sand grid size (one cell per pixel of a default window), and the band of grains dropped in it
+static const int BENCH_SAND_CELLS_PER_SIDE = 600;
+static const int BENCH_SAND_BAND_ROWS = 100;
+static const int BENCH_SAND_EXCHANGE_PARTICLE_COUNT = 100000;
+
+// Particles spawned per run of the spawn benchmarks: one second of a 100k particles/s emitter, at 60 ticks per second
+static const int BENCH_SPAWN_PARTICLE_COUNT = 100000;
+static const int BENCH_SPAWN_TICKS = 60;
+
+typedef void (*BenchFunction)(void* context);
+
+// Keeps results of benchmarked code alive
+static volatile int bench_sink;
+
+static void bench_run(
+    const char* const kernel,
+    const char* const variant,
+    const long long n,
+    const long long ops_per_run,
+    BenchFunction setup,
+    BenchFunction run,
+    void* const context)
+{
+    using BenchClock = std::chrono::steady_clock;
+    using SecondsDelta = std::chrono::duration<double>;
+
+    double best_seconds = 0.0;
+    double total_seconds = 0.0;
+    for (int r = 0; r < BENCH_RUNS_MAX && (r < BENCH_RUNS_MIN || total_seconds < BENCH_SECONDS_MIN); ++r)
+    {
+        if (setup != nullptr)
+        {
+            setup(context);
+        }
+        const BenchClock::time_point start = BenchClock::now();
+        run(context);
+        const double seconds = SecondsDelta{BenchClock::now() - start}.count();
+
+        best_seconds = (r == 0) ? seconds : std::fmin(best_seconds, seconds);
+        total_seconds += seconds;
+    }
+
+    std::printf("%s,%s,%lld,%.3f,%.4g\n", kernel, variant, n, 1e9 * best_seconds / ops_per_run, ops_per_run / best_seconds);
+    std::fflush(stdout);
+}
+
+
+// Segment tests: short particle motion segments against a set of level boundaries
+
+struct BenchSegments
+{
+    Environment env;
+    Vec2* starts;
+    Vec2* ends;
+};
+
+static void bench_segments_initialize(BenchSegments* const bench, const int boundary_count)
+{
+    environment_initialize(&bench->env, boundary_count);
+    for (int l = 0; l < boundary_count; ++l)
+    {
+        Vec2 tail, delta;
+        vec2_set_random_uniform_scaled(&tail, BOUNDARY_LIMIT);
+        vec2_set_random_uniform_scaled(&delta, 0.5f);
+        environment_add_boundary(&bench->env, tail, Vec2{tail.x + delta.x, tail.y + delta.y});
+    }
+    environment_build_bvh(&bench->env);
+
+    bench->starts = (Vec2*)std::malloc(sizeof(Vec2) * BENCH_SEGMENTS_PARTICLE_COUNT);
+    bench->ends = (Vec2*)std::malloc(sizeof(Vec2) * BENCH_SEGMENTS_PARTICLE_COUNT);
+    for (int i = 0; i < BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        // About one frame of motion at max velocity
+        Vec2 delta;
+        vec2_set_random_uniform_scaled(bench->starts + i, BOUNDARY_LIMIT);
+        vec2_set_random_uniform_scaled(&delta, 0.05f);
+        bench->ends[i] = Vec2{bench->starts[i].x + delta.x, bench->starts[i].y + delta.y};
+    }
+}
+
+static void bench_segments_destroy(BenchSegments* const bench)
+{
+    environment_destroy(&bench->env);
+    std::free(bench->starts);
+    std::free(bench->ends);
+}
+
+static void bench_segment_segment_intercept_run(void* const context)
+{
+    const BenchSegments* const bench = (const BenchSegments*)context;
+    int n_hits = 0;
+    for (int i = 0; i < BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        for (int l = 0; l < bench->env.n_boundaries; ++l)
+        {
+            Vec2 intercept;
+            n_hits += vec2_segment_segment_intercept(
+                &intercept,
+                bench->starts + i,
+                bench->ends + i,
+                &(bench->env.boundaries + l)->tail,
+                &(bench->env.boundaries + l)->head
+            );
+        }
+    }
+    bench_sink = n_hits;
+}
+
+static void bench_near_segment_with_normal_run(void* const context)
+{
+    const BenchSegments* const bench = (const BenchSegments*)context;
+    int n_hits = 0;
+    for (int i = 0; i < BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        for (int l = 0; l < bench->env.n_boundaries; ++l)
+        {
+            n_hits += vec2_near_segment_with_normal(bench->env.boundaries + l, bench->env.normals + l, bench->ends + i, bench->env.boundary_thickness);
+        }
+    }
+    bench_sink = n_hits;
+}
+
+// Same as above two, using the environment's cached per-boundary collision data (as the collision loops do)
+static void bench_cached_segment_intercept_run(void* const context)
+{
+    const BenchSegments* const bench = (const BenchSegments*)context;
+    int n_hits = 0;
+    for (int i = 0; i < BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        const AABB step_bounds = aabb_create(bench->starts[i], bench->ends[i]);
+        for (int l = 0; l < bench->env.n_boundaries; ++l)
+        {
+            Vec2 intercept;
+            n_hits += environment_may_cross_boundary(&bench->env, l, &step_bounds) &&
+                vec2_segment_direction_intercept(
+                    &intercept,
+                    bench->starts + i,
+                    bench->ends + i,
+                    &(bench->env.boundaries + l)->tail,
+                    bench->env.directions + l
+                );
+        }
+    }
+    bench_sink = n_hits;
+}
+
+static void bench_cached_near_boundary_run(void* const context)
+{
+    const BenchSegments* const bench = (const BenchSegments*)context;
+    int n_hits = 0;
+    for (int i = 0; i < BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        for (int l = 0; l < bench->env.n_boundaries; ++l)
+        {
+            n_hits += environment_is_near_boundary(&bench->env, l, bench->ends + i);
+        }
+    }
+    bench_sink = n_hits;
+}
+
+// Earliest crossing and first near boundary over all boundaries, one at a time (as particles_earliest_boundary_hit
+// does for grid candidates)
+static void bench_boundary_search_scalar_run(void* const context)
+{
+    const BenchSegments* const bench = (const BenchSegments*)context;
+    const Environment* const env = &bench->env;
+    int n_hits = 0;
+    for (int i = 0; i < BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        const AABB step_bounds = aabb_create(bench->starts[i], bench->ends[i]);
+        float t_best = INFINITY;
+        int l_best = -1;
+        int l_near = -1;
+        for (int l = 0; l < env->n_boundaries; ++l)
+        {
+            float t;
+            if (environment_may_cross_boundary(env, l, &step_bounds) &&
+                vec2_segment_direction_intercept_param(&t, bench->starts + i, bench->ends + i, &(env->boundaries + l)->tail, env->directions + l))
+            {
+                if (t < t_best)
+                {
+                    t_best = t;
+                    l_best = l;
+                }
+            }
+            else if (l_near < 0 && environment_is_near_boundary(env, l, bench->ends + i))
+            {
+                l_near = l;
+            }
+        }
+        n_hits += l_best + l_near;
+    }
+    bench_sink = n_hits;
+}
+
+// Same as above, a block of boundaries at a time
+static void bench_boundary_search_simd_run(void* const context)
+{
+    const BenchSegments* const bench = (const BenchSegments*)context;
+    int n_hits = 0;
+    for (int i = 0; i < BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        EnvironmentBoundaryHits hits;
+        environment_find_boundary_hits(&bench->env, bench->starts + i, bench->ends + i, bench->ends + i, 0, -1, &hits);
+        n_hits += hits.earliest + hits.first_near;
+    }
+    bench_sink = n_hits;
+}
+
+// Earliest crossing over all boundaries, a block at a time
+static void bench_nearest_hit_full_search_run(void* const context)
+{
+    const BenchSegments* const bench = (const BenchSegments*)context;
+    int n_hits = 0;
+    for (int i = 0; i < BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        EnvironmentBoundaryHits hits;
+        environment_find_boundary_hits(&bench->env, bench->starts + i, bench->ends + i, bench->ends + i, 0, -1, &hits);
+        n_hits += hits.earliest;
+    }
+    bench_sink = n_hits;
+}
+
+// Same as above, only searching BVH leaves along the segment
+static void bench_nearest_hit_bvh_run(void* const context)
+{
+    const BenchSegments* const bench = (const BenchSegments*)context;
+    int n_hits = 0;
+    for (int i = 0; i < BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        Vec2 intercept;
+        int l = -1;
+        environment_nearest_boundary_hit(&bench->env, bench->starts + i, bench->ends + i, &intercept, &l);
+        n_hits += l;
+    }
+    bench_sink = n_hits;
+}
+
+// Number of segments for which the BVH finds a different earliest crossing (boundary, or fraction along the segment)
+// than a full search, over particle steps as well as segments across the whole level
+static int bench_nearest_hit_mismatches(const BenchSegments* const bench)
+{
+    int n_mismatches = 0;
+    for (int i = 0; i < 2 * BENCH_SEGMENTS_PARTICLE_COUNT; ++i)
+    {
+        const Vec2* const start = bench->starts + i / 2;
+        const Vec2 across{-start->x, -start->y};
+        const Vec2* const end = (i % 2 == 0) ? (bench->ends + i / 2) : &across;
+
+        EnvironmentBoundaryHits full, bvh;
+        environment_find_boundary_hits(&bench->env, start, end, end, 0, -1, &full);
+        environment_bvh_find_boundary_hits(&bench->env, start, end, end, 0, -1, true, &bvh);
+        n_mismatches += (full.earliest != bvh.earliest) || (full.earliest >= 0 && full.t_earliest != bvh.t_earliest);
+    }
+    return n_mismatches;
+}
+
+
+// Particle phases, run on a fresh copy of the same particles for every run
+
+struct BenchParticles
+{
+    Environment env;
+    Particles particles;
+    Particles initial;
+    Planets planets;
+    float* initial_masses;
+    ThreadPool* pool;
+    WorkerAccumulators acc;
+    ZoneHistogram zones;
+    MemoryArena scratch;
+
+    // Fraction of particles killed before each prune run
+    float dead_fraction;
+
+    // Fraction of particles put to sleep before each sleeping step run
+    float asleep_fraction;
+};
+
+static void bench_particles_initialize(BenchParticles* const bench, ThreadPool* const pool, const int n_particles, const int n_planets)
+{
+    environment_initialize(&bench->env, N_ENVIRONMENT_LINES_INITIAL);
+    environment_load_default_level(&bench->env);
+
+    particles_initialize(&bench->particles, n_particles);
+    particles_initialize(&bench->initial, n_particles);
+    for (int i = 0; i < n_particles; ++i)
+    {
+        Vec2 position, velocity;
+        vec2_set_random_uniform_scaled(&position, BOUNDARY_LIMIT);
+        vec2_set_random_uniform_scaled(&velocity, 1.f);
+        particles_spawn_at(&bench->initial, position);
+        vec2_array_set(&bench->initial.velocities, i, &velocity);
+    }
+
+    planets_initialize(&bench->planets, imax(1, n_planets));
+    bench->initial_masses = (float*)std::malloc(sizeof(float) * imax(1, n_planets));
+    for (int p = 0; p < n_planets; ++p)
+    {
+        Vec2 position;
+        vec2_set_random_uniform_scaled(&position, 0.8f);
+        planets_spawn_at(&bench->planets, position, (p % 2) ? Vec2{0, 1} : Vec2{0, 0}, 0.5f);
+        bench->initial_masses[p] = 0.5f;
+    }
+
+    bench->pool = pool;
+    worker_accumulators_initialize(&bench->acc, thread_pool_thread_count(pool), bench->env.n_reserved, bench->planets.n_reserved);
+    zone_histogram_initialize(&bench->zones, AUDIO_HISTOGRAM_ZONES_PER_SIDE, AUDIO_HISTOGRAM_ZONES_PER_SIDE, thread_pool_thread_count(pool));
+    memory_arena_initialize(&bench->scratch, SIMULATION_SCRATCH_BYTES);
+    bench->dead_fraction = 0.f;
+    bench->asleep_fraction = 0.f;
+}
+
+static void bench_particles_destroy(BenchParticles* const bench)
+{
+    memory_arena_destroy(&bench->scratch);
+    zone_histogram_destroy(&bench->zones);
+    worker_accumulators_destroy(&bench->acc);
+    std::free(bench->initial_masses);
+    planets_destroy(&bench->planets);
+    particles_destroy(&bench->initial);
+    particles_destroy(&bench->particles);
+    environment_destroy(&bench->env);
+}
+
+static void bench_particles_reset(void* const context)
+{
+    BenchParticles* const bench = (BenchParticles*)context;
+    Particles* const ps = &bench->particles;
+    const Particles* const initial = &bench->initial;
+    const int n_padded = simd_padded_count(initial->n_active);
+    vec2_array_copy_n(&ps->positions_previous, &initial->positions_previous, n_padded);
+    vec2_array_copy_n(&ps->positions, &initial->positions, n_padded);
+    vec2_array_copy_n(&ps->velocities, &initial->velocities, n_padded);
+    vec2_array_copy_n(&ps->forces, &initial->forces, n_padded);
+    std::memcpy(ps->alive, initial->alive, sizeof(std::uint64_t) * bitset_word_count(n_padded));
+    ps->n_active = initial->n_active;
+
+    // Undo mass absorbed on previous runs, without invalidating cached planet data
+    for (int p = 0; p < bench->planets.n_active; ++p)
+    {
+        bench->planets.properties[p].mass = bench->initial_masses[p];
+    }
+}
+
+// Same as bench_particles_reset, then converts states to compact storage 
+static void bench_particles_reset_compact(void* const context)
+{
+    bench_particles_reset(context);
+    particles_encode_states(&((BenchParticles*)context)->particles);
+}
+
+static void bench_particles_reset_with_dead(void* const context)
+{
+    bench_particles_reset(context);
+
+    // Kill an evenly spread fraction of particles
+    BenchParticles* const bench = (BenchParticles*)context;
+    const int stride = (int)(1.f / bench->dead_fraction);
+    for (int i = 0; i < bench->particles.n_active; i += stride)
+    {
+        bitset_clear(bench->particles.alive, i);
+    }
+}
+
+// Same as bench_particles_reset, then puts an evenly spread fraction of particles to sleep
+static void bench_particles_reset_asleep(void* const context)
+{
+    bench_particles_reset(context);
+
+    BenchParticles* const bench = (BenchParticles*)context;
+    Particles* const ps = &bench->particles;
+    for (int i = 0; i < ps->n_active; ++i)
+    {
+        const bool asleep = (int)((i + 1) * bench->asleep_fraction) > (int)(i * bench->asleep_fraction);
+        ps->rest_steps[i] = asleep ? (std::int16_t)ps->sleep_steps : 0;
+    }
+}
+
+static void bench_particles_reset_planets_dirty(void* const context)
+{
+    bench_particles_reset(context);
+    ((BenchParticles*)context)->planets.dirty = true;
+}
+
+static void bench_particles_reset_planets_clean(void* const context)
+{
+    bench_particles_reset(context);
+    ((BenchParticles*)context)->planets.dirty = false;
+}
+
+static void bench_integrate_run(void* const context)
+{
+    Particles* const ps = &((BenchParticles*)context)->particles;
+    integrate_states_fixed_step(&ps->positions, &ps->velocities, &ps->forces, ps->n_active, 1.f / 60.f);
+}
+
+static void bench_prune_dead_run(void* const context)
+{
+    particles_prune_dead(&((BenchParticles*)context)->particles);
+}
+
+static void bench_planets_apply_run(void* const context)
+{
+    BenchParticles* const bench = (BenchParticles*)context;
+    planets_apply_to_particles(&bench->planets, &bench->env, &bench->particles, bench->pool, &bench->acc);
+}
+
+static void bench_particles_update_run(void* const context)
+{
+    BenchParticles* const bench = (BenchParticles*)context;
+    particles_update(&bench->particles, &bench->env, bench->pool, &bench->acc, 1.f / 60.f);
+}
+
+static void bench_capture_in_goal_run(void* const context)
+{
+    BenchParticles* const bench = (BenchParticles*)context;
+    bench_sink = particles_capture_in_goal(&bench->particles, &bench->env, bench->pool, &bench->acc);
+}
+
+static void bench_count_in_zones_run(void* const context)
+{
+    BenchParticles* const bench = (BenchParticles*)context;
+    particles_count_in_zones(&bench->particles, bench->pool, &bench->zones);
+    bench_sink = (int)bench->zones.counts[0];
+}
+
+static void bench_contacts_run(void* const context)
+{
+    BenchParticles* const bench = (BenchParticles*)context;
+    particles_apply_contacts(&bench->particles, bench->pool, &bench->scratch);
+}
+
+static void bench_contacts_brute_force_run(void* const context)
+{
+    particles_apply_contacts_brute_force(&((BenchParticles*)context)->particles);
+}
+
+// Phases which particles_step fuses, run one after the other
+static void bench_particles_step_separate_run(void* const context)
+{
+    BenchParticles* const bench = (BenchParticles*)context;
+    const int captured = particles_capture_in_goal(&bench->particles, &bench->env, bench->pool, &bench->acc);
+    particles_update(&bench->particles, &bench->env, bench->pool, &bench->acc, 1.f / 60.f);
+    particles_count_in_zones(&bench->particles, bench->pool, &bench->zones);
+    bench_sink = captured + (int)bench->zones.counts[0];
+}
+
+static void bench_particles_step_fused_run(void* const context)
+{
+    BenchParticles* const bench = (BenchParticles*)context;
+    const int captured = particles_step(&bench->particles, &bench->env, bench->pool, &bench->acc, &bench->zones, 1.f / 60.f);
+    bench_sink = captured + (int)bench->zones.counts[0];
+}
+
+
+// Spawning: particles added one at a time, in batches, and from an emitter
+
+struct BenchSpawn
+{
+    Particles particles;
+    ParticleEmitters emitters;
+    MemoryArena scratch;
+    Vec2Array positions;
+    Vec2Array velocities;
+};
+
+static void bench_spawn_initialize(BenchSpawn* const bench)
+{
+    particles_initialize(&bench->particles, BENCH_SPAWN_PARTICLE_COUNT);
+    particle_emitters_initialize(&bench->emitters);
+    particle_emitters_add(&bench->emitters, Vec2{0.f, 0.5f}, Vec2{0.f, -1.f}, (float)BENCH_SPAWN_PARTICLE_COUNT, 0.1f);
+    memory_arena_initialize(&bench->scratch, SIMULATION_SCRATCH_BYTES);
+
+    bench->positions = Vec2Array{(float*)std::malloc(sizeof(float) * BENCH_SPAWN_PARTICLE_COUNT), (float*)std::malloc(sizeof(float) * BENCH_SPAWN_PARTICLE_COUNT)};
+    bench->velocities = Vec2Array{(float*)std::malloc(sizeof(float) * BENCH_SPAWN_PARTICLE_COUNT), (float*)std::malloc(sizeof(float) * BENCH_SPAWN_PARTICLE_COUNT)};
+    for (int i = 0; i < BENCH_SPAWN_PARTICLE_COUNT; ++i)
+    {
+        Vec2 position;
+        vec2_set_random_uniform_scaled(&position, BOUNDARY_LIMIT);
+        vec2_array_set(&bench->positions, i, &position);
+        vec2_array_set_zero(&bench->velocities, i);
+    }
+}
+
+static void bench_spawn_destroy(BenchSpawn* const bench)
+{
+    std::free(bench->positions.x);
+    std::free(bench->positions.y);
+    std::free(bench->velocities.x);
+    std::free(bench->velocities.y);
+    memory_arena_destroy(&bench->scratch);
+    particles_destroy(&bench->particles);
+}
+
+static void bench_spawn_reset(void* const context)
+{
+    particles_clear(&((BenchSpawn*)context)->particles);
+}
+
+static void bench_spawn_at_run(void* const context)
+{
+    BenchSpawn* const bench = (BenchSpawn*)context;
+    for (int i = 0; i < BENCH_SPAWN_PARTICLE_COUNT; ++i)
+    {
+        particles_spawn_at(&bench->particles, vec2_array_get(&bench->positions, i));
+    }
+}
+
+// Same particles as bench_spawn_at_run, in one batch per tick
+static void bench_spawn_n_run(void* const context)
+{
+    BenchSpawn* const bench = (BenchSpawn*)context;
+    const int n_per_tick = BENCH_SPAWN_PARTICLE_COUNT / BENCH_SPAWN_TICKS;
+    for (int begin = 0; begin < BENCH_SPAWN_PARTICLE_COUNT; begin += n_per_tick)
+    {
+        const Vec2Array positions = vec2_array_offset(&bench->positions, begin);
+        const Vec2Array velocities = vec2_array_offset(&bench->velocities, begin);
+        particles_spawn_n(&bench->particles, &positions, &velocities, imin(n_per_tick, BENCH_SPAWN_PARTICLE_COUNT - begin));
+    }
+}
+
+static void bench_spawn_emitters_run(void* const context)
+{
+    BenchSpawn* const bench = (BenchSpawn*)context;
+    for (int tick = 0; tick < BENCH_SPAWN_TICKS; ++tick)
+    {
+        particle_emitters_update(&bench->emitters, &bench->particles, &bench->scratch, 1.f / BENCH_SPAWN_TICKS);
+    }
+    bench_sink = bench->particles.n_active;
+}
+
+
+// Sand grid: a band of grains across the upper half of the default level, falling or settled
+
+struct BenchSand
+{
+    Environment env;
+    SandGrid grid;
+    Particles particles;
+    Planets planets;
+    ThreadPool* pool;
+    int n_grains;
+};
+
+static void bench_sand_reset_falling(void* const context)
+{
+    BenchSand* const bench = (BenchSand*)context;
+    SandGrid* const grid = &bench->grid;
+    sand_grid_clear_grains(grid);
+    bench->n_grains = 0;
+    const int y_begin = (3 * grid->cells_per_side) / 4;
+    for (int y = y_begin; y < y_begin + BENCH_SAND_BAND_ROWS; ++y)
+    {
+        for (int x = 0; x < grid->cells_per_side; ++x)
+        {
+            if (sand_grid_material(grid, x, y) == SAND_EMPTY)
+            {
+                sand_grid_set(grid, x, y, SAND_GRAIN);
+                ++bench->n_grains;
+            }
+        }
+    }
+}
+
+static void bench_sand_initialize(BenchSand* const bench, ThreadPool* const pool)
+{
+    environment_initialize(&bench->env, N_ENVIRONMENT_LINES_INITIAL);
+    environment_load_default_level(&bench->env);
+    sand_grid_initialize(&bench->grid, BENCH_SAND_CELLS_PER_SIDE, BENCH_SAND_EXCHANGE_PARTICLE_COUNT);
+    sand_grid_rasterize_environment(&bench->grid, &bench->env);
+    bench->grid.enabled = true;
+    bench_sand_reset_falling(bench);
+
+    // Particles which are all moving, so that none settle
+    particles_initialize(&bench->particles, BENCH_SAND_EXCHANGE_PARTICLE_COUNT);
+    for (int i = 0; i < BENCH_SAND_EXCHANGE_PARTICLE_COUNT; ++i)
+    {
+        Vec2 position;
+        const Vec2 velocity{1.f, 0.f};
+        vec2_set_random_uniform_scaled(&position, BOUNDARY_LIMIT);
+        particles_spawn_at(&bench->particles, position);
+        vec2_array_set(&bench->particles.velocities, i, &velocity);
+    }
+    planets_initialize(&bench->planets, 1);
+    bench->pool = pool;
+}
+
+static void bench_sand_destroy(BenchSand* const bench)
+{
+    planets_destroy(&bench->planets);
+    particles_destroy(&bench->particles);
+    sand_grid_destroy(&bench->grid);
+    environment_destroy(&bench->env);
+}
+
+static void bench_sand_update_run(void* const context)
+{
+    BenchSand* const bench = (BenchSand*)context;
+    sand_grid_update(&bench->grid, bench->pool);
+    bench_sink = bench->grid.n_active_chunks;
+}
+
+static void bench_sand_exchange_run(void* const context)
+{
+    BenchSand* const bench = (BenchSand*)context;
+    sand_grid_exchange_particles(&bench->grid, &bench->env, &bench->particles, &bench->planets, bench->pool);
+}
+
+int main(int argc, char** argv)
+{
+    int n_threads = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (std::strcmp(argv[i], "--threads") == 0)
+        {
+            n_threads = std::atoi(argv[i + 1]);
+        }
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::srand(1);
+
+    ThreadPool pool;
+    thread_pool_initialize(&pool, n_threads);
+
+    std::fprintf(stderr, "simd: %s, threads: %d\n", SIMD_NAME, thread_pool_thread_count(&pool));
+    std::printf("kernel,variant,n,ns_per_op,ops_per_s\n");
+
+    {
+        BenchSegments bench;
+        bench_segments_initialize(&bench, BENCH_SEGMENTS_BOUNDARY_COUNT);
+        const long long n_pairs = (long long)BENCH_SEGMENTS_PARTICLE_COUNT * BENCH_SEGMENTS_BOUNDARY_COUNT;
+        bench_run("vec2_segment_segment_intercept", "-", n_pairs, n_pairs, nullptr, bench_segment_segment_intercept_run, &bench);
+        bench_run("vec2_near_segment_with_normal", "-", n_pairs, n_pairs, nullptr, bench_near_segment_with_normal_run, &bench);
+        bench_run("cached segment intercept", "-", n_pairs, n_pairs, nullptr, bench_cached_segment_intercept_run, &bench);
+        bench_run("environment_is_near_boundary", "-", n_pairs, n_pairs, nullptr, bench_cached_near_boundary_run, &bench);
+        bench_segments_destroy(&bench);
+    }
+
+    // Per boundary tested, so SIMD speedup shows as a flat ratio across boundary counts. Nearest hits are per segment,
+    // and are checked against the full search first.
+    int n_mismatches = 0;
+    for (const int n_boundaries : BENCH_SEARCH_BOUNDARY_COUNTS)
+    {
+        BenchSegments bench;
+        bench_segments_initialize(&bench, n_boundaries);
+        const long long n_pairs = (long long)BENCH_SEGMENTS_PARTICLE_COUNT * n_boundaries;
+        bench_run("boundary full search", "one-at-a-time", n_boundaries, n_pairs, nullptr, bench_boundary_search_scalar_run, &bench);
+        bench_run("boundary full search", "blocked", n_boundaries, n_pairs, nullptr, bench_boundary_search_simd_run, &bench);
+
+        const int n_bvh_mismatches = bench_nearest_hit_mismatches(&bench);
+        std::fprintf(stderr, "boundary nearest hit, %d boundaries: %d of %d bvh results differ from full search\n", n_boundaries, n_bvh_mismatches, 2 * BENCH_SEGMENTS_PARTICLE_COUNT);
+        n_mismatches += n_bvh_mismatches;
+        bench_run("boundary nearest hit", "full search", n_boundaries, BENCH_SEGMENTS_PARTICLE_COUNT, nullptr, bench_nearest_hit_full_search_run, &bench);
+        bench_run("boundary nearest hit", "bvh", n_boundaries, BENCH_SEGMENTS_PARTICLE_COUNT, nullptr, bench_nearest_hit_bvh_run, &bench);
+        bench_segments_destroy(&bench);
+    }
+
+    static const int PARTICLE_COUNTS[] = {10000, 100000, 1000000};
+    for (const int n_particles : PARTICLE_COUNTS)
+    {
+        BenchParticles bench;
+        bench_particles_initialize(&bench, &pool, n_particles, 0);
+
+        bench_run("integrate_states_fixed_step", "-", n_particles, n_particles, bench_particles_reset, bench_integrate_run, &bench);
+
+        static const float DEAD_FRACTIONS[] = {0.01f, 0.5f};
+        for (const float dead_fraction : DEAD_FRACTIONS)
+        {
+            char variant[32];
+            std::snprintf(variant, sizeof(variant), "dead=%g", dead_fraction);
+            bench.dead_fraction = dead_fraction;
+            bench_run("particles_prune_dead", variant, n_particles, n_particles, bench_particles_reset_with_dead, bench_prune_dead_run, &bench);
+        }
+
+        bench_run("particles_update", "default-level", n_particles, n_particles, bench_particles_reset, bench_particles_update_run, &bench);
+        bench.particles.collision_mode = PARTICLE_COLLISIONS_SWEPT;
+        bench_run("particles_update", "default-level-swept", n_particles, n_particles, bench_particles_reset, bench_particles_update_run, &bench);
+        bench.particles.collision_mode = PARTICLE_COLLISIONS_FIRST_HIT;
+        bench_run("particles_capture_in_goal", "-", n_particles, n_particles, bench_particles_reset, bench_capture_in_goal_run, &bench);
+        bench_run("particles_count_in_zones", "-", n_particles, n_particles, bench_particles_reset, bench_count_in_zones_run, &bench);
+        bench_run("particles_step", "separate", n_particles, n_particles, bench_particles_reset, bench_particles_step_separate_run, &bench);
+        bench_run("particles_step", "fused", n_particles, n_particles, bench_particles_reset, bench_particles_step_fused_run, &bench);
+
+        bench.particles.storage_mode = PARTICLE_STORAGE_INT16;
+        bench_run("particles_step", "fused-int16", n_particles, n_particles, bench_particles_reset_compact, bench_particles_step_fused_run, &bench);
+        bench.particles.storage_mode = PARTICLE_STORAGE_FLOAT;
+
+        static const float ASLEEP_FRACTIONS[] = {0.f, 0.9f};
+        particles_set_sleep_steps(&bench.particles, PARTICLE_SLEEP_STEPS_DEFAULT);
+        for (const float asleep_fraction : ASLEEP_FRACTIONS)
+        {
+            char variant[32];
+            std::snprintf(variant, sizeof(variant), "fused asleep=%g", asleep_fraction);
+            bench.asleep_fraction = asleep_fraction;
+            bench_run("particles_step", variant, n_particles, n_particles, bench_particles_reset_asleep, bench_particles_step_fused_run, &bench);
+        }
+        particles_set_sleep_steps(&bench.particles, 0);
+
+        bench.particles.contact_mode = PARTICLE_CONTACTS_SOFT_SPHERE;
+        bench_run("particles_apply_contacts", "cell-list", n_particles, n_particles, bench_particles_reset, bench_contacts_run, &bench);
+        if (n_particles <= N_CONTACTS_BRUTE_FORCE_PARTICLES_MAX)
+        {
+            bench_run("particles_apply_contacts", "brute-force", n_particles, n_particles, bench_particles_reset, bench_contacts_brute_force_run, &bench);
+        }
+        bench.particles.contact_mode = PARTICLE_CONTACTS_NONE;
+
+        bench_particles_destroy(&bench);
+    }
+
+    {
+        BenchSpawn bench;
+        bench_spawn_initialize(&bench);
+        const int n = BENCH_SPAWN_PARTICLE_COUNT;
+        bench_run("particles_spawn", "one-at-a-time", n, n, bench_spawn_reset, bench_spawn_at_run, &bench);
+        bench_run("particles_spawn", "batched", n, n, bench_spawn_reset, bench_spawn_n_run, &bench);
+        bench_run("particle_emitters_update", "-", n, n, bench_spawn_reset, bench_spawn_emitters_run, &bench);
+        bench_spawn_destroy(&bench);
+    }
+
+    {
+        BenchSand bench;
+        bench_sand_initialize(&bench, &pool);
+        bench_run("sand_grid_update", "falling", bench.n_grains, bench.n_grains, bench_sand_reset_falling, bench_sand_update_run, &bench);
+
+        // Let the band settle completely (untimed), after which updates have nothing to do
+        while (bench.grid.n_active_chunks > 0)
+        {
+            sand_grid_update(&bench.grid, &pool);
+        }
+        bench_run("sand_grid_update", "settled", bench.n_grains, bench.n_grains, nullptr, bench_sand_update_run, &bench);
+        bench_run("sand_grid_exchange_particles", "-", BENCH_SAND_EXCHANGE_PARTICLE_COUNT, BENCH_SAND_EXCHANGE_PARTICLE_COUNT, nullptr, bench_sand_exchange_run, &bench);
+        bench_sand_destroy(&bench);
+    }
+
+    static const int PLANET_COUNTS[] = {10, 100, 1000};
+    static const int N_PLANET_BENCH_PARTICLES = 100000;
+    for (const int n_planets : PLANET_COUNTS)
+    {
+        BenchParticles bench;
+        bench_particles_initialize(&bench, &pool, N_PLANET_BENCH_PARTICLES, n_planets);
+
+        for (int mode = 0; mode < PLANET_GRAVITY_MODE_COUNT; ++mode)
+        {
+            char variant[64];
+            bench.planets.gravity_mode = (PlanetGravityMode)mode;
+            std::snprintf(variant, sizeof(variant), "%s planets=%d", PLANET_GRAVITY_MODE_NAMES[mode], n_planets);
+
+            // Build any cached planet data once, outside of the timed runs
+            bench_particles_reset_planets_dirty(&bench);
+            bench_planets_apply_run(&bench);
+            bench_run("planets_apply_to_particles", variant, N_PLANET_BENCH_PARTICLES, N_PLANET_BENCH_PARTICLES, bench_particles_reset_planets_clean, bench_planets_apply_run, &bench);
+
+            // Cached modes pay for a rebuild whenever planets change
+            if (mode == PLANET_GRAVITY_FIELD_GRID)
+            {
+                std::snprintf(variant, sizeof(variant), "%s (rebuild) planets=%d", PLANET_GRAVITY_MODE_NAMES[mode], n_planets);
+                bench_run("planets_apply_to_particles", variant, N_PLANET_BENCH_PARTICLES, N_PLANET_BENCH_PARTICLES, bench_particles_reset_planets_dirty, bench_planets_apply_run, &bench);
+            }
+        }
+
+        // Compact storage decodes positions on the fly
+        char variant[64];
+        bench.planets.gravity_mode = PLANET_GRAVITY_DIRECT_SIMD;
+        bench.particles.storage_mode = PARTICLE_STORAGE_INT16;
+        std::snprintf(variant, sizeof(variant), "%s int16 planets=%d", PLANET_GRAVITY_MODE_NAMES[PLANET_GRAVITY_DIRECT_SIMD], n_planets);
+        bench_run("planets_apply_to_particles", variant, N_PLANET_BENCH_PARTICLES, N_PLANET_BENCH_PARTICLES, bench_particles_reset_compact, bench_planets_apply_run, &bench);
+        bench.particles.storage_mode = PARTICLE_STORAGE_FLOAT;
+
+        bench_particles_destroy(&bench);
+    }
+
+    thread_pool_destroy(&pool);
+    return (n_mismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,343 @@
+// Headless simulation driver: runs a scripted scenario with no window, rendering or audio, and reports throughput
+//
+// Usage: bob-headless [--frames N] [--particles K] [--planets P] [--threads T] [--gravity MODE] [--contacts MODE]
+//                     [--collisions MODE] [--storage MODE] [--sand CELLS] [--sleep STEPS] [--emit RATE] [--seed S]
+//
+// MODEs are one of PLANET_GRAVITY_MODE_NAMES, PARTICLE_CONTACT_MODE_NAMES, PARTICLE_COLLISION_MODE_NAMES or
+// PARTICLE_STORAGE_MODE_NAMES, with spaces replaced by dashes (e.g. "direct-simd"). --sand enables the falling sand grid
+// with CELLS cells per side (0, the default, disables it). --sleep puts particles to sleep after STEPS steps at rest (0,
+// the default, disables sleeping). --emit adds an emitter above the play area's center, which spawns RATE particles per
+// second (0, the default, adds none). With int16 storage, the final state is also stepped with both storage modes, and the
+// differences are reported.
+
+// C++ Standard Library
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Simulation core
+#include "simulation.inl"
+
+
+struct HeadlessOptions
+{
+    int n_frames;
+    int n_particles;
+    int n_planets;
+    int n_threads;
+    PlanetGravityMode gravity_mode;
+    ParticleContactMode contact_mode;
+    ParticleCollisionMode collision_mode;
+    ParticleStorageMode storage_mode;
+    int sand_cells_per_side;
+    int sleep_steps;
+    float emit_rate;
+    unsigned seed;
+};
+
+static bool headless_parse_mode(int* const mode, const char* const* const mode_names, const int mode_count, const char* const name)
+{
+    for (int m = 0; m < mode_count; ++m)
+    {
+        // Names are matched with dashes in place of spaces
+        const char* expected = mode_names[m];
+        const char* given = name;
+        while (*expected != '\0' && (*given == *expected || (*given == '-' && *expected == ' ')))
+        {
+            ++expected;
+            ++given;
+        }
+        if (*expected == '\0' && *given == '\0')
+        {
+            *mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool headless_parse_options(HeadlessOptions* const options, const int argc, char** const argv)
+{
+    options->n_frames = 600;
+    options->n_particles = 100000;
+    options->n_planets = 8;
+    options->n_threads = 0;
+    options->gravity_mode = PLANET_GRAVITY_DIRECT_SIMD;
+    options->contact_mode = PARTICLE_CONTACTS_NONE;
+    options->collision_mode = PARTICLE_COLLISIONS_FIRST_HIT;
+    options->storage_mode = PARTICLE_STORAGE_FLOAT;
+    options->sand_cells_per_side = 0;
+    options->sleep_steps = 0;
+    options->emit_rate = 0.f;
+    options->seed = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* const option = argv[i];
+        const char* const value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (value == nullptr)
+        {
+            std::fprintf(stderr, "missing value for %s\n", option);
+            return false;
+        }
+        else if (std::strcmp(option, "--frames") == 0)
+        {
+            options->n_frames = std::atoi(value);
+        }
+        else if (std::strcmp(option, "--particles") == 0)
+        {
+            options->n_particles = std::atoi(value);
+        }
+        else if (std::strcmp(option, "--planets") == 0)
+        {
+            options->n_planets = std::atoi(value);
+        }
+        else if (std::strcmp(option, "--threads") == 0)
+        {
+            options->n_threads = std::atoi(value);
+        }
+        else if (std::strcmp(option, "--gravity") == 0)
+        {
+            int mode;
+            if (!headless_parse_mode(&mode, PLANET_GRAVITY_MODE_NAMES, PLANET_GRAVITY_MODE_COUNT, value))
+            {
+                std::fprintf(stderr, "unknown gravity mode %s\n", value);
+                return false;
+            }
+            options->gravity_mode = (PlanetGravityMode)mode;
+        }
+        else if (std::strcmp(option, "--contacts") == 0)
+        {
+            int mode;
+            if (!headless_parse_mode(&mode, PARTICLE_CONTACT_MODE_NAMES, PARTICLE_CONTACT_MODE_COUNT, value))
+            {
+                std::fprintf(stderr, "unknown contact mode %s\n", value);
+                return false;
+            }
+            options->contact_mode = (ParticleContactMode)mode;
+        }
+        else if (std::strcmp(option, "--collisions") == 0)
+        {
+            int mode;
+            if (!headless_parse_mode(&mode, PARTICLE_COLLISION_MODE_NAMES, PARTICLE_COLLISION_MODE_COUNT, value))
+            {
+                std::fprintf(stderr, "unknown collision mode %s\n", value);
+                return false;
+            }
+            options->collision_mode = (ParticleCollisionMode)mode;
+        }
+        else if (std::strcmp(option, "--storage") == 0)
+        {
+            int mode;
+            if (!headless_parse_mode(&mode, PARTICLE_STORAGE_MODE_NAMES, PARTICLE_STORAGE_MODE_COUNT, value))
+            {
+                std::fprintf(stderr, "unknown storage mode %s\n", value);
+                return false;
+            }
+            options->storage_mode = (ParticleStorageMode)mode;
+        }
+        else if (std::strcmp(option, "--sand") == 0)
+        {
+            options->sand_cells_per_side = std::atoi(value);
+        }
+        else if (std::strcmp(option, "--sleep") == 0)
+        {
+            options->sleep_steps = std::atoi(value);
+        }
+        else if (std::strcmp(option, "--emit") == 0)
+        {
+            options->emit_rate = (float)std::atof(value);
+        }
+        else if (std::strcmp(option, "--seed") == 0)
+        {
+            options->seed = (unsigned)std::atoi(value);
+        }
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", option);
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+// Scenario: the default level, with particles spread over the lower half of the play area and planets on a ring
+// around its center (alternating symmetric and asymmetric). Planet 0 orbits slowly, like a planet dragged with F.
+static void headless_scenario_setup(
+    const HeadlessOptions* const options,
+    Environment* const env,
+    Particles* const particles,
+    ParticleEmitters* const emitters,
+    Planets* const planets,
+    SandGrid* const sand)
+{
+    environment_load_default_level(env);
+    sand_grid_rasterize_environment(sand, env);
+    sand->enabled = (options->sand_cells_per_side > 0);
+
+    std::srand(options->seed);
+    for (int i = 0; i < options->n_particles; ++i)
+    {
+        Vec2 position;
+        vec2_set_random_uniform_scaled(&position, BOUNDARY_LIMIT);
+        position.y = 0.5f * (position.y - BOUNDARY_LIMIT);
+        particles_spawn_at(particles, position);
+    }
+
+    if (options->emit_rate > 0.f)
+    {
+        particle_emitters_add(emitters, Vec2{0.f, 0.8f * BOUNDARY_LIMIT}, Vec2{0.f, 0.f}, options->emit_rate, 0.05f);
+    }
+
+    for (int p = 0; p < options->n_planets; ++p)
+    {
+        const float angle = 6.2831853f * (float)p / (float)options->n_planets;
+        const Vec2 position{0.6f * std::cos(angle), 0.6f * std::sin(angle)};
+        planets_spawn_at(planets, position, (p % 2) ? Vec2{0, 1} : Vec2{0, 0}, 0.5f);
+    }
+    planets->gravity_mode = options->gravity_mode;
+    particles->contact_mode = options->contact_mode;
+    particles->collision_mode = options->collision_mode;
+    particles_set_storage_mode(particles, options->storage_mode);
+    particles_set_sleep_steps(particles, options->sleep_steps);
+}
+
+static void headless_scenario_update(Planets* const planets, const int frame, const float dt)
+{
+    if (planets->n_active > 0 && (frame % 30) == 0)
+    {
+        const float angle = 0.5f * frame * dt;
+        planets->positions[0] = Vec2{0.6f * std::cos(angle), 0.6f * std::sin(angle)};
+        planets->dirty = true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    HeadlessOptions options;
+    if (!headless_parse_options(&options, argc, argv))
+    {
+        return 1;
+    }
+
+    Environment env;
+    environment_initialize(&env, N_ENVIRONMENT_LINES_INITIAL);
+
+    Particles particles;
+    particles_initialize(&particles, N_PARTICLES_INITIAL);
+
+    ParticleEmitters emitters;
+    particle_emitters_initialize(&emitters);
+
+    Planets planets;
+    planets_initialize(&planets, N_PLANETS_INITIAL);
+
+    ThreadPool thread_pool;
+    thread_pool_initialize(&thread_pool, options.n_threads);
+
+    WorkerAccumulators worker_accumulators;
+    worker_accumulators_initialize(&worker_accumulators, thread_pool_thread_count(&thread_pool), env.n_reserved, planets.n_reserved);
+
+    ZoneHistogram zone_histogram;
+    zone_histogram_initialize(&zone_histogram, AUDIO_HISTOGRAM_ZONES_PER_SIDE, AUDIO_HISTOGRAM_ZONES_PER_SIDE, thread_pool_thread_count(&thread_pool));
+
+    MemoryArena scratch;
+    memory_arena_initialize(&scratch, SIMULATION_SCRATCH_BYTES);
+
+    SandGrid sand;
+    sand_grid_initialize(&sand, imax(1, options.sand_cells_per_side), particles.n_reserved);
+
+    headless_scenario_setup(&options, &env, &particles, &emitters, &planets, &sand);
+
+    // One tick per frame, at the game's default tick rate
+    FixedTimestep timestep;
+    fixed_timestep_initialize(&timestep, 60.f, 1);
+    const float dt = fixed_timestep_dt(&timestep);
+
+    using HeadlessClock = std::chrono::steady_clock;
+    using SecondsDelta = std::chrono::duration<double>;
+
+    long long particle_steps = 0;
+    int captured = 0;
+    const HeadlessClock::time_point start = HeadlessClock::now();
+    for (int frame = 0; frame < options.n_frames; ++frame)
+    {
+        headless_scenario_update(&planets, frame, dt);
+        particle_steps += particles.n_active;
+        captured += simulation_tick(&env, &particles, &emitters, &planets, &sand, &thread_pool, &worker_accumulators, &zone_histogram, &scratch, dt);
+    }
+    const double seconds = SecondsDelta{HeadlessClock::now() - start}.count();
+
+    std::printf("simd         : %s\n", SIMD_NAME);
+#if defined(SNAD_HUGE_PAGES)
+    std::printf("huge pages   : on\n");
+#else
+    std::printf("huge pages   : off\n");
+#endif
+    std::printf("threads      : %d\n", thread_pool_thread_count(&thread_pool));
+    std::printf("gravity      : %s\n", PLANET_GRAVITY_MODE_NAMES[planets.gravity_mode]);
+    std::printf("contacts     : %s\n", PARTICLE_CONTACT_MODE_NAMES[particles.contact_mode]);
+    std::printf("collisions   : %s\n", PARTICLE_COLLISION_MODE_NAMES[particles.collision_mode]);
+    std::printf("storage      : %s\n", PARTICLE_STORAGE_MODE_NAMES[particles.storage_mode]);
+    if (sand.enabled)
+    {
+        std::printf("sand         : %d cells per side, %d grains, %d active chunks\n", sand.cells_per_side, sand_grid_count_grains(&sand), sand.n_active_chunks);
+    }
+    else
+    {
+        std::printf("sand         : off\n");
+    }
+    if (particles.sleep_steps > 0)
+    {
+        std::printf("sleep        : after %d steps, %d asleep\n", particles.sleep_steps, particles_count_asleep(&particles));
+    }
+    else
+    {
+        std::printf("sleep        : off\n");
+    }
+    if (emitters.n_active > 0)
+    {
+        std::printf("emitters     : %d, %g particles/s\n", emitters.n_active, options.emit_rate);
+    }
+    else
+    {
+        std::printf("emitters     : off\n");
+    }
+    std::printf("frames       : %d\n", options.n_frames);
+    std::printf("planets      : %d\n", planets.n_active);
+    std::printf("particles    : %d -> %d (%d captured)\n", options.n_particles, particles.n_active, captured);
+    std::printf("capacity     : %d particles, %d planets (of %d, %d reserved)\n", particles.n_max, planets.n_max, particles.n_reserved, planets.n_reserved);
+    std::printf("elapsed      : %.3f s (%.3f ms/frame)\n", seconds, 1e3 * seconds / options.n_frames);
+    std::printf("throughput   : %.4g particle-steps/s\n", particle_steps / seconds);
+
+    if (particles.storage_mode == PARTICLE_STORAGE_INT16)
+    {
+        static const int ACCURACY_TICKS[] = {1, 60};
+        for (const int n_ticks : ACCURACY_TICKS)
+        {
+            ParticleStorageAccuracy accuracy;
+            particles_measure_storage_accuracy(&accuracy, &particles, &env, &planets, n_ticks, dt);
+            std::printf(
+                "accuracy     : %d ticks, position error %.3g max / %.3g rms, velocity error %.3g max / %.3g rms, %d alive mismatches\n",
+                accuracy.n_ticks,
+                accuracy.position_max_error,
+                accuracy.position_rms_error,
+                accuracy.velocity_max_error,
+                accuracy.velocity_rms_error,
+                accuracy.n_alive_mismatches
+            );
+        }
+    }
+
+    sand_grid_destroy(&sand);
+    memory_arena_destroy(&scratch);
+    zone_histogram_destroy(&zone_histogram);
+    worker_accumulators_destroy(&worker_accumulators);
+    thread_pool_destroy(&thread_pool);
+    planets_destroy(&planets);
+    particles_destroy(&particles);
+    environment_destroy(&env);
+    return 0;
+}
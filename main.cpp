@@ -1,4 +1,5 @@
 // C++ Standard Library
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <cstring>
@@ -28,8 +29,10 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+// Simulation core
+#include "simulation.inl"
+
 // Utility
-#include "math.inl"
 #include "graphics.inl"
 
 
@@ -59,478 +62,6 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 }
 
 
-// for each point
-//    for each line
-//       if intersects(point, line)
-//          DEFLECT(point.velocity, line.normal)
-//
-
-
-static const float BOUNDARY_PADDING = 0.05f;
-static const float BOUNDARY_LIMIT = 1.f - BOUNDARY_PADDING;
-
-
-void integrate_states_fixed_step(Vec2* positions, Vec2* velocities, Vec2* acceleratons, int n, float dt)
-{
-    for (int i = 0; i < n; ++i)
-    {
-        // f = m * a
-        // a = f / m = f * inv_mass
-        // v += a * dt
-        vec2_scale_compound_add(velocities + i, acceleratons + i, dt);
-
-        // x += v * dt
-        vec2_scale_compound_add(positions + i, velocities + i, dt);
-    }
-}
-
-
-static const int N_ENVIRONMENT_LINES_MAX = 10;
-
-struct EnvironmentBoundaryProperties
-{
-    float tail_hits;
-    float head_hits;
-};
-
-struct Environment
-{
-    AABB goal;
-    AABB valid_placement;
-    Line* boundaries;
-    Vec2* normals;
-    EnvironmentBoundaryProperties* boundary_properties;
-    int n_boundaries;
-    int n_max;
-
-    float boundary_thickness;
-    float dampening;
-    Vec2 gravity;
-};
-
-void environment_initialize(Environment* const env, const int boundary_count)
-{
-    env->boundaries = (Line*)std::malloc(sizeof(Line) * boundary_count);
-    env->normals = (Vec2*)std::malloc(sizeof(Vec2) * boundary_count);
-    env->boundary_properties = (EnvironmentBoundaryProperties*)std::malloc(sizeof(EnvironmentBoundaryProperties) * boundary_count);
-    env->dampening = 0.7f;
-    env->gravity.x = 0.0f;
-    env->gravity.y = -0.123f;
-    env->boundary_thickness = 1e-3f;
-    env->n_boundaries = 0;
-    env->n_max = boundary_count;
-}
-
-void environment_update(Environment* const env, const float dt)
-{
-    // Decay hit accumulators over time
-    for (int l = 0; l < env->n_boundaries; ++l)
-    {
-        (env->boundary_properties + l)->tail_hits = std::fmin(50.f, std::fmax(0.f, (env->boundary_properties + l)->tail_hits - 50.f * dt));
-        (env->boundary_properties + l)->head_hits = std::fmin(50.f, std::fmax(0.f, (env->boundary_properties + l)->head_hits - 50.f * dt));
-    }
-}
-
-void environment_add_boundary(Environment* const env, const Vec2 tail, const Vec2 head)
-{
-    // Don't add anything if we are already at/over the max allocated boundary count
-    if (env->n_boundaries >= env->n_max)
-    {
-        return;
-    }
-
-    // Add boundary points
-    if (tail.x < head.x)
-    {
-        (env->boundaries + env->n_boundaries)->tail = tail;
-        (env->boundaries + env->n_boundaries)->head = head;
-    }
-    else
-    {
-        (env->boundaries + env->n_boundaries)->tail = head;
-        (env->boundaries + env->n_boundaries)->head = tail;
-    }
-
-    // Initialize properties
-    std::memset(env->boundary_properties + env->n_boundaries, 0, sizeof(EnvironmentBoundaryProperties));
-
-    // Compute normal for boundary
-    *(env->normals + env->n_boundaries) = line_to_normal(env->boundaries + env->n_boundaries);
-
-    // Count new boundary
-    ++env->n_boundaries;
-}
-
-bool environment_is_boundary_between(const Environment* const env, const Vec2* const start, const Vec2* const end)
-{
-    // TODO(enhancment) only check intercept on nearby boundary lines
-    for (int l = 0; l < env->n_boundaries; ++l)
-    {
-        if (vec2_segment_segment_intercept_check(
-            &(env->boundaries + l)->tail,
-            &(env->boundaries + l)->head,
-            start,
-            end
-        ))
-        {
-            return true;
-        }
-    }
-    return false;
-}
-
-void environment_destroy(Environment* const env)
-{
-    std::free(env->boundaries);
-    std::free(env->boundary_properties);
-    std::free(env->normals);
-}
-
-struct Particles
-{
-    int* left_shift_index_buffer;
-    Vec2* positions_previous;
-    Vec2* positions;
-    Vec2* velocities;
-    Vec2* forces;
-    bool* alive;
-    int n_active;
-    int n_max;
-    float max_velocity;
-};
-
-void particles_initialize(Particles* const ps, const int particle_count)
-{
-    ps->left_shift_index_buffer = (int*)std::malloc(sizeof(int) * particle_count);
-
-    ps->positions_previous = (Vec2*)std::malloc(sizeof(Vec2) * particle_count);
-    vec2_set_zero_n(ps->positions_previous, particle_count);
-
-    ps->positions = (Vec2*)std::malloc(sizeof(Vec2) * particle_count);
-    vec2_set_zero_n(ps->positions, particle_count);
-
-    ps->velocities = (Vec2*)std::malloc(sizeof(Vec2) * particle_count);
-    vec2_set_zero_n(ps->velocities, particle_count);
-
-    ps->forces = (Vec2*)std::malloc(sizeof(Vec2) * particle_count);
-    vec2_set_zero_n(ps->forces, particle_count);
-
-    ps->alive = (bool*)std::malloc(sizeof(bool) * particle_count);
-    std::memset(ps->alive, 0, sizeof(bool) * particle_count);
-
-    ps->n_active = 0;
-    ps->n_max = particle_count;
-    ps->max_velocity = 2.5;
-}
-
-void particles_spawn_at(Particles* const ps, const Vec2 position)
-{
-    if (ps->n_active >= ps->n_max)
-    {
-        return;
-    }
-
-    // Initialize point state
-    vec2_set(ps->positions + ps->n_active, &position);
-    vec2_set(ps->positions_previous + ps->n_active, &position);
-    vec2_set_zero(ps->velocities + ps->n_active);
-    vec2_set_zero(ps->forces + ps->n_active);
-    ps->alive[ps->n_active] = true;
-
-    // Increment number of active particles
-    ++ps->n_active;
-}
-
-void particles_clear(Particles* const ps)
-{
-    ps->n_active = 0;
-}
-
-inline void particles_prune_dead(Particles* const ps)
-{
-    // Shift all "alive" particles leftward in the arrays
-    int n_particles_alive = 0;
-    for (int i = 0; i < ps->n_active; ++i)
-    {
-        if (ps->alive[i])
-        {
-            ps->left_shift_index_buffer[n_particles_alive] = i;
-            ++n_particles_alive;
-        }
-    }
-
-    // Do nothing if all particles are alive
-    if (n_particles_alive == ps->n_active)
-    {
-        return;
-    }
-
-    // Shift each component seperately because, at least theoretically, this should be faster due to cache coherency.
-    // TODO(performance) does doing it in one loop and letting the compiler figure it out work better?
-    for (int s = 0; s < n_particles_alive; ++s)
-    {
-        const int j = ps->left_shift_index_buffer[s];
-        ps->positions_previous[s] = ps->positions_previous[j];
-    }
-    for (int s = 0; s < n_particles_alive; ++s)
-    {
-        const int j = ps->left_shift_index_buffer[s];
-        ps->positions[s] = ps->positions[j];
-    }
-    for (int s = 0; s < n_particles_alive; ++s)
-    {
-        const int j = ps->left_shift_index_buffer[s];
-        ps->velocities[s] = ps->velocities[j];
-    }
-    for (int s = 0; s < n_particles_alive; ++s)
-    {
-        const int j = ps->left_shift_index_buffer[s];
-        ps->forces[s] = ps->forces[j];
-    }
-
-    // All remaining particles are alive
-    std::memset(ps->alive, 0xFF, n_particles_alive);
-
-    // Finally set the number of "alive" particles as the active particle count
-    ps->n_active = n_particles_alive;
-}
-
-void particles_update(Particles* const ps, const Environment* const env, const float dt)
-{
-    // Cache previous states
-    vec2_copy_n(ps->positions_previous, ps->positions, ps->n_active);
-
-    // // Divide by particle mass
-    // for (int i = 0; i < ps->n_active; ++i)
-    // {
-    //     (ps->forces + i)->x *= 2.f;
-    //     (ps->forces + i)->y *= 2.f;
-    // }
-
-    // Update point states BEFORE collision resolution to figure out
-    // where points will be next as if they hadn't collided
-    integrate_states_fixed_step(ps->positions, ps->velocities, ps->forces, ps->n_active, dt);
-
-    // Collide points and environment lines
-    for (int i = 0; i < ps->n_active; ++i)
-    {
-        // TODO(enhancement) limit search to nearby boundaries
-        for (int l = 0; l < env->n_boundaries; ++l)
-        {
-            // Particle shot through boundary
-            Vec2 intercept_result;
-            if (vec2_segment_segment_intercept(
-                &intercept_result,
-                (ps->positions + i),
-                (ps->positions_previous + i),
-                &(env->boundaries + l)->tail,
-                &(env->boundaries + l)->head
-            ))
-            {
-                // Set new location to intercept point
-                vec2_set(ps->positions + i, &intercept_result);
-
-                // Offset to a bit above the intercept point if comming from above
-                if (vec2_above_line_with_normal(env->boundaries + l, env->normals + l, ps->positions_previous + i))
-                {
-                    vec2_scale_compound_add(ps->positions + i, env->normals + l, 3.f * env->boundary_thickness);
-                }
-                // Offset to a bit below the intercept point if comming from below
-                else
-                {
-                    vec2_scale_compound_add(ps->positions + i, env->normals + l, -3.f * env->boundary_thickness);
-                }
-
-                // Reflect and dampen velocity vector
-                vec2_reflect(ps->velocities + i, ps->velocities + i, env->normals + l);
-                vec2_scale(ps->velocities + i, env->dampening);
-
-                // TODO(enhancement) count particle intersection ("hits") nearest to endpoint; for now, counting hits for both
-                // Count boundary hits when particle collide hard with boundaries
-                const float approx_energy = 0.5f * vec2_length_manhattan(ps->velocities + i);
-                (env->boundary_properties + l)->tail_hits += approx_energy;
-                (env->boundary_properties + l)->head_hits += approx_energy;
-                break;
-            }
-            // Particle right above boundary
-            else if (vec2_near_segment_with_normal(env->boundaries + l, env->normals + l, ps->positions + i, env->boundary_thickness))
-            {
-                // Set new location as last location
-                vec2_set(ps->positions + i, ps->positions_previous + i);
-
-                // Offset to a bit above the intercept point if comming from above
-                if (vec2_above_line_with_normal(env->boundaries + l, env->normals + l, ps->positions_previous + i))
-                {
-                    vec2_scale_compound_add(ps->positions + i, env->normals + l, 3.f * env->boundary_thickness);
-                }
-                // Offset to a bit below the intercept point if comming from below
-                else
-                {
-                    vec2_scale_compound_add(ps->positions + i, env->normals + l, -3.f * env->boundary_thickness);
-                }
-
-                // Reflect and dampen velocity vector
-                vec2_reflect(ps->velocities + i, ps->velocities + i, env->normals + l);
-                vec2_scale(ps->velocities + i, env->dampening);
-
-                // TODO(enhancement) count particle intersection ("hits") nearest to endpoint; for now, counting hits for both
-                // Count boundary hits when particle collide hard with boundaries
-                const float approx_energy = 0.5f * vec2_length_manhattan(ps->velocities + i);
-                (env->boundary_properties + l)->tail_hits += approx_energy;
-                (env->boundary_properties + l)->head_hits += approx_energy;
-                break;
-            }
-        }
-    }
-
-    // Apply hard limits on velocities
-    for (int i = 0; i < ps->n_active; ++i)
-    {
-        vec2_clamp(ps->velocities + i, -(ps->max_velocity), ps->max_velocity);
-    }
-
-    // Apply hard screen limits on position
-    for (int i = 0; i < ps->n_active; ++i)
-    {
-        vec2_clamp(ps->positions + i, -BOUNDARY_LIMIT, +BOUNDARY_LIMIT);
-    }
-
-    vec2_set_n(ps->forces, &env->gravity, ps->n_active);
-}
-
-void particles_destroy(Particles* const ps)
-{
-    std::free(ps->left_shift_index_buffer);
-    std::free(ps->positions_previous);
-    std::free(ps->positions);
-    std::free(ps->velocities);
-    std::free(ps->forces);
-    std::free(ps->alive);
-}
-
-struct PlanetProperties
-{
-    float age;
-    float mass;
-};
-
-struct Planets
-{
-    Vec2* positions;
-    Vec2* directions;
-    PlanetProperties* properties;
-
-    int n_active;
-    int n_max;
-};
-
-void planets_initialize(Planets* const planets, const int planets_count)
-{
-    planets->positions = (Vec2*)std::malloc(sizeof(Vec2) * planets_count);
-    vec2_set_zero_n(planets->positions, planets_count);
-
-    planets->directions = (Vec2*)std::malloc(sizeof(Vec2) * planets_count);
-    vec2_set_zero_n(planets->directions, planets_count);
-
-    planets->properties = (PlanetProperties*)std::malloc(sizeof(PlanetProperties) * planets_count);
-    std::memset(planets->properties, 0, sizeof(PlanetProperties) * planets_count);
-
-    planets->n_active = 0;
-    planets->n_max = planets_count;
-}
-
-void planets_spawn_at(Planets* const planets, const Vec2 position, const Vec2 direction, const float mass)
-{
-    if (planets->n_active >= planets->n_max)
-    {
-        return;
-    }
-
-    // Initialize point state
-    vec2_set(planets->positions + planets->n_active, &position);
-    vec2_set(planets->directions + planets->n_active, &direction);
-
-    // Initialize mass
-    (planets->properties + planets->n_active)->mass = mass;
-
-    // Initialize time alive
-    (planets->properties + planets->n_active)->age = 0.f;
-
-    // Increment number of active particles
-    ++planets->n_active;
-}
-
-void planets_update(Planets* const planets, const float dt)
-{
-    for (int i = 0; i < planets->n_active; ++i)
-    {
-        planets->properties[i].age += dt;
-    }
-}
-
-void planets_apply_to_particles(const Planets* const planets, const Environment* const env, Particles* const ps)
-{
-    // Calc pull of each planet on each particle; add results to forces
-    for (int i = 0; i < ps->n_active; ++i)
-    {
-        for (int p = 0; p < planets->n_active; ++p)
-        {
-            Vec2 delta;
-
-            // Force is planet_position - particle_position
-            delta.x = (ps->positions + i)->x - (planets->positions + p)->x;
-            delta.y = (ps->positions + i)->y - (planets->positions + p)->y;
-
-            // The "direction" of a planet's field basically splits it into two-halves. On one side, its an attractor,
-            // and the other a repeller. It seems like this sort of asymmetry is needed to make the game more playable
-            // otherwise, you end up with particles cycling clusters of planets in chaos as opposed to getting "flung,"
-            // unless you are extremely careful, which is not fun IMO.
-            const bool is_symmetric = (vec2_length_squared(planets->directions + p) < 1e-4f);
-            const float sign = (is_symmetric)*(-1.f) +
-                               (!is_symmetric)*std::copysign(1.f, vec2_dot(&delta, planets->directions + p));
-
-            // Squared distance between planet and particle
-            const float r_sq = vec2_length_squared(&delta);
-
-            // TODO(debug) make this tunable?
-            static const float PLANET_SURFACE_RADIUS = 0.02f;
-            static const float PLANET_SURFACE_RADIUS_SQ = PLANET_SURFACE_RADIUS * PLANET_SURFACE_RADIUS;
-
-            // If a prticle is too close to the planet surface, do not update and mark for death on next update
-            if (r_sq < PLANET_SURFACE_RADIUS_SQ)
-            {
-                // Kill off the particle
-                ps->alive[i] = false;
-
-                // TODO(enhancement) make tunable?
-                static const float PARTICLE_MASS_GAINED = 5e-3f;
-
-                // Increase the mass of the planet
-                (planets->properties + p)->mass += PARTICLE_MASS_GAINED;
-                break;
-            }
-            else
-            {
-                // NOTE: this is no longer consistent with the Newtonian gravitational
-                //       model, but make attractions more stable
-                vec2_scale_compound_add(ps->forces + i, &delta, sign * ((planets->properties + p)->mass / (r_sq + 1e-5f)));
-            }
-        }
-    }
-}
-
-void planets_clear(Planets* const planets)
-{
-    planets->n_active = 0;
-}
-
-void planets_destroy(Planets* const planets)
-{
-    std::free(planets->positions);
-    std::free(planets->directions);
-    std::free(planets->properties);
-}
-
 union Buttons
 {
     struct BitField
@@ -552,14 +83,21 @@ struct RenderPipelineData
     GLuint particles_shader;
     GLuint particles_vao;
     GLuint particles_vbo;
+    int particles_vbo_capacity;
 
     GLuint planets_shader;
     GLuint planets_vao;
     GLuint planets_vbo;
+    int planets_vbo_capacity;
 
     GLuint environment_shader;
     GLuint environment_vao;
     GLuint environment_vbo;
+    int environment_vbo_capacity;
+
+    GLuint sand_shader;
+    GLuint sand_vao;
+    GLuint sand_texture;
 
     float aspect_ratio;
     float display_h;
@@ -568,11 +106,24 @@ struct RenderPipelineData
     GLFWwindow* window;
 };
 
+// Binds vbo, and reallocates it for count elements of element_bytes if it holds fewer, so that vertex buffers keep up
+// with the (growable) simulation pools
+void render_pipeline_fit_buffer(const GLuint vbo, int* const capacity, const int count, const std::size_t element_bytes)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (count > *capacity)
+    {
+        glBufferData(GL_ARRAY_BUFFER, count * element_bytes, 0, GL_DYNAMIC_DRAW);
+        *capacity = count;
+    }
+}
+
 void render_pipeline_initialize(RenderPipelineData* const r_data,
                                 GLFWwindow* const window,
                                 const Planets* const planets,
                                 const Particles* const particles,
-                                const Environment* const environment)
+                                const Environment* const environment,
+                                const SandGrid* const sand)
 {
     // Enable alpha blending
     glEnable(GL_BLEND);
@@ -584,8 +135,14 @@ void render_pipeline_initialize(RenderPipelineData* const r_data,
             GL_VERTEX_SHADER,
             R"VertexShader(
                 #version 330 core
-                layout (location = 0) in vec2 aPos;
-                layout (location = 1) in vec2 aVel;
+                layout (location = 0) in float aPosX;
+                layout (location = 1) in float aPosY;
+                layout (location = 2) in float aVelX;
+                layout (location = 3) in float aVelY;
+
+                // Attribute scales, for normalized int16 attributes
+                uniform float uPositionScale;
+                uniform float uVelocityScale;
 
                 out vec4 VertColor;
 
@@ -596,8 +153,8 @@ void render_pipeline_initialize(RenderPipelineData* const r_data,
 
                 void main()
                 {
-                    float mag = sqrt(aVel.x * aVel.x + aVel.y * aVel.y);
-                    gl_Position = vec4(aPos.x, aPos.y, 0.0, 1.0);
+                    float mag = uVelocityScale * sqrt(aVelX * aVelX + aVelY * aVelY);
+                    gl_Position = vec4(uPositionScale * aPosX, uPositionScale * aPosY, 0.0, 1.0);
                     VertColor = lerp(vec4(mag, 0.3 * mag, 1.f-mag, 1), vec4(1, 1, 1, 0.3), 0.9);
                 }
             )VertexShader"
@@ -674,8 +231,8 @@ void render_pipeline_initialize(RenderPipelineData* const r_data,
     glGenVertexArrays(1, &r_data->particles_vao);
     glBindVertexArray(r_data->particles_vao);
     glGenBuffers(1, &r_data->particles_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, r_data->particles_vbo);
-    glBufferData(GL_ARRAY_BUFFER, particles->n_max * sizeof(Vec2), 0, GL_DYNAMIC_DRAW);
+    r_data->particles_vbo_capacity = 0;
+    render_pipeline_fit_buffer(r_data->particles_vbo, &r_data->particles_vbo_capacity, particles->n_max, sizeof(Vec2) + sizeof(Vec2));
 
     // Create shader for planets
     {
@@ -791,8 +348,8 @@ void render_pipeline_initialize(RenderPipelineData* const r_data,
     glGenVertexArrays(1, &r_data->planets_vao);
     glBindVertexArray(r_data->planets_vao);
     glGenBuffers(1, &r_data->planets_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, r_data->planets_vbo);
-    glBufferData(GL_ARRAY_BUFFER, planets->n_max * sizeof(Vec2), 0, GL_DYNAMIC_DRAW);
+    r_data->planets_vbo_capacity = 0;
+    render_pipeline_fit_buffer(r_data->planets_vbo, &r_data->planets_vbo_capacity, planets->n_max, sizeof(Vec2) + sizeof(PlanetProperties));
 
     // Create shader for environment
     {
@@ -887,8 +444,92 @@ void render_pipeline_initialize(RenderPipelineData* const r_data,
     glGenVertexArrays(1, &r_data->environment_vao);
     glBindVertexArray(r_data->environment_vao);
     glGenBuffers(1, &r_data->environment_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, r_data->environment_vbo);
-    glBufferData(GL_ARRAY_BUFFER, environment->n_max * (sizeof(Line) + sizeof(EnvironmentBoundaryProperties)), 0, GL_DYNAMIC_DRAW);
+    r_data->environment_vbo_capacity = 0;
+    render_pipeline_fit_buffer(r_data->environment_vbo, &r_data->environment_vbo_capacity, environment->n_max, sizeof(Line) + sizeof(EnvironmentBoundaryProperties));
+
+    // Create shader for sand, which draws the sand grid (as an integer texture) over the play area from a single point
+    {
+        const GLuint vert_shader = create_shader_source(
+            GL_VERTEX_SHADER,
+            R"VertexShader(
+                #version 330 core
+
+                void main()
+                {
+                    gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+                }
+            )VertexShader"
+        );
+        const GLuint frag_shader = create_shader_source(
+            GL_FRAGMENT_SHADER,
+            R"FragmentShader(
+                #version 330 core
+
+                uniform usampler2D uCells;
+
+                in vec2 gTexCoord;
+                out vec4 FragColor;
+                void main()
+                {
+                    // Cell material is in the low 7 bits; 1 is a grain
+                    uint material = texture(uCells, gTexCoord).r & 0x7Fu;
+                    if (material != 1u)
+                    {
+                        discard;
+                    }
+
+                    // Vary the shade of each grain a little
+                    vec2 cell = floor(gTexCoord * vec2(textureSize(uCells, 0)));
+                    float shade = 0.8 + 0.2 * fract(sin(dot(cell, vec2(12.9898, 78.233))) * 43758.5453);
+                    FragColor = vec4(0.9 * shade, 0.75 * shade, 0.45 * shade, 1.0);
+                }
+            )FragmentShader"
+        );
+        const GLuint geom_shader = create_shader_source(
+            GL_GEOMETRY_SHADER,
+            R"GeometryShader(
+                #version 330 core
+
+                layout(points) in;
+                layout(triangle_strip, max_vertices = 4) out;
+
+                uniform float uAspectRatio;
+
+                out vec2 gTexCoord;
+
+                void main()
+                {
+                    for (int i = 0; i < 4; i++)
+                    {
+                        vec2 corner = vec2(float(i % 2), float(i / 2));
+                        gTexCoord = corner;
+                        gl_Position = vec4((2.0 * corner.x - 1.0) * uAspectRatio, 2.0 * corner.y - 1.0, 0.0, 1.0);
+                        EmitVertex();
+                    }
+                    EndPrimitive();
+                }
+            )GeometryShader"
+        );
+
+        // Link shaders into program
+        r_data->sand_shader = link_shader_program(vert_shader, frag_shader, &geom_shader);
+
+        // Cleanup shader source
+        glDeleteShader(vert_shader);
+        glDeleteShader(frag_shader);
+        glDeleteShader(geom_shader);
+    }
+
+    // Setup (attribute-less) vertex array and cell texture for sand
+    glGenVertexArrays(1, &r_data->sand_vao);
+    glGenTextures(1, &r_data->sand_texture);
+    glBindTexture(GL_TEXTURE_2D, r_data->sand_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, sand->cells_per_side, sand->cells_per_side, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
     // Unset VBO/VAO
     glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -912,12 +553,15 @@ void render_pipeline_destroy(RenderPipelineData* const r_data)
     glDeleteVertexArrays(1, &r_data->particles_vao);
     glDeleteVertexArrays(1, &r_data->planets_vao);
     glDeleteVertexArrays(1, &r_data->environment_vao);
+    glDeleteVertexArrays(1, &r_data->sand_vao);
     glDeleteBuffers(1, &r_data->particles_vbo);
     glDeleteBuffers(1, &r_data->planets_vbo);
     glDeleteBuffers(1, &r_data->environment_vbo);
     glDeleteProgram(r_data->particles_shader);
     glDeleteProgram(r_data->planets_shader);
     glDeleteProgram(r_data->environment_shader);
+    glDeleteProgram(r_data->sand_shader);
+    glDeleteTextures(1, &r_data->sand_texture);
 }
 
 void render_pipeline_draw_points(const GLuint vao, const GLuint vbo, const Vec2* const points, const int n_points)
@@ -964,6 +608,29 @@ void render_pipeline_draw_points_with_direction(const GLuint vao, const GLuint v
     glDrawArrays(GL_POINTS, 0, n_points);
 }
 
+// Uploads each component array as its own attribute, i.e. [x0, x1, ..., y0, y1, ..., vx0, vx1, ...]; components are
+// either GL_FLOAT, or GL_SHORT (normalized to [-1, 1] in the shader)
+void render_pipeline_draw_points_components(const GLuint vao, const GLuint vbo, const void* const* const components, const GLenum type, const int n_components, const int n_points)
+{
+    const int value_size = (type == GL_SHORT) ? sizeof(std::int16_t) : sizeof(float);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    for (int c = 0; c < n_components; ++c)
+    {
+        glEnableVertexAttribArray(c);
+        glVertexAttribPointer(
+            c,                  // attribute c, must match the layout in the shader
+            1,                  // size
+            type,               // type
+            (type == GL_SHORT) ? GL_TRUE : GL_FALSE, // normalized?
+            value_size,         // stride
+            (void*)(std::size_t)(c * n_points * value_size) // array buffer offset
+        );
+        glBufferSubData(GL_ARRAY_BUFFER, c * n_points * value_size, n_points * value_size, components[c]);
+    }
+    glDrawArrays(GL_POINTS, 0, n_points);
+}
+
 void render_pipeline_draw_lines(const GLuint vao, const GLuint vbo, const Line* const lines, const int n_lines)
 {
     // TODO(optimization) environment data need only be uploaded once, so glBufferData is redundant on
@@ -990,7 +657,7 @@ void render_pipeline_draw_planets(RenderPipelineData* const r_data, const Planet
     glUseProgram(r_data->planets_shader);
     glUniform1f(glGetUniformLocation(r_data->planets_shader, "uAspectRatio"), r_data->aspect_ratio);
     glBindVertexArray(r_data->planets_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, r_data->planets_vbo);
+    render_pipeline_fit_buffer(r_data->planets_vbo, &r_data->planets_vbo_capacity, planets->n_max, sizeof(Vec2) + sizeof(PlanetProperties));
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(
         0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
@@ -1016,11 +683,38 @@ void render_pipeline_draw_planets(RenderPipelineData* const r_data, const Planet
     glDrawArrays(GL_POINTS, 0, n_points);
 }
 
-void render_pipeline_draw_particles(RenderPipelineData* const r_data, const Particles* const particles)
+// Draws particles at positions (e.g. interpolated between ticks) rather than their simulated positions
+void render_pipeline_draw_particles(RenderPipelineData* const r_data, const Particles* const particles, const Vec2Array* const positions)
 {
     glUseProgram(r_data->particles_shader);
     glUniform1f(glGetUniformLocation(r_data->particles_shader, "uAspectRatio"), r_data->aspect_ratio);
-    render_pipeline_draw_points_with_direction(r_data->particles_vao, r_data->particles_vbo, particles->positions, particles->velocities, particles->n_active);
+    glUniform1f(glGetUniformLocation(r_data->particles_shader, "uPositionScale"), 1.f);
+    glUniform1f(glGetUniformLocation(r_data->particles_shader, "uVelocityScale"), 1.f);
+    const void* const components[4] = {
+        positions->x,
+        positions->y,
+        particles->velocities.x,
+        particles->velocities.y
+    };
+    render_pipeline_fit_buffer(r_data->particles_vbo, &r_data->particles_vbo_capacity, particles->n_max, sizeof(Vec2) + sizeof(Vec2));
+    render_pipeline_draw_points_components(r_data->particles_vao, r_data->particles_vbo, components, GL_FLOAT, 4, particles->n_active);
+}
+
+// Same as render_pipeline_draw_particles, for particles in compact storage; uploads half as much
+void render_pipeline_draw_compact_particles(RenderPipelineData* const r_data, const Particles* const particles, const Vec2ArrayI16* const positions)
+{
+    glUseProgram(r_data->particles_shader);
+    glUniform1f(glGetUniformLocation(r_data->particles_shader, "uAspectRatio"), r_data->aspect_ratio);
+    glUniform1f(glGetUniformLocation(r_data->particles_shader, "uPositionScale"), 32767.f * PARTICLE_COMPACT_POSITION_SCALE);
+    glUniform1f(glGetUniformLocation(r_data->particles_shader, "uVelocityScale"), 32767.f * PARTICLE_COMPACT_VELOCITY_SCALE);
+    const void* const components[4] = {
+        positions->x,
+        positions->y,
+        particles->compact_velocities.x,
+        particles->compact_velocities.y
+    };
+    render_pipeline_fit_buffer(r_data->particles_vbo, &r_data->particles_vbo_capacity, particles->n_max, sizeof(Vec2) + sizeof(Vec2));
+    render_pipeline_draw_points_components(r_data->particles_vao, r_data->particles_vbo, components, GL_SHORT, 4, particles->n_active);
 }
 
 void render_pipeline_draw_environment(RenderPipelineData* const r_data, const Environment* const environment)
@@ -1029,7 +723,7 @@ void render_pipeline_draw_environment(RenderPipelineData* const r_data, const En
     glUseProgram(r_data->environment_shader);
     glUniform1f(glGetUniformLocation(r_data->environment_shader, "uAspectRatio"), r_data->aspect_ratio);
     glBindVertexArray(r_data->environment_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, r_data->environment_vbo);
+    render_pipeline_fit_buffer(r_data->environment_vbo, &r_data->environment_vbo_capacity, environment->n_max, sizeof(Line) + sizeof(EnvironmentBoundaryProperties));
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(
         0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
@@ -1055,6 +749,20 @@ void render_pipeline_draw_environment(RenderPipelineData* const r_data, const En
     glDrawArrays(GL_LINES, 0, 2 * n_boundaries);
 }
 
+void render_pipeline_draw_sand(RenderPipelineData* const r_data, const SandGrid* const sand)
+{
+    glUseProgram(r_data->sand_shader);
+    glUniform1f(glGetUniformLocation(r_data->sand_shader, "uAspectRatio"), r_data->aspect_ratio);
+    glUniform1i(glGetUniformLocation(r_data->sand_shader, "uCells"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, r_data->sand_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, sand->cells_per_side, sand->cells_per_side, GL_RED_INTEGER, GL_UNSIGNED_BYTE, sand->cells);
+    glBindVertexArray(r_data->sand_vao);
+    glDrawArrays(GL_POINTS, 0, 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 Vec2 render_pipeline_get_screen_mouse_position(RenderPipelineData* const r_data)
 {
     Vec2 cursor_position;
@@ -1864,58 +1572,8 @@ int main(int, char**)
 
     // Initialize game level
     Environment env;
-    environment_initialize(&env, N_ENVIRONMENT_LINES_MAX);
-    // bottom wall
-    environment_add_boundary(
-        &env,
-        Vec2{-BOUNDARY_LIMIT, -BOUNDARY_LIMIT},
-        Vec2{+BOUNDARY_LIMIT, -BOUNDARY_LIMIT}
-    );
-    // right wall
-    environment_add_boundary(
-        &env,
-        Vec2{+BOUNDARY_LIMIT, -BOUNDARY_LIMIT},
-        Vec2{+BOUNDARY_LIMIT, +BOUNDARY_LIMIT}
-    );
-    // top wall
-    environment_add_boundary(
-        &env,
-        Vec2{-BOUNDARY_LIMIT, +BOUNDARY_LIMIT},
-        Vec2{+BOUNDARY_LIMIT, +BOUNDARY_LIMIT}
-    );
-    // left wall
-    environment_add_boundary(
-        &env,
-        Vec2{-BOUNDARY_LIMIT, -BOUNDARY_LIMIT},
-        Vec2{-BOUNDARY_LIMIT, +BOUNDARY_LIMIT}
-    );
-
-    // add some hard-coded level stuff
-    environment_add_boundary(
-        &env,
-        Vec2{-0.5f * BOUNDARY_LIMIT, +0.5 * BOUNDARY_LIMIT},
-        Vec2{+1.0f * BOUNDARY_LIMIT, +0.5 * BOUNDARY_LIMIT}
-    );
-    environment_add_boundary(
-        &env,
-        Vec2{-1.0f * BOUNDARY_LIMIT, -0.5 * BOUNDARY_LIMIT},
-        Vec2{+0.5f * BOUNDARY_LIMIT, -0.5 * BOUNDARY_LIMIT}
-    );
-
-    environment_add_boundary(
-        &env,
-        Vec2{-0.2f * BOUNDARY_LIMIT, -0.2 * BOUNDARY_LIMIT},
-        Vec2{+0.2f * BOUNDARY_LIMIT, +0.2 * BOUNDARY_LIMIT}
-    );
-
-    env.goal = aabb_create(
-        Vec2{BOUNDARY_LIMIT - 0.4, BOUNDARY_LIMIT - 0.4},
-        Vec2{BOUNDARY_LIMIT - 0.1, BOUNDARY_LIMIT - 0.1}
-    );
-    env.valid_placement = aabb_create(
-        Vec2{-BOUNDARY_LIMIT, -BOUNDARY_LIMIT},
-        Vec2{+BOUNDARY_LIMIT, +BOUNDARY_LIMIT}
-    );
+    environment_initialize(&env, N_ENVIRONMENT_LINES_INITIAL);
+    environment_load_default_level(&env);
 
     // Initialize text_regions
     enum TextRegionType {
@@ -1936,16 +1594,47 @@ int main(int, char**)
         text_region_create_centered(&text_render_pipeline_data, "restart?", Vec2{0, -0.4}, 0.05f)
     };
 
-    static const int N_PLANETS_MAX = 1000;
-    static const int N_POINTS_MAX = 200000;
-
     // Initialize particles
     Particles particles;
-    particles_initialize(&particles, N_POINTS_MAX);
+    particles_initialize(&particles, N_PARTICLES_INITIAL);
+
+    // Emitters; the first one spews particles from the mouse while shift-clicking, and is paused otherwise
+    ParticleEmitters emitters;
+    particle_emitters_initialize(&emitters);
+    ParticleEmitter* const mouse_emitter = emitters.emitters + particle_emitters_add(&emitters, Vec2{0, 0}, Vec2{0, 0}, 0.f, 0.01f);
+    float mouse_spew_rate = 600.f;
+
+    // Particle positions interpolated between the last two ticks, for rendering; these grow along with particles
+    Vec2Array particle_render_positions;
+    vec2_array_reserve(&particle_render_positions, nullptr, particles.n_reserved);
+    Vec2ArrayI16 particle_render_compact_positions;
+    vec2_array_i16_reserve(&particle_render_compact_positions, nullptr, particles.n_reserved);
+    int particle_render_capacity = 0;
 
     // Initial planets
     Planets planets;
-    planets_initialize(&planets, N_PLANETS_MAX);
+    planets_initialize(&planets, N_PLANETS_INITIAL);
+
+    // Start worker threads for particle updates
+    ThreadPool thread_pool;
+    thread_pool_initialize(&thread_pool, 0);
+
+    WorkerAccumulators worker_accumulators;
+    worker_accumulators_initialize(&worker_accumulators, thread_pool_thread_count(&thread_pool), env.n_reserved, planets.n_reserved);
+
+    // Particle counts per zone as of the last simulation tick, which drive audio zone gains
+    ZoneHistogram zone_histogram;
+    zone_histogram_initialize(&zone_histogram, AUDIO_HISTOGRAM_ZONES_PER_SIDE, AUDIO_HISTOGRAM_ZONES_PER_SIDE, thread_pool_thread_count(&thread_pool));
+
+    // Scratch memory for temporaries of each tick
+    MemoryArena scratch;
+    memory_arena_initialize(&scratch, SIMULATION_SCRATCH_BYTES);
+
+    // Falling sand grid for settled particles, with one cell per pixel of (initial) play area height
+    SandGrid sand;
+    glfwGetFramebufferSize(window, &display_w, &display_h);
+    sand_grid_initialize(&sand, display_h, particles.n_reserved);
+    sand_grid_rasterize_environment(&sand, &env);
 
     // Initialize render data
     RenderPipelineData render_pipeline_data;
@@ -1954,15 +1643,16 @@ int main(int, char**)
         window,
         &planets,
         &particles,
-        &env
+        &env,
+        &sand
     );
 
     // Update current used input states
     UserInputState input_state;
     user_input_state_initialize(&input_state);
 
-    float freq_min = 60.f;
-    float dt_max = 1.f / freq_min;
+    FixedTimestep timestep;
+    fixed_timestep_initialize(&timestep, 60.f, 4);
     float next_planet_mass = 0.5f;
     bool next_planet_assymetric_grav = false;
 
@@ -1974,6 +1664,13 @@ int main(int, char**)
     int score = -1;
     const int min_required_score = 100;
 
+#ifndef NDEBUG
+    PlanetKernelBenchmark planet_kernel_benchmark;
+    planet_kernel_benchmark.n_particles = 0;
+    ParticleStorageAccuracy particle_storage_accuracy;
+    particle_storage_accuracy.n_ticks = 0;
+#endif  // NDEBUG
+
     // Main loop
     while (!glfwWindowShouldClose(window))
     {
@@ -1982,9 +1679,8 @@ int main(int, char**)
         const GameClock::duration dt_duration = current_time_point - previous_time_point;
         previous_time_point = current_time_point;
 
-        // Get frame time-delta as float dt value and saturate
-        const float dt_raw = std::chrono::duration_cast<FloatTimeDelta>(dt_duration).count();
-        const float dt = std::fmin(dt_max, dt_raw);
+        // Get frame time-delta as float dt value
+        const float frame_dt = std::chrono::duration_cast<FloatTimeDelta>(dt_duration).count();
 
         glfwPollEvents();
 
@@ -2012,9 +1708,6 @@ int main(int, char**)
         }
         else if (score < min_required_score)
         {
-            // Update/reset environment state
-            environment_update(&env, dt);
-
             // Flag to suppress in-game UI interations for this frame, only
             bool suppress_all_in_game_user_input = false;
 
@@ -2026,19 +1719,66 @@ int main(int, char**)
             ImGui::Dummy(ImVec2{1, 30});
             ImGui::Text("Particles  : (%d)", particles.n_active);
             ImGui::Text("Boundaries : (%d)", env.n_boundaries);
-            if (ImGui::SliderFloat("min update rate", (float*)(&freq_min), 30.0, 120.0))
-            {
-                dt_max = 1./ freq_min;
-            }
+            ImGui::Text("SIMD       : (%s)", SIMD_NAME);
+            ImGui::Text("Threads    : (%d)", thread_pool_thread_count(&thread_pool));
+            ImGui::SliderFloat("tick rate", &timestep.tick_rate, 30.f, 240.f);
+            ImGui::SliderInt("max substeps", &timestep.max_substeps, 1, 8);
             ImGui::InputFloat2("gravity", (float*)(&env.gravity));
             ImGui::SliderFloat("dampening", &env.dampening, 0.1f, 1.f);
-            ImGui::SliderFloat("max particle velocity", &particles.max_velocity, 0.5f, 5.f);
+            ImGui::SliderFloat("max particle velocity", &particles.max_velocity, 0.5f, PARTICLE_COMPACT_VELOCITY_LIMIT);
+            ImGui::Combo("particle collisions", (int*)(&particles.collision_mode), PARTICLE_COLLISION_MODE_NAMES, PARTICLE_COLLISION_MODE_COUNT);
+            ImGui::SliderInt("max bounces", &particles.max_bounces, 1, 8);
+            int storage_mode = particles.storage_mode;
+            if (ImGui::Combo("particle storage", &storage_mode, PARTICLE_STORAGE_MODE_NAMES, PARTICLE_STORAGE_MODE_COUNT))
+            {
+                particles_set_storage_mode(&particles, (ParticleStorageMode)storage_mode);
+            }
+            if (ImGui::SmallButton("Measure storage accuracy"))
+            {
+                particles_measure_storage_accuracy(&particle_storage_accuracy, &particles, &env, &planets, 60, fixed_timestep_dt(&timestep));
+            }
+            if (particle_storage_accuracy.n_ticks > 0)
+            {
+                ImGui::Text("  after %d ticks, position error %.2e max / %.2e rms", particle_storage_accuracy.n_ticks, particle_storage_accuracy.position_max_error, particle_storage_accuracy.position_rms_error);
+                ImGui::Text("  velocity error %.2e max / %.2e rms, alive mismatches %d", particle_storage_accuracy.velocity_max_error, particle_storage_accuracy.velocity_rms_error, particle_storage_accuracy.n_alive_mismatches);
+            }
+            ImGui::Combo("particle contacts", (int*)(&particles.contact_mode), PARTICLE_CONTACT_MODE_NAMES, PARTICLE_CONTACT_MODE_COUNT);
+            ImGui::SliderFloat("contact stiffness", &particles.contact_stiffness, 500.f, 8000.f);
+            int sleep_steps = particles.sleep_steps;
+            if (ImGui::SliderInt("sleep after steps at rest (0 = off)", &sleep_steps, 0, 240))
+            {
+                particles_set_sleep_steps(&particles, sleep_steps);
+            }
+            ImGui::SameLine();
+            ImGui::Text("asleep (%d)", particles_count_asleep(&particles));
+            ImGui::SliderFloat("spew rate (particles/s)", &mouse_spew_rate, 60.f, 100000.f, "%.0f", ImGuiSliderFlags_Logarithmic);
+            ImGui::Checkbox("sand grid", &sand.enabled);
+            ImGui::SameLine();
+            ImGui::Text("active chunks (%d)", sand.n_active_chunks);
             ImGui::SliderFloat("next planet mass", &next_planet_mass, 0.1f, 2.f);
             ImGui::Checkbox("next gravity assymetric", &next_planet_assymetric_grav);
+            ImGui::Combo("planet gravity", (int*)(&planets.gravity_mode), PLANET_GRAVITY_MODE_NAMES, PLANET_GRAVITY_MODE_COUNT);
+            if (ImGui::SliderFloat("opening angle", &planets.opening_angle, 0.f, 1.5f))
+            {
+                planets.dirty = true;
+            }
             if (ImGui::SmallButton("Clear particles"))
             {
                 particles_clear(&particles);
             }
+            if (ImGui::SmallButton("Clear sand"))
+            {
+                sand_grid_clear_grains(&sand);
+            }
+            if (ImGui::SmallButton("Benchmark planet kernels"))
+            {
+                planets_benchmark_kernels(&planet_kernel_benchmark, &planets, 100000, 5);
+            }
+            if (planet_kernel_benchmark.n_particles > 0)
+            {
+                ImGui::Text("  scalar %.3f ms, %s %.3f ms (x%.1f)", planet_kernel_benchmark.scalar_ms, SIMD_NAME, planet_kernel_benchmark.simd_ms, planet_kernel_benchmark.scalar_ms / planet_kernel_benchmark.simd_ms);
+                ImGui::Text("  max error %.2e, death mismatches %d", planet_kernel_benchmark.max_relative_error, planet_kernel_benchmark.n_death_mismatches);
+            }
             if (ImGui::SmallButton("Clear planets"))
             {
                 planets_clear(&planets);
@@ -2047,8 +1787,7 @@ int main(int, char**)
             ImGui::End();
 #endif // NDEBUG
 
-            // Prune dead particles
-            particles_prune_dead(&particles);
+            mouse_emitter->rate = 0.f;
 
             // Don't allow game interation if the debug panel is hovered
             if (suppress_all_in_game_user_input)
@@ -2068,9 +1807,9 @@ int main(int, char**)
             {
                 if (aabb_within(&env.valid_placement, &input_state.mouse_position))
                 {
-                    particles_spawn_at(&particles, input_state.mouse_position);
+                    mouse_emitter->position = input_state.mouse_position;
+                    mouse_emitter->rate = mouse_spew_rate;
                 }
-
             }
             // Spawn single planet on click
             else if (input_state.pressed.fields.left_mouse_button)
@@ -2081,6 +1820,7 @@ int main(int, char**)
                     score = 0;
                     particles_clear(&particles);
                     planets_clear(&planets);
+                    sand_grid_clear_grains(&sand);
                 }
                 else if ((text_regions + IN_GAME_CLEAR_PLANETS)->is_hovered)
                 {
@@ -2106,6 +1846,7 @@ int main(int, char**)
                 if (planets.n_active > 0)
                 {
                     planets.positions[0] = input_state.mouse_position;
+                    planets.dirty = true;
                 }
                 else if (next_planet_assymetric_grav)
                 {
@@ -2117,48 +1858,28 @@ int main(int, char**)
                 }
             }
 
-            // Apply planet gravity to particles
-            planets_apply_to_particles(&planets, &env, &particles);
-
-            // Check for particles in the goal region
-            for (int i = 0; i < particles.n_active; ++i)
+            // Run simulation in fixed ticks
+            const int n_ticks = fixed_timestep_advance(&timestep, frame_dt);
+            const float dt = fixed_timestep_dt(&timestep);
+            int captured = 0;
+            for (int tick = 0; tick < n_ticks; ++tick)
             {
-                // Stop these particles here
-                if (aabb_within(&env.goal, particles.positions + i))
-                {
-                    if (vec2_length_squared(particles.velocities + i) > 0.f)
-                    {
-                        REPLAY_SFX(SFX_SCORE_POINT);
-                        ++score;
-
-                        // Remove particle next iteration
-                        particles.alive[i] = false;
-                    }
-                    vec2_set_zero(particles.forces + i);
-                    vec2_set_zero(particles.velocities + i);
-                }
+                captured += simulation_tick(&env, &particles, &emitters, &planets, &sand, &thread_pool, &worker_accumulators, &zone_histogram, &scratch, dt);
             }
 
-            // Do planet update
-            planets_update(&planets, dt);
-
-            // Do particle update
-            particles_update(&particles, &env, dt);
+            if (captured > 0)
+            {
+                REPLAY_SFX(SFX_SCORE_POINT);
+                score += captured;
+            }
 
 #if defined(PLATFORM_SUPPORTS_AUDIO)
             // Play sounds based on positions
-            unsigned in_zone[16];
-            std::memset(in_zone, 0, sizeof(unsigned) * 16);
-            for (int i = 0; i < particles.n_active; ++i)
+            float zone_gains[N_AUDIO_ZONES];
+            zone_histogram_gains(&zone_histogram, zone_gains, N_AUDIO_ZONES_PER_SIDE, AUDIO_ZONE_FULL_GAIN_COUNT);
+            for (int z = 0; z < N_AUDIO_ZONES; ++z)
             {
-                const int xd = ((particles.positions + i)->x + 1.f) / 0.5f;
-                const int yd = ((particles.positions + i)->y + 1.f) / 0.5f;
-                in_zone[xd * 4 + yd] += 1;
-            }
-            for (int z = 0; z < 16; ++z)
-            {
-                const float gain = std::fmin(1.f, (float)in_zone[z] / 4.f);
-                AL_TEST_ERROR(alSourcef(audio_sources[z], AL_GAIN, gain));
+                AL_TEST_ERROR(alSourcef(audio_sources[z], AL_GAIN, zone_gains[z]));
             }
 
             // Update background track
@@ -2185,6 +1906,7 @@ int main(int, char**)
                 score = 0;
                 planets_clear(&planets);
                 particles_clear(&particles);
+                sand_grid_clear_grains(&sand);
             }
 
 #if defined(PLATFORM_SUPPORTS_AUDIO)
@@ -2222,9 +1944,28 @@ int main(int, char**)
         else if (score < min_required_score)
         {
             // Draw the game level data
+            if (sand.enabled)
+            {
+                render_pipeline_draw_sand(&render_pipeline_data, &sand);
+            }
             render_pipeline_draw_environment(&render_pipeline_data, &env);
             render_pipeline_draw_planets(&render_pipeline_data, &planets);
-            render_pipeline_draw_particles(&render_pipeline_data, &particles);
+            if (particles.n_max > particle_render_capacity)
+            {
+                vec2_array_commit(&particle_render_positions, particles.n_max);
+                vec2_array_i16_commit(&particle_render_compact_positions, particles.n_max);
+                particle_render_capacity = particles.n_max;
+            }
+            if (particles.storage_mode == PARTICLE_STORAGE_INT16)
+            {
+                particles_interpolate_compact_positions(&particles, &particle_render_compact_positions, fixed_timestep_alpha(&timestep));
+                render_pipeline_draw_compact_particles(&render_pipeline_data, &particles, &particle_render_compact_positions);
+            }
+            else
+            {
+                particles_interpolate_positions(&particles, &particle_render_positions, fixed_timestep_alpha(&timestep));
+                render_pipeline_draw_particles(&render_pipeline_data, &particles, &particle_render_positions);
+            }
 
             // Show current score
             {
@@ -2271,10 +2012,17 @@ int main(int, char**)
     glfwTerminate();
 
     // Cleanup game state
+    thread_pool_destroy(&thread_pool);
+    sand_grid_destroy(&sand);
+    memory_arena_destroy(&scratch);
+    zone_histogram_destroy(&zone_histogram);
+    worker_accumulators_destroy(&worker_accumulators);
     render_pipeline_destroy(&render_pipeline_data);
     text_render_pipeline_destroy(&text_render_pipeline_data);
     planets_destroy(&planets);
     particles_destroy(&particles);
+    vec2_array_release(&particle_render_positions);
+    vec2_array_i16_release(&particle_render_compact_positions);
     environment_destroy(&env);
 
 #if defined(PLATFORM_SUPPORTS_AUDIO)
@@ -0,0 +1,4775 @@
+#pragma once
+
+// Simulation core: environment, particles and planets, with no dependencies on windowing, rendering or audio
+
+// C++ Standard Library
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+
+// Utility
+#include "math.inl"
+#include "bitset.inl"
+#include "memory.inl"
+#include "simd.inl"
+#include "thread_pool.inl"
+#include "timestep.inl"
+
+
+// for each point
+//    for each line
+//       if intersects(point, line)
+//          DEFLECT(point.velocity, line.normal)
+//
+
+
+static const float BOUNDARY_PADDING = 0.05f;
+static const float BOUNDARY_LIMIT = 1.f - BOUNDARY_PADDING;
+
+
+void integrate_states_fixed_step(Vec2Array* positions, Vec2Array* velocities, const Vec2Array* acceleratons, int n, float dt)
+{
+    // f = m * a
+    // a = f / m = f * inv_mass
+    // v += a * dt
+    // x += v * dt
+    //
+    // Arrays are padded to the SIMD width, so this runs over whole vectors (including unused padding)
+    const int n_padded = simd_padded_count(n);
+    simd_integrate_n(positions->x, velocities->x, acceleratons->x, dt, n_padded);
+    simd_integrate_n(positions->y, velocities->y, acceleratons->y, dt, n_padded);
+}
+
+
+// Boundary capacity committed up front, and the most boundaries an environment can grow to
+static const int N_ENVIRONMENT_LINES_INITIAL = 1 << 10;
+static const int N_ENVIRONMENT_LINES_RESERVED = 1 << 20;
+
+// Uniform grid over the [-1, 1] x [-1, 1] play area, used as a broadphase for particle-boundary collisions
+static const int ENVIRONMENT_GRID_CELLS_PER_SIDE = 32;
+
+// Max number of boundary candidates gathered for a single query; queries which find more fall back to the BVH
+static const int ENVIRONMENT_GRID_QUERY_MAX = 64;
+
+// Grid nodes reserved per boundary. Levels which need more than this put more than ENVIRONMENT_GRID_QUERY_MAX boundaries
+// in most cells anyway, so once the reservation runs out the grid is marked overflowed and every query falls back.
+static const int ENVIRONMENT_GRID_NODES_PER_BOUNDARY = 4;
+
+struct EnvironmentGrid
+{
+    // Each cell is a singly-linked list of nodes, each of which refer to a boundary touching that cell
+    int* cell_heads;
+    int* node_next;
+    int* node_boundary;
+    int n_nodes;
+    int n_nodes_max;      // Committed capacity
+    int n_nodes_reserved; // Most nodes the pool arrays can grow to
+    bool overflowed;      // Some boundary could not be inserted, so queries can't trust the cell lists
+
+    int cells_per_side;
+    float cell_size;
+    float inv_cell_size;
+};
+
+// Arena bytes needed by environment_grid_initialize
+std::size_t environment_grid_arena_bytes(const int cells_per_side, const int node_count_reserved)
+{
+    return memory_arena_array_bytes(sizeof(int) * cells_per_side * cells_per_side)
+        + 2 * memory_arena_array_bytes(sizeof(int) * node_count_reserved);
+}
+
+// Commits node storage for at least node_count nodes (see pool_grow_count); returns false past n_nodes_reserved
+bool environment_grid_grow(EnvironmentGrid* const grid, const int node_count)
+{
+    const int n_nodes_max = pool_grow_count(grid->n_nodes_max, node_count, grid->n_nodes_reserved);
+    if (n_nodes_max <= grid->n_nodes_max)
+    {
+        return n_nodes_max >= 0;
+    }
+    const bool committed = pool_array_commit(grid->node_next, sizeof(int) * n_nodes_max)
+        && pool_array_commit(grid->node_boundary, sizeof(int) * n_nodes_max);
+    if (committed)
+    {
+        grid->n_nodes_max = n_nodes_max;
+    }
+    return committed;
+}
+
+void environment_grid_initialize(
+    EnvironmentGrid* const grid,
+    MemoryArena* const arena,
+    const int cells_per_side,
+    const int node_count,
+    const int node_count_reserved)
+{
+    const int n_cells = cells_per_side * cells_per_side;
+    grid->cell_heads = (int*)memory_arena_reserve_array(arena, sizeof(int) * n_cells);
+    pool_array_commit(grid->cell_heads, sizeof(int) * n_cells);
+    std::memset(grid->cell_heads, 0xFF, sizeof(int) * n_cells);
+
+    grid->node_next = (int*)memory_arena_reserve_array(arena, sizeof(int) * node_count_reserved);
+    grid->node_boundary = (int*)memory_arena_reserve_array(arena, sizeof(int) * node_count_reserved);
+    grid->n_nodes = 0;
+    grid->n_nodes_max = 0;
+    grid->n_nodes_reserved = node_count_reserved;
+    grid->overflowed = false;
+    environment_grid_grow(grid, node_count);
+
+    grid->cells_per_side = cells_per_side;
+    grid->cell_size = 2.f / cells_per_side;
+    grid->inv_cell_size = cells_per_side / 2.f;
+}
+
+inline int environment_grid_cell_coord(const EnvironmentGrid* const grid, const float v)
+{
+    const int c = (int)((v + 1.f) * grid->inv_cell_size);
+    return imax(0, imin(grid->cells_per_side - 1, c));
+}
+
+void environment_grid_insert(EnvironmentGrid* const grid, const Line* const line, const int boundary_index)
+{
+    const AABB line_aabb = aabb_create(line->tail, line->head);
+    const int cx_min = environment_grid_cell_coord(grid, line_aabb.min_corner.x);
+    const int cx_max = environment_grid_cell_coord(grid, line_aabb.max_corner.x);
+    const int cy_min = environment_grid_cell_coord(grid, line_aabb.min_corner.y);
+    const int cy_max = environment_grid_cell_coord(grid, line_aabb.max_corner.y);
+
+    for (int cy = cy_min; cy <= cy_max; ++cy)
+    {
+        for (int cx = cx_min; cx <= cx_max; ++cx)
+        {
+            // Cells along the edge of the grid extend out to infinity, since queries are clamped to the grid
+            AABB cell_aabb;
+            cell_aabb.min_corner.x = (cx == 0) ? -INFINITY : (cx * grid->cell_size - 1.f);
+            cell_aabb.min_corner.y = (cy == 0) ? -INFINITY : (cy * grid->cell_size - 1.f);
+            cell_aabb.max_corner.x = (cx == grid->cells_per_side - 1) ? +INFINITY : ((cx + 1) * grid->cell_size - 1.f);
+            cell_aabb.max_corner.y = (cy == grid->cells_per_side - 1) ? +INFINITY : ((cy + 1) * grid->cell_size - 1.f);
+
+            // Skip cells in the AABB of the line that the line does not actually pass through
+            if (!aabb_intersects_segment(&cell_aabb, line))
+            {
+                continue;
+            }
+
+            // Grow node storage
+            if (!environment_grid_grow(grid, grid->n_nodes + 1))
+            {
+                grid->overflowed = true;
+                return;
+            }
+
+            // Push boundary to front of cell list
+            const int cell = cy * grid->cells_per_side + cx;
+            grid->node_next[grid->n_nodes] = grid->cell_heads[cell];
+            grid->node_boundary[grid->n_nodes] = boundary_index;
+            grid->cell_heads[cell] = grid->n_nodes;
+            ++grid->n_nodes;
+        }
+    }
+}
+
+// Gathers (sorted, unique) indices of all boundaries in the cells touched by the AABB of start -> end,
+// expanded by some tolerance. Returns -1 if there are more than max_candidates candidates, or the grid overflowed.
+int environment_grid_query(
+    const EnvironmentGrid* const grid,
+    int* const candidates,
+    const int max_candidates,
+    const Vec2* const start,
+    const Vec2* const end,
+    const float tolerance)
+{
+    if (grid->overflowed)
+    {
+        return -1;
+    }
+
+    const int cx_min = environment_grid_cell_coord(grid, std::fmin(start->x, end->x) - tolerance);
+    const int cx_max = environment_grid_cell_coord(grid, std::fmax(start->x, end->x) + tolerance);
+    const int cy_min = environment_grid_cell_coord(grid, std::fmin(start->y, end->y) - tolerance);
+    const int cy_max = environment_grid_cell_coord(grid, std::fmax(start->y, end->y) + tolerance);
+
+    int n_candidates = 0;
+    for (int cy = cy_min; cy <= cy_max; ++cy)
+    {
+        for (int cx = cx_min; cx <= cx_max; ++cx)
+        {
+            for (int node = grid->cell_heads[cy * grid->cells_per_side + cx]; node >= 0; node = grid->node_next[node])
+            {
+                const int l = grid->node_boundary[node];
+
+                // Insert into sorted position, skipping duplicates from neighboring cells
+                int c = n_candidates;
+                while (c > 0 && candidates[c - 1] > l)
+                {
+                    --c;
+                }
+                if (c > 0 && candidates[c - 1] == l)
+                {
+                    continue;
+                }
+                else if (n_candidates >= max_candidates)
+                {
+                    return -1;
+                }
+                std::memmove(candidates + c + 1, candidates + c, sizeof(int) * (n_candidates - c));
+                candidates[c] = l;
+                ++n_candidates;
+            }
+        }
+    }
+    return n_candidates;
+}
+
+// Boundary collision data for up to SIMD_F32_WIDTH boundaries, one lane each, so a segment can be tested against a
+// whole block at once (see environment_boundary_search_block). Unused lanes have an index of INFINITY.
+struct EnvironmentBoundaryBlock
+{
+    alignas(SIMD_ALIGNMENT_BYTES) float tail_x[SIMD_F32_WIDTH];
+    float tail_y[SIMD_F32_WIDTH];
+    float direction_x[SIMD_F32_WIDTH];
+    float direction_y[SIMD_F32_WIDTH];
+    float normal_x[SIMD_F32_WIDTH];
+    float normal_y[SIMD_F32_WIDTH];
+    float min_x[SIMD_F32_WIDTH];
+    float max_x[SIMD_F32_WIDTH];
+    float index[SIMD_F32_WIDTH]; // Boundary index (exact as a float, since n_reserved is well below 2^24)
+};
+
+inline int environment_boundary_block_count(const int boundary_count)
+{
+    return (boundary_count + SIMD_F32_WIDTH - 1) / SIMD_F32_WIDTH;
+}
+
+inline void environment_boundary_block_copy_lane(
+    EnvironmentBoundaryBlock* const dst,
+    const int dst_lane,
+    const EnvironmentBoundaryBlock* const src,
+    const int src_lane)
+{
+    dst->tail_x[dst_lane] = src->tail_x[src_lane];
+    dst->tail_y[dst_lane] = src->tail_y[src_lane];
+    dst->direction_x[dst_lane] = src->direction_x[src_lane];
+    dst->direction_y[dst_lane] = src->direction_y[src_lane];
+    dst->normal_x[dst_lane] = src->normal_x[src_lane];
+    dst->normal_y[dst_lane] = src->normal_y[src_lane];
+    dst->min_x[dst_lane] = src->min_x[src_lane];
+    dst->max_x[dst_lane] = src->max_x[src_lane];
+    dst->index[dst_lane] = src->index[src_lane];
+}
+
+// Max number of boundaries held in a single BVH leaf; leaves are stored as whole blocks, so this is at least a block
+static const int ENVIRONMENT_BVH_LEAF_SIZE = (SIMD_F32_WIDTH > 4) ? SIMD_F32_WIDTH : 4;
+
+// Max depth of BVH traversal (median splits keep depth at ~log2(n_boundaries / ENVIRONMENT_BVH_LEAF_SIZE))
+static const int ENVIRONMENT_BVH_STACK_SIZE = 64;
+
+struct EnvironmentBVHNode
+{
+    AABB bounds;
+    int first; // first child node index (internal node) or first index into EnvironmentBVH::blocks (leaf)
+    int count; // number of blocks in a leaf; 0 for internal nodes
+};
+
+struct EnvironmentBVH
+{
+    // Pool arrays with room for a tree over n_reserved boundaries, committed by each build. Indices order boundaries
+    // while building; the boundaries of each leaf are then copied into blocks of their own, in tree order.
+    EnvironmentBVHNode* nodes;
+    int* indices;
+    EnvironmentBoundaryBlock* blocks;
+    int n_nodes;
+    int n_blocks;
+    int n_reserved;
+
+    // Boundaries [0, n_indexed) are in the tree; any added after the last build are checked linearly
+    int n_indexed;
+};
+
+// Most leaf blocks of a BVH over boundary_count boundaries. Median splits leave at least ENVIRONMENT_BVH_LEAF_SIZE / 2
+// boundaries in every leaf (but a lone root), and each leaf pads at most one block.
+inline int environment_bvh_block_count_max(const int boundary_count)
+{
+    return environment_boundary_block_count(boundary_count) + 2 * boundary_count / ENVIRONMENT_BVH_LEAF_SIZE + 1;
+}
+
+// Arena bytes needed by environment_bvh_initialize. A binary tree with n leaves (at most) has fewer than 2 * n nodes.
+std::size_t environment_bvh_arena_bytes(const int boundary_count_reserved)
+{
+    return memory_arena_array_bytes(sizeof(EnvironmentBVHNode) * 2 * boundary_count_reserved)
+        + memory_arena_array_bytes(sizeof(int) * boundary_count_reserved)
+        + memory_arena_array_bytes(sizeof(EnvironmentBoundaryBlock) * environment_bvh_block_count_max(boundary_count_reserved));
+}
+
+void environment_bvh_initialize(EnvironmentBVH* const bvh, MemoryArena* const arena, const int boundary_count_reserved)
+{
+    bvh->nodes = (EnvironmentBVHNode*)memory_arena_reserve_array(arena, sizeof(EnvironmentBVHNode) * 2 * boundary_count_reserved);
+    bvh->indices = (int*)memory_arena_reserve_array(arena, sizeof(int) * boundary_count_reserved);
+    bvh->blocks = (EnvironmentBoundaryBlock*)memory_arena_reserve_array(
+        arena,
+        sizeof(EnvironmentBoundaryBlock) * environment_bvh_block_count_max(boundary_count_reserved)
+    );
+    bvh->n_nodes = 0;
+    bvh->n_blocks = 0;
+    bvh->n_reserved = boundary_count_reserved;
+    bvh->n_indexed = 0;
+}
+
+void environment_bvh_build_node(
+    EnvironmentBVH* const bvh,
+    const Line* const lines,
+    const EnvironmentBoundaryBlock* const boundary_blocks,
+    const int node_index,
+    const int first,
+    const int count)
+{
+    EnvironmentBVHNode* const node = bvh->nodes + node_index;
+
+    // Bound all lines in this node, as well as their centers
+    AABB centers = aabb_create(lines[bvh->indices[first]].tail, lines[bvh->indices[first]].tail);
+    node->bounds = centers;
+    for (int i = first; i < first + count; ++i)
+    {
+        const Line* const line = lines + bvh->indices[i];
+        const Vec2 center{0.5f * (line->tail.x + line->head.x), 0.5f * (line->tail.y + line->head.y)};
+        node->bounds.min_corner.x = std::fmin(node->bounds.min_corner.x, std::fmin(line->tail.x, line->head.x));
+        node->bounds.min_corner.y = std::fmin(node->bounds.min_corner.y, std::fmin(line->tail.y, line->head.y));
+        node->bounds.max_corner.x = std::fmax(node->bounds.max_corner.x, std::fmax(line->tail.x, line->head.x));
+        node->bounds.max_corner.y = std::fmax(node->bounds.max_corner.y, std::fmax(line->tail.y, line->head.y));
+        centers.min_corner.x = std::fmin(centers.min_corner.x, center.x);
+        centers.min_corner.y = std::fmin(centers.min_corner.y, center.y);
+        centers.max_corner.x = std::fmax(centers.max_corner.x, center.x);
+        centers.max_corner.y = std::fmax(centers.max_corner.y, center.y);
+    }
+
+    // Copy the boundaries of a leaf into blocks of its own; lanes past the last boundary are unused
+    if (count <= ENVIRONMENT_BVH_LEAF_SIZE)
+    {
+        node->first = bvh->n_blocks;
+        node->count = environment_boundary_block_count(count);
+        bvh->n_blocks += node->count;
+        for (int i = 0; i < node->count * SIMD_F32_WIDTH; ++i)
+        {
+            EnvironmentBoundaryBlock* const block = bvh->blocks + node->first + i / SIMD_F32_WIDTH;
+            if (i < count)
+            {
+                const int l = bvh->indices[first + i];
+                environment_boundary_block_copy_lane(block, i % SIMD_F32_WIDTH, boundary_blocks + l / SIMD_F32_WIDTH, l % SIMD_F32_WIDTH);
+            }
+            else
+            {
+                block->index[i % SIMD_F32_WIDTH] = INFINITY;
+            }
+        }
+        return;
+    }
+
+    // Split at the median center along the longest axis of the center bounds
+    const bool split_x = (centers.max_corner.x - centers.min_corner.x) > (centers.max_corner.y - centers.min_corner.y);
+    const int mid = first + count / 2;
+    std::nth_element(
+        bvh->indices + first,
+        bvh->indices + mid,
+        bvh->indices + first + count,
+        [lines, split_x](const int lhs, const int rhs)
+        {
+            return split_x ? (lines[lhs].tail.x + lines[lhs].head.x) < (lines[rhs].tail.x + lines[rhs].head.x)
+                           : (lines[lhs].tail.y + lines[lhs].head.y) < (lines[rhs].tail.y + lines[rhs].head.y);
+        }
+    );
+
+    // Children are always allocated side-by-side
+    const int left = bvh->n_nodes;
+    bvh->n_nodes += 2;
+    node->first = left;
+    node->count = 0;
+
+    environment_bvh_build_node(bvh, lines, boundary_blocks, left + 0, first, mid - first);
+    environment_bvh_build_node(bvh, lines, boundary_blocks, left + 1, mid, first + count - mid);
+}
+
+// Builds the tree over boundaries [0, n_lines), whose collision data is in boundary_blocks
+void environment_bvh_build(
+    EnvironmentBVH* const bvh,
+    const Line* const lines,
+    const EnvironmentBoundaryBlock* const boundary_blocks,
+    const int n_lines)
+{
+    bvh->n_nodes = 0;
+    bvh->n_blocks = 0;
+    bvh->n_indexed = 0;
+
+    // Boundaries are capped at the reservation the tree was sized for, so these commits only fail if memory runs out
+    if (n_lines == 0
+        || !pool_array_commit(bvh->nodes, sizeof(EnvironmentBVHNode) * 2 * n_lines)
+        || !pool_array_commit(bvh->indices, sizeof(int) * n_lines)
+        || !pool_array_commit(bvh->blocks, sizeof(EnvironmentBoundaryBlock) * environment_bvh_block_count_max(n_lines)))
+    {
+        return;
+    }
+
+    for (int l = 0; l < n_lines; ++l)
+    {
+        bvh->indices[l] = l;
+    }
+
+    bvh->n_nodes = 1;
+    environment_bvh_build_node(bvh, lines, boundary_blocks, 0, 0, n_lines);
+    bvh->n_indexed = n_lines;
+}
+
+struct EnvironmentBoundaryProperties
+{
+    float tail_hits;
+    float head_hits;
+};
+
+// Orientation of a boundary, so collision tests can take shortcuts for axis-aligned ones
+enum EnvironmentBoundaryAxis
+{
+    ENVIRONMENT_BOUNDARY_SLANTED,
+    ENVIRONMENT_BOUNDARY_HORIZONTAL, // tail.y == head.y
+    ENVIRONMENT_BOUNDARY_VERTICAL,   // tail.x == head.x
+};
+
+// Per-boundary pool arrays in the environment arena (besides boundary_blocks)
+static const int ENVIRONMENT_ARENA_ARRAY_COUNT = 7;
+
+// Levels with at most this many boundaries skip the grid and BVH, and are always searched in full with the SIMD kernel
+static const int ENVIRONMENT_SCAN_BOUNDARIES_MAX = 16;
+
+struct Environment
+{
+    AABB goal;
+    AABB valid_placement;
+
+    // Per-boundary pool arrays, all in one arena
+    MemoryArena arena;
+    Line* boundaries;
+    Vec2* normals;
+    EnvironmentBoundaryProperties* boundary_properties;
+
+    // Collision data derived from each boundary when it is added, so collision tests don't recompute it per particle
+    Vec2* directions;            // head - tail
+    float* lengths_squared;
+    AABB* bounds;
+    std::uint8_t* axes;          // EnvironmentBoundaryAxis
+    EnvironmentBoundaryBlock* boundary_blocks;
+
+    EnvironmentGrid grid;
+    EnvironmentBVH bvh;
+    int n_boundaries;
+    int n_max;      // Committed capacity, which grows as boundaries are added
+    int n_reserved; // Most boundaries the pool arrays can grow to
+
+    float boundary_thickness;
+    float dampening;
+    Vec2 gravity;
+
+    // Incremented whenever boundaries change, which wakes all sleeping particles (see particles_wake_on_changes)
+    int revision;
+};
+
+// Commits boundary storage for at least boundary_count boundaries (see pool_grow_count); returns false past n_reserved
+bool environment_grow(Environment* const env, const int boundary_count)
+{
+    const int n_max = pool_grow_count(env->n_max, boundary_count, env->n_reserved);
+    if (n_max <= env->n_max)
+    {
+        return n_max >= 0;
+    }
+    const bool committed = pool_array_commit(env->boundaries, sizeof(Line) * n_max)
+        && pool_array_commit(env->normals, sizeof(Vec2) * n_max)
+        && pool_array_commit(env->boundary_properties, sizeof(EnvironmentBoundaryProperties) * n_max)
+        && pool_array_commit(env->directions, sizeof(Vec2) * n_max)
+        && pool_array_commit(env->lengths_squared, sizeof(float) * n_max)
+        && pool_array_commit(env->bounds, sizeof(AABB) * n_max)
+        && pool_array_commit(env->axes, sizeof(std::uint8_t) * n_max)
+        && pool_array_commit(env->boundary_blocks, sizeof(EnvironmentBoundaryBlock) * environment_boundary_block_count(n_max));
+    if (committed)
+    {
+        env->n_max = n_max;
+    }
+    return committed;
+}
+
+// Starts with capacity for boundary_count boundaries, which grows on demand up to N_ENVIRONMENT_LINES_RESERVED
+void environment_initialize(Environment* const env, const int boundary_count)
+{
+    env->n_reserved = imax(boundary_count, N_ENVIRONMENT_LINES_RESERVED);
+    const std::size_t block_bytes = sizeof(EnvironmentBoundaryBlock) * environment_boundary_block_count(env->n_reserved);
+    const int grid_nodes_reserved = ENVIRONMENT_GRID_NODES_PER_BOUNDARY * env->n_reserved;
+    memory_arena_initialize(
+        &env->arena,
+        ENVIRONMENT_ARENA_ARRAY_COUNT * memory_arena_array_bytes(sizeof(Line) * env->n_reserved)
+            + memory_arena_array_bytes(block_bytes)
+            + environment_grid_arena_bytes(ENVIRONMENT_GRID_CELLS_PER_SIDE, grid_nodes_reserved)
+            + environment_bvh_arena_bytes(env->n_reserved)
+    );
+    env->boundaries = (Line*)memory_arena_reserve_array(&env->arena, sizeof(Line) * env->n_reserved);
+    env->normals = (Vec2*)memory_arena_reserve_array(&env->arena, sizeof(Vec2) * env->n_reserved);
+    env->boundary_properties = (EnvironmentBoundaryProperties*)memory_arena_reserve_array(&env->arena, sizeof(EnvironmentBoundaryProperties) * env->n_reserved);
+    env->directions = (Vec2*)memory_arena_reserve_array(&env->arena, sizeof(Vec2) * env->n_reserved);
+    env->lengths_squared = (float*)memory_arena_reserve_array(&env->arena, sizeof(float) * env->n_reserved);
+    env->bounds = (AABB*)memory_arena_reserve_array(&env->arena, sizeof(AABB) * env->n_reserved);
+    env->axes = (std::uint8_t*)memory_arena_reserve_array(&env->arena, sizeof(std::uint8_t) * env->n_reserved);
+    env->boundary_blocks = (EnvironmentBoundaryBlock*)memory_arena_reserve_array(&env->arena, block_bytes);
+    env->n_max = 0;
+    environment_grow(env, boundary_count);
+    environment_grid_initialize(
+        &env->grid,
+        &env->arena,
+        ENVIRONMENT_GRID_CELLS_PER_SIDE,
+        imax(16, ENVIRONMENT_GRID_NODES_PER_BOUNDARY * boundary_count),
+        grid_nodes_reserved
+    );
+    environment_bvh_initialize(&env->bvh, &env->arena, env->n_reserved);
+    env->dampening = 0.7f;
+    env->gravity.x = 0.0f;
+    env->gravity.y = -0.123f;
+    env->boundary_thickness = 1e-3f;
+    env->n_boundaries = 0;
+    env->revision = 0;
+}
+
+void environment_update(Environment* const env, const float dt)
+{
+    // Keep boundaries outside of the BVH (which are searched linearly) down to a small level's worth
+    if (env->n_boundaries - env->bvh.n_indexed > ENVIRONMENT_SCAN_BOUNDARIES_MAX)
+    {
+        environment_bvh_build(&env->bvh, env->boundaries, env->boundary_blocks, env->n_boundaries);
+    }
+
+    // Decay hit accumulators over time
+    for (int l = 0; l < env->n_boundaries; ++l)
+    {
+        (env->boundary_properties + l)->tail_hits = std::fmin(50.f, std::fmax(0.f, (env->boundary_properties + l)->tail_hits - 50.f * dt));
+        (env->boundary_properties + l)->head_hits = std::fmin(50.f, std::fmax(0.f, (env->boundary_properties + l)->head_hits - 50.f * dt));
+    }
+}
+
+void environment_add_boundary(Environment* const env, const Vec2 tail, const Vec2 head)
+{
+    // Don't add anything if storage can't grow any further
+    if (!environment_grow(env, env->n_boundaries + 1))
+    {
+        return;
+    }
+
+    // Add boundary points
+    if (tail.x < head.x)
+    {
+        (env->boundaries + env->n_boundaries)->tail = tail;
+        (env->boundaries + env->n_boundaries)->head = head;
+    }
+    else
+    {
+        (env->boundaries + env->n_boundaries)->tail = head;
+        (env->boundaries + env->n_boundaries)->head = tail;
+    }
+
+    // Initialize properties
+    std::memset(env->boundary_properties + env->n_boundaries, 0, sizeof(EnvironmentBoundaryProperties));
+
+    // Compute normal for boundary
+    const Line* const line = env->boundaries + env->n_boundaries;
+    *(env->normals + env->n_boundaries) = line_to_normal(line);
+
+    // Cache collision data
+    const Vec2 direction = vec2_sub(&line->head, &line->tail);
+    env->directions[env->n_boundaries] = direction;
+    env->lengths_squared[env->n_boundaries] = vec2_length_squared(&direction);
+    env->bounds[env->n_boundaries] = aabb_create(line->tail, line->head);
+    env->axes[env->n_boundaries] = (direction.y == 0.f) ? ENVIRONMENT_BOUNDARY_HORIZONTAL
+                                 : (direction.x == 0.f) ? ENVIRONMENT_BOUNDARY_VERTICAL
+                                 : ENVIRONMENT_BOUNDARY_SLANTED;
+
+    EnvironmentBoundaryBlock* const block = env->boundary_blocks + env->n_boundaries / SIMD_F32_WIDTH;
+    const int lane = env->n_boundaries % SIMD_F32_WIDTH;
+    if (lane == 0)
+    {
+        std::fill(block->index, block->index + SIMD_F32_WIDTH, INFINITY);
+    }
+    block->index[lane] = (float)env->n_boundaries;
+    block->tail_x[lane] = line->tail.x;
+    block->tail_y[lane] = line->tail.y;
+    block->direction_x[lane] = direction.x;
+    block->direction_y[lane] = direction.y;
+    block->normal_x[lane] = env->normals[env->n_boundaries].x;
+    block->normal_y[lane] = env->normals[env->n_boundaries].y;
+    block->min_x[lane] = env->bounds[env->n_boundaries].min_corner.x;
+    block->max_x[lane] = env->bounds[env->n_boundaries].max_corner.x;
+
+    // Register boundary with all grid cells it passes through
+    environment_grid_insert(&env->grid, line, env->n_boundaries);
+
+    // Count new boundary
+    ++env->n_boundaries;
+    ++env->revision;
+}
+
+// Same as vec2_near_segment_with_normal for boundary l, using its cached collision data
+inline bool environment_is_near_boundary(const Environment* const env, const int l, const Vec2* const point)
+{
+    // Boundaries are stored with tail.x <= head.x, so the bounds are the (strict) x-range test; vertical boundaries
+    // have an empty x-range and are never near
+    const AABB* const bounds = env->bounds + l;
+    if (!(point->x > bounds->min_corner.x && point->x < bounds->max_corner.x))
+    {
+        return false;
+    }
+    // The normal of a horizontal boundary is exactly (0, +/-1)
+    else if (env->axes[l] == ENVIRONMENT_BOUNDARY_HORIZONTAL)
+    {
+        return std::abs(env->boundaries[l].tail.y - point->y) < env->boundary_thickness;
+    }
+    return vec2_near_line_with_normal(env->boundaries + l, env->normals + l, point, env->boundary_thickness);
+}
+
+// True if a segment with the given bounds could cross boundary l, which is cheaper to check than the crossing itself
+inline bool environment_may_cross_boundary(const Environment* const env, const int l, const AABB* const segment_bounds)
+{
+    return aabb_overlaps(segment_bounds, env->bounds + l);
+}
+
+// Boundaries found by environment_find_boundary_hits; indices are -1 if there is no such boundary
+struct EnvironmentBoundaryHits
+{
+    float t_earliest;  // Fraction along the segment of the earliest crossing, or INFINITY
+    int earliest;      // Boundary crossed at t_earliest (the lowest index on ties)
+    int first_crossed; // Lowest index of a crossed boundary
+    int first_near;    // Lowest index of a boundary which isn't crossed, but which near_point is right above
+};
+
+// Running state of a blocked boundary search: the segment, near point and index range broadcast to all lanes, and the
+// best candidates each lane has seen so far
+struct EnvironmentBoundarySearch
+{
+    simd_f32 px;
+    simd_f32 py;
+    simd_f32 rx;
+    simd_f32 ry;
+    simd_f32 near_x;
+    simd_f32 near_y;
+    simd_f32 tolerance;
+    simd_f32 tolerance_neg;
+    simd_f32 index_from;
+    simd_f32 index_end;
+    simd_f32 index_excluded;
+
+    simd_f32 t_earliest;
+    simd_f32 earliest;
+    simd_f32 first_crossed;
+    simd_f32 first_near;
+};
+
+// Starts a search of the segment p -> p_head against boundaries [from, n_boundaries), other than excluded
+inline void environment_boundary_search_begin(
+    EnvironmentBoundarySearch* const search,
+    const Environment* const env,
+    const Vec2* const p,
+    const Vec2* const p_head,
+    const Vec2* const near_point,
+    const int from,
+    const int excluded)
+{
+    search->px = simd_f32_set1(p->x);
+    search->py = simd_f32_set1(p->y);
+    search->rx = simd_f32_set1(p_head->x - p->x);
+    search->ry = simd_f32_set1(p_head->y - p->y);
+    search->near_x = simd_f32_set1(near_point->x);
+    search->near_y = simd_f32_set1(near_point->y);
+    search->tolerance = simd_f32_set1(env->boundary_thickness);
+    search->tolerance_neg = simd_f32_set1(-env->boundary_thickness);
+    search->index_from = simd_f32_set1((float)from);
+    search->index_end = simd_f32_set1((float)env->n_boundaries);
+    search->index_excluded = simd_f32_set1((float)excluded);
+
+    search->t_earliest = simd_f32_set1(INFINITY);
+    search->earliest = simd_f32_set1(INFINITY);
+    search->first_crossed = simd_f32_set1(INFINITY);
+    search->first_near = simd_f32_set1(INFINITY);
+}
+
+// Tests the segment against a block of boundaries. Per boundary, this is vec2_segment_direction_intercept_param
+// followed by environment_is_near_boundary (for near_point); each lane keeps its best candidates with masked selects
+// and mins, so blocks can be searched in any order.
+inline void environment_boundary_search_block(EnvironmentBoundarySearch* const search, const EnvironmentBoundaryBlock* const block)
+{
+    const simd_f32 zero = simd_f32_set1(0.f);
+    const simd_f32 one = simd_f32_set1(1.f);
+    const simd_f32 infinity = simd_f32_set1(INFINITY);
+    const simd_f32 index = simd_f32_load(block->index);
+
+    // Lanes in [from, n_boundaries), other than the excluded one; unused lanes (at INFINITY) are past the end
+    const simd_mask is_excluded = simd_mask_and_not(simd_f32_le(index, search->index_excluded), simd_f32_lt(index, search->index_excluded));
+    const simd_mask valid = simd_mask_and_not(
+        simd_mask_and_not(simd_f32_lt(index, search->index_end), simd_f32_lt(index, search->index_from)),
+        is_excluded
+    );
+
+    // Same arithmetic as vec2_segment_direction_intercept_param, with q = tail and s = direction
+    const simd_f32 tail_x = simd_f32_load(block->tail_x);
+    const simd_f32 tail_y = simd_f32_load(block->tail_y);
+    const simd_f32 sx = simd_f32_load(block->direction_x);
+    const simd_f32 sy = simd_f32_load(block->direction_y);
+    const simd_f32 r_cross_s = simd_f32_sub(simd_f32_mul(search->rx, sy), simd_f32_mul(search->ry, sx));
+    const simd_f32 q_m_p_x = simd_f32_sub(tail_x, search->px);
+    const simd_f32 q_m_p_y = simd_f32_sub(tail_y, search->py);
+    const simd_f32 u = simd_f32_div(simd_f32_sub(simd_f32_mul(q_m_p_x, search->ry), simd_f32_mul(q_m_p_y, search->rx)), r_cross_s);
+    const simd_f32 t = simd_f32_div(simd_f32_sub(simd_f32_mul(q_m_p_x, sy), simd_f32_mul(q_m_p_y, sx)), r_cross_s);
+    const simd_mask not_parallel = simd_mask_or(simd_f32_lt(r_cross_s, zero), simd_f32_lt(zero, r_cross_s));
+    const simd_mask u_on_segment = simd_mask_and(simd_f32_le(zero, u), simd_f32_le(u, one));
+    const simd_mask t_on_segment = simd_mask_and(simd_f32_le(zero, t), simd_f32_le(t, one));
+    const simd_mask crossed = simd_mask_and(simd_mask_and(valid, not_parallel), simd_mask_and(u_on_segment, t_on_segment));
+
+    // Earlier crossings replace the lane's earliest one, and equally early ones do if they have a lower index
+    const simd_mask is_earlier = simd_mask_and(
+        simd_mask_and(crossed, simd_f32_le(t, search->t_earliest)),
+        simd_mask_or(simd_f32_lt(t, search->t_earliest), simd_f32_lt(index, search->earliest))
+    );
+    search->t_earliest = simd_f32_select(is_earlier, t, search->t_earliest);
+    search->earliest = simd_f32_select(is_earlier, index, search->earliest);
+    search->first_crossed = simd_f32_min(search->first_crossed, simd_f32_select(crossed, index, infinity));
+
+    // Same as environment_is_near_boundary: strictly within the x-range, and closer than the tolerance to the line
+    const simd_f32 distance = simd_f32_add(
+        simd_f32_mul(simd_f32_load(block->normal_x), simd_f32_sub(tail_x, search->near_x)),
+        simd_f32_mul(simd_f32_load(block->normal_y), simd_f32_sub(tail_y, search->near_y))
+    );
+    const simd_mask within_x = simd_mask_and(simd_f32_lt(simd_f32_load(block->min_x), search->near_x), simd_f32_lt(search->near_x, simd_f32_load(block->max_x)));
+    const simd_mask within_tolerance = simd_mask_and(simd_f32_lt(search->tolerance_neg, distance), simd_f32_lt(distance, search->tolerance));
+    const simd_mask near = simd_mask_and(simd_mask_and_not(valid, crossed), simd_mask_and(within_x, within_tolerance));
+    search->first_near = simd_f32_min(search->first_near, simd_f32_select(near, index, infinity));
+}
+
+// Reduces the lanes of a search into its results
+void environment_boundary_search_end(const EnvironmentBoundarySearch* const search, EnvironmentBoundaryHits* const hits)
+{
+    alignas(SIMD_ALIGNMENT_BYTES) float lanes_t_earliest[SIMD_F32_WIDTH];
+    alignas(SIMD_ALIGNMENT_BYTES) float lanes_earliest[SIMD_F32_WIDTH];
+    alignas(SIMD_ALIGNMENT_BYTES) float lanes_first_crossed[SIMD_F32_WIDTH];
+    alignas(SIMD_ALIGNMENT_BYTES) float lanes_first_near[SIMD_F32_WIDTH];
+    simd_f32_store(lanes_t_earliest, search->t_earliest);
+    simd_f32_store(lanes_earliest, search->earliest);
+    simd_f32_store(lanes_first_crossed, search->first_crossed);
+    simd_f32_store(lanes_first_near, search->first_near);
+
+    float t_best = INFINITY;
+    float l_best = INFINITY;
+    float l_crossed = INFINITY;
+    float l_near = INFINITY;
+    for (int lane = 0; lane < SIMD_F32_WIDTH; ++lane)
+    {
+        if (lanes_t_earliest[lane] < t_best || (lanes_t_earliest[lane] == t_best && lanes_earliest[lane] < l_best))
+        {
+            t_best = lanes_t_earliest[lane];
+            l_best = lanes_earliest[lane];
+        }
+        l_crossed = std::fmin(l_crossed, lanes_first_crossed[lane]);
+        l_near = std::fmin(l_near, lanes_first_near[lane]);
+    }
+
+    hits->t_earliest = t_best;
+    hits->earliest = (l_best < INFINITY) ? (int)l_best : -1;
+    hits->first_crossed = (l_crossed < INFINITY) ? (int)l_crossed : -1;
+    hits->first_near = (l_near < INFINITY) ? (int)l_near : -1;
+}
+
+// Tests the segment p -> p_head against all boundaries [from, n_boundaries), other than excluded, a block at a time
+void environment_find_boundary_hits(
+    const Environment* const env,
+    const Vec2* const p,
+    const Vec2* const p_head,
+    const Vec2* const near_point,
+    const int from,
+    const int excluded,
+    EnvironmentBoundaryHits* const hits)
+{
+    EnvironmentBoundarySearch search;
+    environment_boundary_search_begin(&search, env, p, p_head, near_point, from, excluded);
+    for (int b = from / SIMD_F32_WIDTH; b * SIMD_F32_WIDTH < env->n_boundaries; ++b)
+    {
+        environment_boundary_search_block(&search, env->boundary_blocks + b);
+    }
+    environment_boundary_search_end(&search, hits);
+}
+
+// Same as environment_find_boundary_hits, but only tests the given candidates (as from environment_grid_query), which are
+// gathered into blocks
+void environment_find_candidate_boundary_hits(
+    const Environment* const env,
+    const int* const candidates,
+    const int n_candidates,
+    const Vec2* const p,
+    const Vec2* const p_head,
+    const Vec2* const near_point,
+    const int excluded,
+    EnvironmentBoundaryHits* const hits)
+{
+    EnvironmentBoundarySearch search;
+    environment_boundary_search_begin(&search, env, p, p_head, near_point, 0, excluded);
+    EnvironmentBoundaryBlock block{};
+    for (int c = 0; c < n_candidates; c += SIMD_F32_WIDTH)
+    {
+        const int n_lanes = imin(SIMD_F32_WIDTH, n_candidates - c);
+        for (int lane = 0; lane < n_lanes; ++lane)
+        {
+            const int l = candidates[c + lane];
+            environment_boundary_block_copy_lane(&block, lane, env->boundary_blocks + l / SIMD_F32_WIDTH, l % SIMD_F32_WIDTH);
+        }
+        std::fill(block.index + n_lanes, block.index + SIMD_F32_WIDTH, INFINITY);
+        environment_boundary_search_block(&search, &block);
+    }
+    environment_boundary_search_end(&search, hits);
+}
+
+// True if the segment from p (with direction 1 / inv_delta) enters the bounds of a BVH node, expanded by tolerance,
+// within [0, t_max] (slab test); sets t_entry to where it enters. inv_delta must be finite (see
+// environment_bvh_inverse_delta), so that no slab gives a NaN.
+inline bool environment_bvh_node_entered(
+    const EnvironmentBVHNode* const node,
+    const Vec2* const p,
+    const Vec2* const inv_delta,
+    const float tolerance,
+    const float t_max,
+    float* const t_entry)
+{
+    const float tx0 = (node->bounds.min_corner.x - tolerance - p->x) * inv_delta->x;
+    const float tx1 = (node->bounds.max_corner.x + tolerance - p->x) * inv_delta->x;
+    const float ty0 = (node->bounds.min_corner.y - tolerance - p->y) * inv_delta->y;
+    const float ty1 = (node->bounds.max_corner.y + tolerance - p->y) * inv_delta->y;
+    const float t_enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), 0.f);
+    const float t_exit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), t_max);
+    *t_entry = t_enter;
+    return t_enter <= t_exit;
+}
+
+// Reciprocal of a segment direction component, or a huge value if that is (nearly) zero
+inline float environment_bvh_inverse_delta(const float delta)
+{
+    return (std::abs(delta) > 1e-30f) ? (1.f / delta) : 1e30f;
+}
+
+// Same as environment_find_boundary_hits, but only tests the leaf blocks of BVH nodes which the segment passes through
+// (with bounds expanded by the boundary thickness), and boundaries added since the BVH was built. near_point must be on
+// the segment; as with the grid, boundaries are only near it within the boundary thickness of their bounds.
+//
+// With earliest_only, nodes which the segment enters after the earliest crossing found so far are skipped: earliest and
+// t_earliest are still exact, as is first_near when nothing is crossed, but first_crossed may not be.
+void environment_bvh_find_boundary_hits(
+    const Environment* const env,
+    const Vec2* const p,
+    const Vec2* const p_head,
+    const Vec2* const near_point,
+    const int from,
+    const int excluded,
+    const bool earliest_only,
+    EnvironmentBoundaryHits* const hits)
+{
+    const EnvironmentBVH* const bvh = &env->bvh;
+    const Vec2 inv_delta{environment_bvh_inverse_delta(p_head->x - p->x), environment_bvh_inverse_delta(p_head->y - p->y)};
+    const float tolerance = env->boundary_thickness;
+
+    EnvironmentBoundarySearch search;
+    environment_boundary_search_begin(&search, env, p, p_head, near_point, from, excluded);
+
+    // Nodes are tested before they are pushed, along with the fraction along the segment at which it enters them
+    float t_max = 1.f;
+    int stack[ENVIRONMENT_BVH_STACK_SIZE];
+    float stack_t_entry[ENVIRONMENT_BVH_STACK_SIZE];
+    int stack_size = 0;
+    float t_root;
+    if (bvh->n_nodes > 0 && environment_bvh_node_entered(bvh->nodes, p, &inv_delta, tolerance, t_max, &t_root))
+    {
+        stack[stack_size] = 0;
+        stack_t_entry[stack_size++] = t_root;
+    }
+
+    while (stack_size > 0)
+    {
+        --stack_size;
+        const EnvironmentBVHNode* const node = bvh->nodes + stack[stack_size];
+        if (stack_t_entry[stack_size] > t_max)
+        {
+            continue;
+        }
+        else if (node->count == 0)
+        {
+            // Visit the child which is entered first, first (which only matters for earliest_only)
+            const EnvironmentBVHNode* const left = bvh->nodes + node->first;
+            const EnvironmentBVHNode* const right = left + 1;
+            float t_left, t_right;
+            const bool hit_left = environment_bvh_node_entered(left, p, &inv_delta, tolerance, t_max, &t_left);
+            const bool hit_right = environment_bvh_node_entered(right, p, &inv_delta, tolerance, t_max, &t_right);
+            if (hit_left && hit_right)
+            {
+                const bool left_first = t_left < t_right;
+                stack[stack_size] = left_first ? (node->first + 1) : (node->first + 0);
+                stack_t_entry[stack_size++] = left_first ? t_right : t_left;
+                stack[stack_size] = left_first ? (node->first + 0) : (node->first + 1);
+                stack_t_entry[stack_size++] = left_first ? t_left : t_right;
+            }
+            else if (hit_left)
+            {
+                stack[stack_size] = node->first + 0;
+                stack_t_entry[stack_size++] = t_left;
+            }
+            else if (hit_right)
+            {
+                stack[stack_size] = node->first + 1;
+                stack_t_entry[stack_size++] = t_right;
+            }
+            continue;
+        }
+
+        for (int b = node->first; b < node->first + node->count; ++b)
+        {
+            environment_boundary_search_block(&search, bvh->blocks + b);
+        }
+        if (earliest_only)
+        {
+            t_max = std::fmin(t_max, simd_f32_reduce_min(search.t_earliest));
+        }
+    }
+
+    // Check boundaries added since the BVH was last built
+    for (int b = imax(from, bvh->n_indexed) / SIMD_F32_WIDTH; b * SIMD_F32_WIDTH < env->n_boundaries; ++b)
+    {
+        environment_boundary_search_block(&search, env->boundary_blocks + b);
+    }
+    environment_boundary_search_end(&search, hits);
+}
+
+// Lowest index of a boundary which is crossed or near, or -1
+inline int environment_boundary_hits_first(const EnvironmentBoundaryHits* const hits)
+{
+    if (hits->first_crossed < 0 || (hits->first_near >= 0 && hits->first_near < hits->first_crossed))
+    {
+        return hits->first_near;
+    }
+    return hits->first_crossed;
+}
+
+// Same as environment_grid_query, but also returns -1 for levels small enough that searching all boundaries with
+// environment_find_boundary_hits is cheaper than the grid. On -1, search with environment_search_boundary_hits.
+inline int environment_query_candidates(
+    const Environment* const env,
+    int* const candidates,
+    const Vec2* const start,
+    const Vec2* const end)
+{
+    if (env->n_boundaries <= ENVIRONMENT_SCAN_BOUNDARIES_MAX)
+    {
+        return -1;
+    }
+    return environment_grid_query(&env->grid, candidates, ENVIRONMENT_GRID_QUERY_MAX, start, end, env->boundary_thickness);
+}
+
+// Searches boundaries when the grid can't narrow them down: small levels are searched in full, and larger ones (where the
+// query overflowed) through the BVH, see environment_bvh_find_boundary_hits
+inline void environment_search_boundary_hits(
+    const Environment* const env,
+    const Vec2* const p,
+    const Vec2* const p_head,
+    const Vec2* const near_point,
+    const int from,
+    const int excluded,
+    const bool earliest_only,
+    EnvironmentBoundaryHits* const hits)
+{
+    if (env->n_boundaries <= ENVIRONMENT_SCAN_BOUNDARIES_MAX)
+    {
+        environment_find_boundary_hits(env, p, p_head, near_point, from, excluded, hits);
+    }
+    else
+    {
+        environment_bvh_find_boundary_hits(env, p, p_head, near_point, from, excluded, earliest_only, hits);
+    }
+}
+
+// Rebuilds the boundary BVH in bulk; call once all level boundaries have been added
+void environment_build_bvh(Environment* const env)
+{
+    environment_bvh_build(&env->bvh, env->boundaries, env->boundary_blocks, env->n_boundaries);
+}
+
+// True if the segment start -> end crosses any boundary
+bool environment_is_boundary_between(const Environment* const env, const Vec2* const start, const Vec2* const end)
+{
+    EnvironmentBoundaryHits hits;
+    environment_bvh_find_boundary_hits(env, start, end, end, 0, -1, true, &hits);
+    return hits.earliest >= 0;
+}
+
+// Finds the boundary which the segment start -> end crosses first (the lowest index on ties). On a hit, sets the
+// intercept point and the index of the boundary which was hit.
+bool environment_nearest_boundary_hit(
+    const Environment* const env,
+    const Vec2* const start,
+    const Vec2* const end,
+    Vec2* const intercept,
+    int* const boundary_index)
+{
+    EnvironmentBoundaryHits hits;
+    environment_bvh_find_boundary_hits(env, start, end, end, 0, -1, true, &hits);
+    if (hits.earliest < 0)
+    {
+        return false;
+    }
+
+    intercept->x = start->x + hits.t_earliest * (end->x - start->x);
+    intercept->y = start->y + hits.t_earliest * (end->y - start->y);
+    *boundary_index = hits.earliest;
+    return true;
+}
+
+void environment_destroy(Environment* const env)
+{
+    // Grid and BVH storage is in the arena too
+    memory_arena_destroy(&env->arena);
+}
+
+// Sets up the hard-coded level: walls around the play area, a few obstacles and the goal region
+void environment_load_default_level(Environment* const env)
+{
+    // bottom wall
+    environment_add_boundary(
+        env,
+        Vec2{-BOUNDARY_LIMIT, -BOUNDARY_LIMIT},
+        Vec2{+BOUNDARY_LIMIT, -BOUNDARY_LIMIT}
+    );
+    // right wall
+    environment_add_boundary(
+        env,
+        Vec2{+BOUNDARY_LIMIT, -BOUNDARY_LIMIT},
+        Vec2{+BOUNDARY_LIMIT, +BOUNDARY_LIMIT}
+    );
+    // top wall
+    environment_add_boundary(
+        env,
+        Vec2{-BOUNDARY_LIMIT, +BOUNDARY_LIMIT},
+        Vec2{+BOUNDARY_LIMIT, +BOUNDARY_LIMIT}
+    );
+    // left wall
+    environment_add_boundary(
+        env,
+        Vec2{-BOUNDARY_LIMIT, -BOUNDARY_LIMIT},
+        Vec2{-BOUNDARY_LIMIT, +BOUNDARY_LIMIT}
+    );
+
+    // add some hard-coded level stuff
+    environment_add_boundary(
+        env,
+        Vec2{-0.5f * BOUNDARY_LIMIT, +0.5 * BOUNDARY_LIMIT},
+        Vec2{+1.0f * BOUNDARY_LIMIT, +0.5 * BOUNDARY_LIMIT}
+    );
+    environment_add_boundary(
+        env,
+        Vec2{-1.0f * BOUNDARY_LIMIT, -0.5 * BOUNDARY_LIMIT},
+        Vec2{+0.5f * BOUNDARY_LIMIT, -0.5 * BOUNDARY_LIMIT}
+    );
+
+    environment_add_boundary(
+        env,
+        Vec2{-0.2f * BOUNDARY_LIMIT, -0.2 * BOUNDARY_LIMIT},
+        Vec2{+0.2f * BOUNDARY_LIMIT, +0.2 * BOUNDARY_LIMIT}
+    );
+
+    // Index all level boundaries for segment queries
+    environment_build_bvh(env);
+
+    env->goal = aabb_create(
+        Vec2{BOUNDARY_LIMIT - 0.4, BOUNDARY_LIMIT - 0.4},
+        Vec2{BOUNDARY_LIMIT - 0.1, BOUNDARY_LIMIT - 0.1}
+    );
+    env->valid_placement = aabb_create(
+        Vec2{-BOUNDARY_LIMIT, -BOUNDARY_LIMIT},
+        Vec2{+BOUNDARY_LIMIT, +BOUNDARY_LIMIT}
+    );
+}
+
+// Number of particles handed to a worker thread at a time (a multiple of the SIMD padding and of the alive bitset word
+// size, so chunks never share vectors or alive words)
+static const int PARTICLE_CHUNK_SIZE = 4096;
+static_assert(PARTICLE_CHUNK_SIZE % BITSET_WORD_BITS == 0, "chunks must not share alive bitset words");
+
+// The play area is split into a grid of zones, each of which drives the volume of one music track
+static const int N_AUDIO_ZONES_PER_SIDE = 4;
+static const int N_AUDIO_ZONES = N_AUDIO_ZONES_PER_SIDE * N_AUDIO_ZONES_PER_SIDE;
+
+// Particles are binned on a finer grid than the audio zones, so that gains change smoothly as particles move across
+static const int AUDIO_HISTOGRAM_ZONES_PER_SIDE = 16;
+
+// Number of particles in an audio zone which plays its track at full volume
+static const float AUDIO_ZONE_FULL_GAIN_COUNT = 4.f;
+
+// Stride between per-thread counters, so that threads never write to the same cache line
+static const int WORKER_COUNTER_STRIDE = 16;
+
+// Per-thread results of the parallel particle phases, which are reduced into shared state after each phase
+struct WorkerAccumulators
+{
+    MemoryArena arena;                                   // Holds all of the arrays below
+    EnvironmentBoundaryProperties** boundary_properties; // [n_threads], pool arrays of [n_boundaries_max]
+    float** planet_mass_gained;                          // [n_threads], pool arrays of [n_planets_max]
+    int* captured;                                       // [n_threads][WORKER_COUNTER_STRIDE], 1 used
+    int n_threads;
+    int n_boundaries_max; // Committed per thread; grown along with the environment
+    int n_planets_max;    // Committed per thread; grown along with planets
+};
+
+// Per-thread arrays are reserved for up to boundary_count boundaries and planets_count planets (the n_reserved of the
+// environment and planets), and committed as those grow
+void worker_accumulators_initialize(WorkerAccumulators* const acc, const int thread_count, const int boundary_count, const int planets_count)
+{
+    const std::size_t boundary_bytes = sizeof(EnvironmentBoundaryProperties) * boundary_count;
+    const std::size_t planet_bytes = sizeof(float) * planets_count;
+    const std::size_t pointer_bytes = sizeof(void*) * thread_count;
+    const std::size_t captured_bytes = sizeof(int) * thread_count * WORKER_COUNTER_STRIDE;
+    memory_arena_initialize(
+        &acc->arena,
+        thread_count * (memory_arena_array_bytes(boundary_bytes) + memory_arena_array_bytes(planet_bytes))
+            + 2 * memory_arena_array_bytes(pointer_bytes)
+            + memory_arena_array_bytes(captured_bytes)
+    );
+    acc->boundary_properties = (EnvironmentBoundaryProperties**)memory_arena_reserve_array(&acc->arena, pointer_bytes);
+    acc->planet_mass_gained = (float**)memory_arena_reserve_array(&acc->arena, pointer_bytes);
+    acc->captured = (int*)memory_arena_reserve_array(&acc->arena, captured_bytes);
+    pool_array_commit(acc->boundary_properties, pointer_bytes);
+    pool_array_commit(acc->planet_mass_gained, pointer_bytes);
+    pool_array_commit(acc->captured, captured_bytes);
+    for (int t = 0; t < thread_count; ++t)
+    {
+        acc->boundary_properties[t] = (EnvironmentBoundaryProperties*)memory_arena_reserve_array(&acc->arena, boundary_bytes);
+        acc->planet_mass_gained[t] = (float*)memory_arena_reserve_array(&acc->arena, planet_bytes);
+    }
+
+    acc->n_threads = thread_count;
+    acc->n_boundaries_max = 0;
+    acc->n_planets_max = 0;
+}
+
+void worker_accumulators_destroy(WorkerAccumulators* const acc)
+{
+    memory_arena_destroy(&acc->arena);
+}
+
+// Commits (zeroed) per-thread boundary hits for up to boundary_count boundaries
+void worker_accumulators_grow_boundaries(WorkerAccumulators* const acc, const int boundary_count)
+{
+    if (boundary_count <= acc->n_boundaries_max)
+    {
+        return;
+    }
+    for (int t = 0; t < acc->n_threads; ++t)
+    {
+        pool_array_commit(acc->boundary_properties[t], sizeof(EnvironmentBoundaryProperties) * boundary_count);
+    }
+    acc->n_boundaries_max = boundary_count;
+}
+
+// Commits (zeroed) per-thread planet mass gains for up to planets_count planets
+void worker_accumulators_grow_planets(WorkerAccumulators* const acc, const int planets_count)
+{
+    if (planets_count <= acc->n_planets_max)
+    {
+        return;
+    }
+    for (int t = 0; t < acc->n_threads; ++t)
+    {
+        pool_array_commit(acc->planet_mass_gained[t], sizeof(float) * planets_count);
+    }
+    acc->n_planets_max = planets_count;
+}
+
+void worker_accumulators_reset_counters(WorkerAccumulators* const acc)
+{
+    std::memset(acc->captured, 0, sizeof(int) * acc->n_threads * WORKER_COUNTER_STRIDE);
+}
+
+// Adds per-thread boundary hits to the environment, and resets them
+void worker_accumulators_reduce_boundary_hits(WorkerAccumulators* const acc, const Environment* const env)
+{
+    for (int t = 0; t < acc->n_threads; ++t)
+    {
+        EnvironmentBoundaryProperties* const boundary_hits = acc->boundary_properties[t];
+        for (int l = 0; l < env->n_boundaries; ++l)
+        {
+            (env->boundary_properties + l)->tail_hits += (boundary_hits + l)->tail_hits;
+            (env->boundary_properties + l)->head_hits += (boundary_hits + l)->head_hits;
+        }
+        std::memset(boundary_hits, 0, sizeof(EnvironmentBoundaryProperties) * env->n_boundaries);
+    }
+}
+
+int worker_accumulators_reduce_captured(const WorkerAccumulators* const acc)
+{
+    int captured = 0;
+    for (int t = 0; t < acc->n_threads; ++t)
+    {
+        captured += acc->captured[t * WORKER_COUNTER_STRIDE];
+    }
+    return captured;
+}
+
+// Particle counts over an n_x by n_y grid of zones covering the [-1, 1] play area. Threads bin particles into their
+// own counts, which are merged into counts afterwards.
+struct ZoneHistogram
+{
+    unsigned* counts;        // [n_x][n_y]
+    unsigned* thread_counts; // [n_threads][thread_stride]
+    int thread_stride;       // n_x * n_y, padded to WORKER_COUNTER_STRIDE
+    int n_threads;
+    int n_x;
+    int n_y;
+};
+
+void zone_histogram_initialize(ZoneHistogram* const zh, const int zone_count_x, const int zone_count_y, const int thread_count)
+{
+    const int n_zones = zone_count_x * zone_count_y;
+    zh->thread_stride = ((n_zones + WORKER_COUNTER_STRIDE - 1) / WORKER_COUNTER_STRIDE) * WORKER_COUNTER_STRIDE;
+    zh->counts = (unsigned*)std::malloc(sizeof(unsigned) * n_zones);
+    zh->thread_counts = (unsigned*)std::malloc(sizeof(unsigned) * thread_count * zh->thread_stride);
+    std::memset(zh->counts, 0, sizeof(unsigned) * n_zones);
+    std::memset(zh->thread_counts, 0, sizeof(unsigned) * thread_count * zh->thread_stride);
+    zh->n_threads = thread_count;
+    zh->n_x = zone_count_x;
+    zh->n_y = zone_count_y;
+}
+
+void zone_histogram_destroy(ZoneHistogram* const zh)
+{
+    std::free(zh->counts);
+    std::free(zh->thread_counts);
+}
+
+inline unsigned* zone_histogram_thread_counts(const ZoneHistogram* const zh, const int thread_index)
+{
+    return zh->thread_counts + thread_index * zh->thread_stride;
+}
+
+void zone_histogram_reset_threads(ZoneHistogram* const zh)
+{
+    std::memset(zh->thread_counts, 0, sizeof(unsigned) * zh->n_threads * zh->thread_stride);
+}
+
+// Bins positions [begin, end) into thread_counts; positions on or past the edges of the play area go to edge zones
+void zone_histogram_count_range(
+    const ZoneHistogram* const zh,
+    unsigned* const thread_counts,
+    const Vec2Array* const positions,
+    const int begin,
+    const int end)
+{
+    // Clamped as floats with plain comparisons, which compile to branch-free min/max
+    const float scale_x = 0.5f * zh->n_x;
+    const float scale_y = 0.5f * zh->n_y;
+    const float xd_max = (float)(zh->n_x - 1);
+    const float yd_max = (float)(zh->n_y - 1);
+    for (int i = begin; i < end; ++i)
+    {
+        float x = (positions->x[i] + 1.f) * scale_x;
+        float y = (positions->y[i] + 1.f) * scale_y;
+        x = (x > 0.f) ? x : 0.f;
+        y = (y > 0.f) ? y : 0.f;
+        x = (x < xd_max) ? x : xd_max;
+        y = (y < yd_max) ? y : yd_max;
+        thread_counts[(int)x * zh->n_y + (int)y] += 1;
+    }
+}
+
+void zone_histogram_merge(ZoneHistogram* const zh)
+{
+    const int n_zones = zh->n_x * zh->n_y;
+    std::memcpy(zh->counts, zh->thread_counts, sizeof(unsigned) * n_zones);
+    for (int t = 1; t < zh->n_threads; ++t)
+    {
+        const unsigned* const thread_counts = zone_histogram_thread_counts(zh, t);
+        for (int z = 0; z < n_zones; ++z)
+        {
+            zh->counts[z] += thread_counts[z];
+        }
+    }
+}
+
+// Writes gains in [0, 1] for a coarser n_sources_per_side^2 grid of audio zones (indexed like the histogram). Each
+// histogram zone is shared between the (up to) four audio zones nearest to its center, weighted bilinearly, so that
+// gains fade between audio zones instead of jumping. An audio zone plays at full gain with full_gain_count particles.
+void zone_histogram_gains(const ZoneHistogram* const zh, float* const gains, const int n_sources_per_side, const float full_gain_count)
+{
+    for (int s = 0; s < n_sources_per_side * n_sources_per_side; ++s)
+    {
+        gains[s] = 0.f;
+    }
+
+    for (int xd = 0; xd < zh->n_x; ++xd)
+    {
+        // Zone center, in units of audio zones, relative to the center of the first audio zone
+        const float u = ((xd + 0.5f) * n_sources_per_side) / zh->n_x - 0.5f;
+        const int x0 = imin(imax((int)std::floor(u), 0), n_sources_per_side - 1);
+        const int x1 = imin(x0 + 1, n_sources_per_side - 1);
+        const float wx = std::fmin(std::fmax(u - x0, 0.f), 1.f);
+
+        for (int yd = 0; yd < zh->n_y; ++yd)
+        {
+            const float v = ((yd + 0.5f) * n_sources_per_side) / zh->n_y - 0.5f;
+            const int y0 = imin(imax((int)std::floor(v), 0), n_sources_per_side - 1);
+            const int y1 = imin(y0 + 1, n_sources_per_side - 1);
+            const float wy = std::fmin(std::fmax(v - y0, 0.f), 1.f);
+
+            const float count = (float)zh->counts[xd * zh->n_y + yd];
+            gains[x0 * n_sources_per_side + y0] += count * (1.f - wx) * (1.f - wy);
+            gains[x1 * n_sources_per_side + y0] += count * wx * (1.f - wy);
+            gains[x0 * n_sources_per_side + y1] += count * (1.f - wx) * wy;
+            gains[x1 * n_sources_per_side + y1] += count * wx * wy;
+        }
+    }
+
+    for (int s = 0; s < n_sources_per_side * n_sources_per_side; ++s)
+    {
+        gains[s] = std::fmin(1.f, gains[s] / full_gain_count);
+    }
+}
+
+// Particles in contact mode are disks of this diameter
+static const float PARTICLE_CONTACT_DIAMETER = 0.003f;
+static const float PARTICLE_CONTACT_DIAMETER_SQ = PARTICLE_CONTACT_DIAMETER * PARTICLE_CONTACT_DIAMETER;
+
+// Cells per side of the contact grid over the [-1, 1] play area; cells are at least one diameter wide, so that all
+// contacts of a particle are in its own or the 8 surrounding cells
+static const int PARTICLE_CONTACT_CELLS_PER_SIDE = (int)(2.f / PARTICLE_CONTACT_DIAMETER);
+static const int PARTICLE_CONTACT_CELLS = PARTICLE_CONTACT_CELLS_PER_SIDE * PARTICLE_CONTACT_CELLS_PER_SIDE;
+
+// Damping of the normal velocity between particles in contact (per unit of time)
+static const float PARTICLE_CONTACT_DAMPING = 10.f;
+
+// The contact pass reads whole SIMD vectors of neighbours, up to SIMD_F32_WIDTH - 1 floats past the last particle, so
+// particle positions and velocities (and the scratch arrays they are swapped with) have this much extra room
+static const int PARTICLE_CONTACT_READ_PADDING = SIMD_F32_WIDTH;
+
+enum ParticleContactMode
+{
+    PARTICLE_CONTACTS_NONE,        // Particles pass through each other
+    PARTICLE_CONTACTS_SOFT_SPHERE, // Overlapping particles are pushed apart by a damped spring
+    PARTICLE_CONTACT_MODE_COUNT
+};
+
+static const char* const PARTICLE_CONTACT_MODE_NAMES[PARTICLE_CONTACT_MODE_COUNT] = {
+    "none",
+    "soft sphere",
+};
+
+enum ParticleCollisionMode
+{
+    PARTICLE_COLLISIONS_FIRST_HIT, // The first boundary found along the step is resolved, and the rest of the step is dropped
+    PARTICLE_COLLISIONS_SWEPT,     // The earliest boundary along the step is resolved, and the rest of the step is reflected
+    PARTICLE_COLLISION_MODE_COUNT
+};
+
+static const char* const PARTICLE_COLLISION_MODE_NAMES[PARTICLE_COLLISION_MODE_COUNT] = {
+    "first hit",
+    "swept",
+};
+
+// Compact storage keeps positions and velocities as int16 fixed point over their whole range: positions are always
+// clamped to BOUNDARY_LIMIT, and velocities to max_velocity, which is at most PARTICLE_COMPACT_VELOCITY_LIMIT
+static const float PARTICLE_COMPACT_VELOCITY_LIMIT = 5.f;
+static const float PARTICLE_COMPACT_POSITION_SCALE = BOUNDARY_LIMIT / 32767.f;
+static const float PARTICLE_COMPACT_VELOCITY_SCALE = PARTICLE_COMPACT_VELOCITY_LIMIT / 32767.f;
+
+enum ParticleStorageMode
+{
+    PARTICLE_STORAGE_FLOAT, // Positions and velocities are floats
+    PARTICLE_STORAGE_INT16, // Positions and velocities are int16 (the compact_* arrays), and float arrays are scratch
+    PARTICLE_STORAGE_MODE_COUNT
+};
+
+static const char* const PARTICLE_STORAGE_MODE_NAMES[PARTICLE_STORAGE_MODE_COUNT] = {
+    "float",
+    "int16",
+};
+
+// Cell list for particle contacts. Particles themselves are counting-sorted by contact grid cell (row-major) every
+// tick, so particles [cell_starts[c], cell_starts[c + 1]) are in cell c. Particles move little between ticks, so
+// sorting mostly moves data sequentially, and the contact pass reads neighbours from nearby memory.
+struct ParticleContactGrid
+{
+    int* cell_starts;    // [PARTICLE_CONTACT_CELLS + 1]
+    int* particle_cells; // [n_max], cell of each particle
+
+    // Particle states are gathered into these in sorted order, and then swapped with the particle arrays
+    Vec2Array positions_previous;
+    Vec2Array positions;
+    Vec2Array velocities;
+    Vec2Array forces;
+    std::uint64_t* alive;
+};
+
+// Arrays of the grid (ARRAY_COUNT of them) are reserved in arena: per-particle arrays for up to particle_count
+// particles (see particle_contact_grid_commit), and cell_starts, which is smaller than any of those
+static const int PARTICLE_CONTACT_GRID_ARRAY_COUNT = 11;
+
+void particle_contact_grid_initialize(ParticleContactGrid* const grid, MemoryArena* const arena, const int particle_count)
+{
+    grid->cell_starts = (int*)memory_arena_reserve_array(arena, sizeof(int) * (PARTICLE_CONTACT_CELLS + 1));
+    pool_array_commit(grid->cell_starts, sizeof(int) * (PARTICLE_CONTACT_CELLS + 1));
+    grid->particle_cells = (int*)memory_arena_reserve_array(arena, sizeof(int) * particle_count);
+    vec2_array_reserve(&grid->positions_previous, arena, particle_count + PARTICLE_CONTACT_READ_PADDING);
+    vec2_array_reserve(&grid->positions, arena, particle_count + PARTICLE_CONTACT_READ_PADDING);
+    vec2_array_reserve(&grid->velocities, arena, particle_count + PARTICLE_CONTACT_READ_PADDING);
+    vec2_array_reserve(&grid->forces, arena, particle_count);
+    grid->alive = (std::uint64_t*)memory_arena_reserve_array(arena, sizeof(std::uint64_t) * bitset_word_count(simd_padded_count(particle_count)));
+}
+
+// Commits per-particle arrays for the first particle_count particles
+bool particle_contact_grid_commit(ParticleContactGrid* const grid, const int particle_count)
+{
+    return pool_array_commit(grid->particle_cells, sizeof(int) * particle_count)
+        && vec2_array_commit(&grid->positions_previous, particle_count + PARTICLE_CONTACT_READ_PADDING)
+        && vec2_array_commit(&grid->positions, particle_count + PARTICLE_CONTACT_READ_PADDING)
+        && vec2_array_commit(&grid->velocities, particle_count + PARTICLE_CONTACT_READ_PADDING)
+        && vec2_array_commit(&grid->forces, particle_count)
+        && pool_array_commit(grid->alive, sizeof(std::uint64_t) * bitset_word_count(simd_padded_count(particle_count)));
+}
+
+// Particle capacity committed by default, and the most particles a pool can grow to. Reserved address space is ~100
+// bytes per particle, and only committed (and touched) capacity takes physical memory.
+static const int N_PARTICLES_INITIAL = 1 << 16;
+static const int N_PARTICLES_RESERVED = 1 << 23;
+
+// Per-particle pool arrays of Particles itself, besides those of its contact grid
+static const int PARTICLE_ARENA_ARRAY_COUNT = 16;
+
+// Particles moving slower than this are at rest; see Particles::sleep_steps
+static const float PARTICLE_SLEEP_SPEED = 0.05f;
+
+// Steps at rest before particles fall asleep, when sleeping is enabled (see particles_set_sleep_steps)
+static const int PARTICLE_SLEEP_STEPS_DEFAULT = 30;
+
+struct Particles
+{
+    // All per-particle pool arrays below (including the contact grid's) are in one arena
+    MemoryArena arena;
+
+    // Particle states are stored as separate (aligned, padded) x and y arrays; use vec2_array_get/set for single particles
+    Vec2Array positions_previous;
+    Vec2Array positions;
+    Vec2Array velocities;
+    Vec2Array forces;
+    std::uint64_t* alive; // Bitset, see bitset.inl; bits at and past n_active are clear
+    int n_active;
+    int n_max;      // Committed capacity, which grows as particles spawn (see particles_grow)
+    int n_reserved; // Most particles the pool arrays can grow to
+
+    float max_velocity;
+
+    ParticleCollisionMode collision_mode;
+    int max_bounces; // Boundary hits resolved per particle per step in swept mode
+
+    // States in compact storage mode; forces and alive flags are the same in both modes
+    ParticleStorageMode storage_mode;
+    Vec2ArrayI16 compact_positions_previous;
+    Vec2ArrayI16 compact_positions;
+    Vec2ArrayI16 compact_velocities;
+
+    ParticleContactMode contact_mode;
+    float contact_stiffness;
+    ParticleContactGrid contact_grid;
+
+    // Steps each particle has been at rest for, up to sleep_steps, at which it is asleep: sleeping particles are held
+    // in place, and skip integration, collisions and planet pull until something wakes them (see
+    // particles_wake_on_changes). 0 disables sleeping, and rest_steps is not kept up to date.
+    std::int16_t* rest_steps;
+    int sleep_steps;
+    int environment_revision; // Environment::revision as of the last particles_wake_on_changes
+};
+
+// Commits particle storage for at least particle_count particles (see pool_grow_count); returns false past n_reserved
+bool particles_grow(Particles* const ps, const int particle_count)
+{
+    const int n_max = pool_grow_count(ps->n_max, particle_count, ps->n_reserved);
+    if (n_max <= ps->n_max)
+    {
+        return n_max >= 0;
+    }
+    const bool committed = vec2_array_commit(&ps->positions_previous, n_max + PARTICLE_CONTACT_READ_PADDING)
+        && vec2_array_commit(&ps->positions, n_max + PARTICLE_CONTACT_READ_PADDING)
+        && vec2_array_commit(&ps->velocities, n_max + PARTICLE_CONTACT_READ_PADDING)
+        && vec2_array_commit(&ps->forces, n_max)
+        && pool_array_commit(ps->alive, sizeof(std::uint64_t) * bitset_word_count(simd_padded_count(n_max)))
+        && vec2_array_i16_commit(&ps->compact_positions_previous, n_max)
+        && vec2_array_i16_commit(&ps->compact_positions, n_max)
+        && vec2_array_i16_commit(&ps->compact_velocities, n_max)
+        && pool_array_commit(ps->rest_steps, sizeof(std::int16_t) * simd_padded_count(n_max))
+        && particle_contact_grid_commit(&ps->contact_grid, n_max);
+    if (committed)
+    {
+        ps->n_max = n_max;
+    }
+    return committed;
+}
+
+// Starts with capacity for particle_count particles, which grows on demand up to N_PARTICLES_RESERVED
+void particles_initialize(Particles* const ps, const int particle_count)
+{
+    // Positions are swapped with previous positions every step, so both are padded for contact reads
+    // Arrays are at most a padded float array each
+    ps->n_reserved = imax(particle_count, N_PARTICLES_RESERVED);
+    const std::size_t max_array_bytes = sizeof(float) * simd_padded_count(ps->n_reserved + PARTICLE_CONTACT_READ_PADDING);
+    memory_arena_initialize(&ps->arena, (PARTICLE_ARENA_ARRAY_COUNT + PARTICLE_CONTACT_GRID_ARRAY_COUNT) * memory_arena_array_bytes(max_array_bytes));
+
+    vec2_array_reserve(&ps->positions_previous, &ps->arena, ps->n_reserved + PARTICLE_CONTACT_READ_PADDING);
+    vec2_array_reserve(&ps->positions, &ps->arena, ps->n_reserved + PARTICLE_CONTACT_READ_PADDING);
+    vec2_array_reserve(&ps->velocities, &ps->arena, ps->n_reserved + PARTICLE_CONTACT_READ_PADDING);
+    vec2_array_reserve(&ps->forces, &ps->arena, ps->n_reserved);
+    ps->alive = (std::uint64_t*)memory_arena_reserve_array(&ps->arena, sizeof(std::uint64_t) * bitset_word_count(simd_padded_count(ps->n_reserved)));
+
+    ps->n_active = 0;
+    ps->max_velocity = 2.5;
+
+    ps->collision_mode = PARTICLE_COLLISIONS_FIRST_HIT;
+    ps->max_bounces = 4;
+
+    ps->storage_mode = PARTICLE_STORAGE_FLOAT;
+    vec2_array_i16_reserve(&ps->compact_positions_previous, &ps->arena, ps->n_reserved);
+    vec2_array_i16_reserve(&ps->compact_positions, &ps->arena, ps->n_reserved);
+    vec2_array_i16_reserve(&ps->compact_velocities, &ps->arena, ps->n_reserved);
+
+    ps->contact_mode = PARTICLE_CONTACTS_NONE;
+    ps->contact_stiffness = 4000.f;
+    particle_contact_grid_initialize(&ps->contact_grid, &ps->arena, ps->n_reserved);
+
+    ps->rest_steps = (std::int16_t*)memory_arena_reserve_array(&ps->arena, sizeof(std::int16_t) * simd_padded_count(ps->n_reserved));
+    ps->sleep_steps = 0;
+    ps->environment_revision = 0;
+
+    ps->n_max = 0;
+    particles_grow(ps, particle_count);
+}
+
+inline std::int16_t particle_compact_encode(const float value, const float scale)
+{
+    return (std::int16_t)std::lrint(clampf(value / scale, -32767.f, 32767.f));
+}
+
+// Converts states of active particles from float to compact storage
+void particles_encode_states(Particles* const ps)
+{
+    const int n_padded = simd_padded_count(ps->n_active);
+    simd_encode_i16_n(ps->compact_positions_previous.x, ps->positions_previous.x, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+    simd_encode_i16_n(ps->compact_positions_previous.y, ps->positions_previous.y, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+    simd_encode_i16_n(ps->compact_positions.x, ps->positions.x, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+    simd_encode_i16_n(ps->compact_positions.y, ps->positions.y, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+    simd_encode_i16_n(ps->compact_velocities.x, ps->velocities.x, PARTICLE_COMPACT_VELOCITY_SCALE, n_padded);
+    simd_encode_i16_n(ps->compact_velocities.y, ps->velocities.y, PARTICLE_COMPACT_VELOCITY_SCALE, n_padded);
+}
+
+// Converts states of active particles from compact to float storage
+void particles_decode_states(Particles* const ps)
+{
+    const int n_padded = simd_padded_count(ps->n_active);
+    simd_decode_i16_n(ps->positions_previous.x, ps->compact_positions_previous.x, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+    simd_decode_i16_n(ps->positions_previous.y, ps->compact_positions_previous.y, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+    simd_decode_i16_n(ps->positions.x, ps->compact_positions.x, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+    simd_decode_i16_n(ps->positions.y, ps->compact_positions.y, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+    simd_decode_i16_n(ps->velocities.x, ps->compact_velocities.x, PARTICLE_COMPACT_VELOCITY_SCALE, n_padded);
+    simd_decode_i16_n(ps->velocities.y, ps->compact_velocities.y, PARTICLE_COMPACT_VELOCITY_SCALE, n_padded);
+}
+
+void particles_set_storage_mode(Particles* const ps, const ParticleStorageMode mode)
+{
+    if (mode == ps->storage_mode)
+    {
+        return;
+    }
+    else if (mode == PARTICLE_STORAGE_INT16)
+    {
+        particles_encode_states(ps);
+    }
+    else
+    {
+        particles_decode_states(ps);
+    }
+    ps->storage_mode = mode;
+}
+
+void particles_spawn_at(Particles* const ps, const Vec2 position)
+{
+    if (!particles_grow(ps, ps->n_active + 1))
+    {
+        return;
+    }
+
+    // Initialize point state
+    vec2_array_set(&ps->positions, ps->n_active, &position);
+    vec2_array_set(&ps->positions_previous, ps->n_active, &position);
+    vec2_array_set_zero(&ps->velocities, ps->n_active);
+    vec2_array_set_zero(&ps->forces, ps->n_active);
+    bitset_set(ps->alive, ps->n_active);
+    if (ps->storage_mode == PARTICLE_STORAGE_INT16)
+    {
+        ps->compact_positions.x[ps->n_active] = particle_compact_encode(position.x, PARTICLE_COMPACT_POSITION_SCALE);
+        ps->compact_positions.y[ps->n_active] = particle_compact_encode(position.y, PARTICLE_COMPACT_POSITION_SCALE);
+        ps->compact_positions_previous.x[ps->n_active] = ps->compact_positions.x[ps->n_active];
+        ps->compact_positions_previous.y[ps->n_active] = ps->compact_positions.y[ps->n_active];
+        ps->compact_velocities.x[ps->n_active] = 0;
+        ps->compact_velocities.y[ps->n_active] = 0;
+    }
+    ps->rest_steps[ps->n_active] = 0;
+
+    // Increment number of active particles
+    ++ps->n_active;
+}
+
+// Spawns n particles with the given positions and velocities (arrays of n values each), growing storage once for the
+// whole batch and writing each state array in bulk. Returns the number of particles spawned, which is less than n if
+// storage can't grow that far.
+int particles_spawn_n(Particles* const ps, const Vec2Array* const positions, const Vec2Array* const velocities, const int n)
+{
+    const int n_spawned = imin(n, ps->n_reserved - ps->n_active);
+    if (n_spawned <= 0 || !particles_grow(ps, ps->n_active + n_spawned))
+    {
+        return 0;
+    }
+
+    const int begin = ps->n_active;
+    Vec2Array dst_positions = vec2_array_offset(&ps->positions, begin);
+    Vec2Array dst_positions_previous = vec2_array_offset(&ps->positions_previous, begin);
+    Vec2Array dst_velocities = vec2_array_offset(&ps->velocities, begin);
+    vec2_array_copy_n(&dst_positions, positions, n_spawned);
+    vec2_array_copy_n(&dst_positions_previous, positions, n_spawned);
+    vec2_array_copy_n(&dst_velocities, velocities, n_spawned);
+    std::memset(ps->forces.x + begin, 0, sizeof(float) * n_spawned);
+    std::memset(ps->forces.y + begin, 0, sizeof(float) * n_spawned);
+    bitset_set_range(ps->alive, begin, begin + n_spawned);
+    std::memset(ps->rest_steps + begin, 0, sizeof(std::int16_t) * n_spawned);
+    if (ps->storage_mode == PARTICLE_STORAGE_INT16)
+    {
+        // Batches don't start on SIMD boundaries, so these are left to the compiler
+        for (int s = 0; s < n_spawned; ++s)
+        {
+            ps->compact_positions.x[begin + s] = particle_compact_encode(positions->x[s], PARTICLE_COMPACT_POSITION_SCALE);
+            ps->compact_positions.y[begin + s] = particle_compact_encode(positions->y[s], PARTICLE_COMPACT_POSITION_SCALE);
+            ps->compact_velocities.x[begin + s] = particle_compact_encode(velocities->x[s], PARTICLE_COMPACT_VELOCITY_SCALE);
+            ps->compact_velocities.y[begin + s] = particle_compact_encode(velocities->y[s], PARTICLE_COMPACT_VELOCITY_SCALE);
+        }
+        std::memcpy(ps->compact_positions_previous.x + begin, ps->compact_positions.x + begin, sizeof(std::int16_t) * n_spawned);
+        std::memcpy(ps->compact_positions_previous.y + begin, ps->compact_positions.y + begin, sizeof(std::int16_t) * n_spawned);
+    }
+
+    ps->n_active += n_spawned;
+    return n_spawned;
+}
+
+void particles_clear(Particles* const ps)
+{
+    bitset_clear_range(ps->alive, 0, ps->n_active);
+    ps->n_active = 0;
+}
+
+inline bool particles_is_asleep(const Particles* const ps, const int i)
+{
+    return ps->sleep_steps > 0 && ps->rest_steps[i] >= ps->sleep_steps;
+}
+
+// Returns true if sleeping is enabled and all particles in [begin, end) are asleep
+inline bool particles_are_asleep(const Particles* const ps, const int begin, const int end)
+{
+    if (ps->sleep_steps == 0)
+    {
+        return false;
+    }
+
+    for (int i = begin; i < end; ++i)
+    {
+        if (ps->rest_steps[i] < ps->sleep_steps)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void particles_wake_all(Particles* const ps)
+{
+    std::memset(ps->rest_steps, 0, sizeof(std::int16_t) * ps->n_active);
+}
+
+// Sets the steps at rest after which particles fall asleep (0 disables sleeping), and wakes all particles
+void particles_set_sleep_steps(Particles* const ps, const int sleep_steps)
+{
+    particles_wake_all(ps);
+    ps->sleep_steps = imin(imax(sleep_steps, 0), INT16_MAX);
+}
+
+int particles_count_asleep(const Particles* const ps)
+{
+    int count = 0;
+    for (int i = 0; i < ps->n_active; ++i)
+    {
+        count += particles_is_asleep(ps, i);
+    }
+    return count;
+}
+
+// Wakes sleeping particles within radius of center
+void particles_wake_near(Particles* const ps, const Vec2 center, const float radius)
+{
+    if (ps->sleep_steps == 0)
+    {
+        return;
+    }
+
+    const bool compact = (ps->storage_mode == PARTICLE_STORAGE_INT16);
+    for (int i = 0; i < ps->n_active; ++i)
+    {
+        if (!particles_is_asleep(ps, i))
+        {
+            continue;
+        }
+
+        const float x = compact ? ps->compact_positions.x[i] * PARTICLE_COMPACT_POSITION_SCALE : ps->positions.x[i];
+        const float y = compact ? ps->compact_positions.y[i] * PARTICLE_COMPACT_POSITION_SCALE : ps->positions.y[i];
+        const float dx = x - center.x;
+        const float dy = y - center.y;
+        if (dx * dx + dy * dy < radius * radius)
+        {
+            ps->rest_steps[i] = 0;
+        }
+    }
+}
+
+// Holds sleeping particles in [begin, end) at their previous positions, after integration
+void particles_hold_asleep_range(Particles* const ps, const int begin, const int end)
+{
+    if (ps->sleep_steps == 0)
+    {
+        return;
+    }
+
+    for (int i = begin; i < end; ++i)
+    {
+        if (particles_is_asleep(ps, i))
+        {
+            ps->positions.x[i] = ps->positions_previous.x[i];
+            ps->positions.y[i] = ps->positions_previous.y[i];
+            vec2_array_set_zero(&ps->velocities, i);
+        }
+    }
+}
+
+// Counts steps at rest for awake particles in [begin, end), after collisions; particles which fall asleep are stopped
+void particles_count_rest_range(Particles* const ps, const int begin, const int end)
+{
+    if (ps->sleep_steps == 0)
+    {
+        return;
+    }
+
+    const float sleep_speed_sq = PARTICLE_SLEEP_SPEED * PARTICLE_SLEEP_SPEED;
+    for (int i = begin; i < end; ++i)
+    {
+        if (particles_is_asleep(ps, i))
+        {
+            continue;
+        }
+
+        const float speed_sq = ps->velocities.x[i] * ps->velocities.x[i] + ps->velocities.y[i] * ps->velocities.y[i];
+        ps->rest_steps[i] = (speed_sq < sleep_speed_sq) ? (std::int16_t)(ps->rest_steps[i] + 1) : 0;
+        if (ps->rest_steps[i] >= ps->sleep_steps)
+        {
+            vec2_array_set_zero(&ps->velocities, i);
+        }
+    }
+}
+
+inline void particles_prune_dead(Particles* const ps)
+{
+    // Do nothing if no particles were killed
+    if (bitset_find_next_clear(ps->alive, 0, ps->n_active) == ps->n_active)
+    {
+        return;
+    }
+
+    // Shift all "alive" particles leftward in the arrays. Each kernel moves all of its arrays in the same pass over the
+    // alive bits, so this is one pass over the float components and, in int16 mode or with sleeping on, one over the
+    // int16 components (including steps at rest)
+    const int n_rest_steps = (ps->sleep_steps > 0) ? 1 : 0;
+    int n_particles_alive;
+    if (ps->storage_mode == PARTICLE_STORAGE_INT16)
+    {
+        std::int16_t* const compact_components[7] = {
+            ps->compact_positions_previous.x,
+            ps->compact_positions_previous.y,
+            ps->compact_positions.x,
+            ps->compact_positions.y,
+            ps->compact_velocities.x,
+            ps->compact_velocities.y,
+            ps->rest_steps
+        };
+        float* const components[2] = {
+            ps->forces.x,
+            ps->forces.y
+        };
+        simd_compact_i16_n(compact_components, 6 + n_rest_steps, ps->alive, ps->n_active);
+        n_particles_alive = simd_compact_n(components, 2, ps->alive, ps->n_active);
+    }
+    else
+    {
+        float* const components[8] = {
+            ps->positions_previous.x,
+            ps->positions_previous.y,
+            ps->positions.x,
+            ps->positions.y,
+            ps->velocities.x,
+            ps->velocities.y,
+            ps->forces.x,
+            ps->forces.y
+        };
+        if (n_rest_steps > 0)
+        {
+            simd_compact_i16_n(&ps->rest_steps, 1, ps->alive, ps->n_active);
+        }
+        n_particles_alive = simd_compact_n(components, 8, ps->alive, ps->n_active);
+    }
+
+    // All remaining particles are alive
+    bitset_set_range(ps->alive, 0, n_particles_alive);
+    bitset_clear_range(ps->alive, n_particles_alive, ps->n_active);
+
+    // Finally set the number of "alive" particles as the active particle count
+    ps->n_active = n_particles_alive;
+}
+
+// Collides particles [begin, end), which moved from positions_previous to positions, with environment boundaries;
+// boundary hits are added to boundary_hits
+void particles_collide_first_hit_range(
+    Particles* const ps,
+    const Environment* const env,
+    EnvironmentBoundaryProperties* const boundary_hits,
+    const int begin,
+    const int end)
+{
+    for (int i = begin; i < end; ++i)
+    {
+        if (particles_is_asleep(ps, i))
+        {
+            continue;
+        }
+
+        const Vec2 position_previous = vec2_array_get(&ps->positions_previous, i);
+        Vec2 position = vec2_array_get(&ps->positions, i);
+        Vec2 velocity = vec2_array_get(&ps->velocities, i);
+
+        // Only check boundaries in grid cells which the particle passed through, or search for them if there are too many
+        int candidates[ENVIRONMENT_GRID_QUERY_MAX];
+        const int n_candidates = environment_query_candidates(env, candidates, &position_previous, &position);
+        const int n_checks = (n_candidates < 0) ? env->n_boundaries : n_candidates;
+        const AABB step_bounds = aabb_create(position_previous, position);
+
+        for (int c = 0; c < n_checks; ++c)
+        {
+            int l = (n_candidates < 0) ? c : candidates[c];
+
+            // When searching, skip ahead to the next boundary which is crossed or near
+            if (n_candidates < 0)
+            {
+                EnvironmentBoundaryHits hits;
+                environment_search_boundary_hits(env, &position, &position_previous, &position, c, -1, false, &hits);
+                l = environment_boundary_hits_first(&hits);
+                if (l < 0)
+                {
+                    break;
+                }
+                c = l;
+            }
+
+            // Particle shot through boundary
+            Vec2 intercept_result;
+            if (environment_may_cross_boundary(env, l, &step_bounds) &&
+                vec2_segment_direction_intercept(
+                    &intercept_result,
+                    &position,
+                    &position_previous,
+                    &(env->boundaries + l)->tail,
+                    env->directions + l
+                ))
+            {
+                // Set new location to intercept point
+                vec2_set(&position, &intercept_result);
+            }
+            // Particle right above boundary
+            else if (environment_is_near_boundary(env, l, &position))
+            {
+                // Set new location as last location
+                vec2_set(&position, &position_previous);
+            }
+            else
+            {
+                continue;
+            }
+
+            // Offset to a bit above the intercept point if comming from above
+            if (vec2_above_line_with_normal(env->boundaries + l, env->normals + l, &position_previous))
+            {
+                vec2_scale_compound_add(&position, env->normals + l, 3.f * env->boundary_thickness);
+            }
+            // Offset to a bit below the intercept point if comming from below
+            else
+            {
+                vec2_scale_compound_add(&position, env->normals + l, -3.f * env->boundary_thickness);
+            }
+
+            // Reflect and dampen velocity vector
+            vec2_reflect(&velocity, &velocity, env->normals + l);
+            vec2_scale(&velocity, env->dampening);
+
+            // TODO(enhancement) count particle intersection ("hits") nearest to endpoint; for now, counting hits for both
+            // Count boundary hits when particle collide hard with boundaries
+            const float approx_energy = 0.5f * vec2_length_manhattan(&velocity);
+            (boundary_hits + l)->tail_hits += approx_energy;
+            (boundary_hits + l)->head_hits += approx_energy;
+
+            vec2_array_set(&ps->positions, i, &position);
+            vec2_array_set(&ps->velocities, i, &velocity);
+            break;
+        }
+    }
+}
+
+// Finds the boundary, other than the excluded one, which the segment start -> end crosses first. On a hit, sets the
+// fraction t along the segment and the index of the boundary which was hit. Otherwise, sets near_index to a boundary
+// which end is right above (or -1).
+inline bool particles_earliest_boundary_hit(
+    const Environment* const env,
+    const Vec2* const start,
+    const Vec2* const end,
+    const int excluded,
+    float* const t_hit,
+    int* const boundary_index,
+    int* const near_index)
+{
+    // Search the boundaries in grid cells which the segment passes through, or search for them if there are too many
+    EnvironmentBoundaryHits hits;
+    int candidates[ENVIRONMENT_GRID_QUERY_MAX];
+    const int n_candidates = environment_query_candidates(env, candidates, start, end);
+    if (n_candidates < 0)
+    {
+        environment_search_boundary_hits(env, start, end, end, 0, excluded, true, &hits);
+    }
+    else
+    {
+        environment_find_candidate_boundary_hits(env, candidates, n_candidates, start, end, end, excluded, &hits);
+    }
+
+    *t_hit = hits.t_earliest;
+    *boundary_index = hits.earliest;
+    *near_index = hits.first_near;
+    return hits.earliest >= 0;
+}
+
+// Reflects and dampens a particle velocity off boundary l, and counts the hit
+inline void particles_bounce_off_boundary(
+    Vec2* const velocity,
+    const Environment* const env,
+    EnvironmentBoundaryProperties* const boundary_hits,
+    const int l)
+{
+    vec2_reflect(velocity, velocity, env->normals + l);
+    vec2_scale(velocity, env->dampening);
+
+    const float approx_energy = 0.5f * vec2_length_manhattan(velocity);
+    (boundary_hits + l)->tail_hits += approx_energy;
+    (boundary_hits + l)->head_hits += approx_energy;
+}
+
+// Same as particles_collide_first_hit_range, but resolves boundaries in the order the particle reaches them: the
+// rest of the step after each hit is reflected and dampened like the velocity, and swept again, up to max_bounces
+// hits. A particle with hits left over stops at its last hit.
+void particles_collide_swept_range(
+    Particles* const ps,
+    const Environment* const env,
+    EnvironmentBoundaryProperties* const boundary_hits,
+    const int begin,
+    const int end)
+{
+    for (int i = begin; i < end; ++i)
+    {
+        if (particles_is_asleep(ps, i))
+        {
+            continue;
+        }
+
+        Vec2 start = vec2_array_get(&ps->positions_previous, i);
+        Vec2 position = vec2_array_get(&ps->positions, i);
+        Vec2 velocity = vec2_array_get(&ps->velocities, i);
+
+        int l_last = -1;
+        for (int n_bounces = 0; ; ++n_bounces)
+        {
+            float t;
+            int l;
+            int l_near;
+            if (!particles_earliest_boundary_hit(env, &start, &position, l_last, &t, &l, &l_near))
+            {
+                // Particle ended right above a boundary: go back to the start of the sweep
+                if (l_near >= 0)
+                {
+                    vec2_set(&position, &start);
+                    particles_bounce_off_boundary(&velocity, env, boundary_hits, l_near);
+                }
+                break;
+            }
+
+            // Out of bounces: stop at the last hit
+            if (n_bounces == ps->max_bounces)
+            {
+                vec2_set(&position, &start);
+                break;
+            }
+
+            // Back off from the intercept point along the path, to up to a bit away from the boundary. Unlike an offset
+            // along the normal, this stays on the part of the path which was just swept, so it can't cross a
+            // neighbouring boundary in a corner.
+            const Vec2 delta{position.x - start.x, position.y - start.y};
+            const Vec2 intercept{start.x + t * delta.x, start.y + t * delta.y};
+            const float t_back = std::fmax(0.f, t - 3.f * env->boundary_thickness / std::abs(vec2_dot(&delta, env->normals + l)));
+            start = Vec2{start.x + t_back * delta.x, start.y + t_back * delta.y};
+
+            // Reflect and dampen the rest of the step, like the velocity
+            Vec2 remaining{position.x - intercept.x, position.y - intercept.y};
+            vec2_reflect(&remaining, &remaining, env->normals + l);
+            vec2_scale(&remaining, env->dampening);
+            position = Vec2{start.x + remaining.x, start.y + remaining.y};
+
+            particles_bounce_off_boundary(&velocity, env, boundary_hits, l);
+            l_last = l;
+        }
+
+        vec2_array_set(&ps->positions, i, &position);
+        vec2_array_set(&ps->velocities, i, &velocity);
+    }
+}
+
+// Collides particles [begin, end) with environment boundaries, using the particles' collision mode
+inline void particles_collide_range(
+    Particles* const ps,
+    const Environment* const env,
+    EnvironmentBoundaryProperties* const boundary_hits,
+    const int begin,
+    const int end)
+{
+    if (ps->collision_mode == PARTICLE_COLLISIONS_SWEPT)
+    {
+        particles_collide_swept_range(ps, env, boundary_hits, begin, end);
+    }
+    else
+    {
+        particles_collide_first_hit_range(ps, env, boundary_hits, begin, end);
+    }
+}
+
+// Updates particles [begin, end), where begin is a multiple of the SIMD padding; boundary hits are added to boundary_hits
+void particles_update_range(
+    Particles* const ps,
+    const Environment* const env,
+    EnvironmentBoundaryProperties* const boundary_hits,
+    const int begin,
+    const int end,
+    const float dt)
+{
+    Vec2Array positions_previous = vec2_array_offset(&ps->positions_previous, begin);
+    Vec2Array positions = vec2_array_offset(&ps->positions, begin);
+    Vec2Array velocities = vec2_array_offset(&ps->velocities, begin);
+    Vec2Array forces = vec2_array_offset(&ps->forces, begin);
+    const int n_padded = simd_padded_count(end - begin);
+
+    // Cache previous states
+    vec2_array_copy_n(&positions_previous, &positions, end - begin);
+
+    // Update point states BEFORE collision resolution to figure out
+    // where points will be next as if they hadn't collided
+    integrate_states_fixed_step(&positions, &velocities, &forces, end - begin, dt);
+    particles_hold_asleep_range(ps, begin, end);
+
+    // Collide points and environment lines
+    particles_collide_range(ps, env, boundary_hits, begin, end);
+
+    // Apply hard limits on velocities
+    simd_clamp_n(velocities.x, -(ps->max_velocity), ps->max_velocity, n_padded);
+    simd_clamp_n(velocities.y, -(ps->max_velocity), ps->max_velocity, n_padded);
+
+    // Apply hard screen limits on position
+    simd_clamp_n(positions.x, -BOUNDARY_LIMIT, +BOUNDARY_LIMIT, n_padded);
+    simd_clamp_n(positions.y, -BOUNDARY_LIMIT, +BOUNDARY_LIMIT, n_padded);
+
+    particles_count_rest_range(ps, begin, end);
+
+    // Reset forces to gravity
+    simd_fill_n(forces.x, env->gravity.x, n_padded);
+    simd_fill_n(forces.y, env->gravity.y, n_padded);
+}
+
+struct ParticlesUpdateTask
+{
+    Particles* ps;
+    const Environment* env;
+    WorkerAccumulators* acc;
+    float dt;
+};
+
+void particles_update_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    const ParticlesUpdateTask* const task = (const ParticlesUpdateTask*)context;
+    EnvironmentBoundaryProperties* const boundary_hits = task->acc->boundary_properties[thread_index];
+    particles_update_range(task->ps, task->env, boundary_hits, begin, end, task->dt);
+}
+
+void particles_update(Particles* const ps, const Environment* const env, ThreadPool* const pool, WorkerAccumulators* const acc, const float dt)
+{
+    worker_accumulators_grow_boundaries(acc, env->n_max);
+    ParticlesUpdateTask task{ps, env, acc, dt};
+    thread_pool_run(pool, particles_update_task, &task, ps->n_active, PARTICLE_CHUNK_SIZE);
+    worker_accumulators_reduce_boundary_hits(acc, env);
+}
+
+// Stops particles whose given positions are in the goal region; particles which were still moving are marked for
+// removal and counted
+void particles_capture_in_goal_range(
+    Particles* const ps,
+    const Environment* const env,
+    const Vec2Array* const positions,
+    int* const captured,
+    const int begin,
+    const int end)
+{
+    for (int i = begin; i < end; ++i)
+    {
+        // Stop these particles here
+        const Vec2 position = vec2_array_get(positions, i);
+        if (aabb_within(&env->goal, &position))
+        {
+            Vec2 velocity = vec2_array_get(&ps->velocities, i);
+            if (vec2_length_squared(&velocity) > 0.f)
+            {
+                ++(*captured);
+
+                // Remove particle next iteration
+                bitset_clear(ps->alive, i);
+            }
+            vec2_array_set_zero(&ps->forces, i);
+            vec2_array_set_zero(&ps->velocities, i);
+        }
+    }
+}
+
+struct ParticlesCaptureInGoalTask
+{
+    Particles* ps;
+    const Environment* env;
+    WorkerAccumulators* acc;
+};
+
+void particles_capture_in_goal_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    const ParticlesCaptureInGoalTask* const task = (const ParticlesCaptureInGoalTask*)context;
+    particles_capture_in_goal_range(task->ps, task->env, &task->ps->positions, task->acc->captured + thread_index * WORKER_COUNTER_STRIDE, begin, end);
+}
+
+// Returns the number of particles newly captured in the goal region
+int particles_capture_in_goal(Particles* const ps, const Environment* const env, ThreadPool* const pool, WorkerAccumulators* const acc)
+{
+    worker_accumulators_reset_counters(acc);
+
+    ParticlesCaptureInGoalTask task{ps, env, acc};
+    thread_pool_run(pool, particles_capture_in_goal_task, &task, ps->n_active, PARTICLE_CHUNK_SIZE);
+    return worker_accumulators_reduce_captured(acc);
+}
+
+struct ParticlesCountInZonesTask
+{
+    const Particles* ps;
+    ZoneHistogram* zones;
+};
+
+void particles_count_in_zones_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    const ParticlesCountInZonesTask* const task = (const ParticlesCountInZonesTask*)context;
+    zone_histogram_count_range(task->zones, zone_histogram_thread_counts(task->zones, thread_index), &task->ps->positions, begin, end);
+}
+
+// Counts particles in each zone of zones
+void particles_count_in_zones(const Particles* const ps, ThreadPool* const pool, ZoneHistogram* const zones)
+{
+    zone_histogram_reset_threads(zones);
+
+    ParticlesCountInZonesTask task{ps, zones};
+    thread_pool_run(pool, particles_count_in_zones_task, &task, ps->n_active, PARTICLE_CHUNK_SIZE);
+    zone_histogram_merge(zones);
+}
+
+// Particles per tile of the fused particle step; every phase runs over a whole tile before the next one starts, so
+// that the tile stays in L1 between phases (a multiple of the SIMD padding and of the alive bitset word size)
+static const int PARTICLE_STEP_TILE_SIZE = 256;
+
+// Float scratch for one tile of particles in compact storage. view is a float storage view of the tile, indexed from
+// 0, with states in scratch, and forces, alive flags and rest steps shared with the particles (see
+// particle_compact_tile_view).
+struct ParticleCompactTile
+{
+    alignas(SIMD_ALIGNMENT_BYTES) float positions_previous[2][PARTICLE_STEP_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT_BYTES) float positions[2][PARTICLE_STEP_TILE_SIZE];
+    alignas(SIMD_ALIGNMENT_BYTES) float velocities[2][PARTICLE_STEP_TILE_SIZE];
+    Particles view;
+};
+
+// Sets up tile for particles [tile_begin, tile_begin + PARTICLE_STEP_TILE_SIZE); tile_begin must be a multiple of the
+// tile size. States are decoded into the scratch by the caller.
+inline void particle_compact_tile_view(ParticleCompactTile* const tile, const Particles* const ps, const int tile_begin)
+{
+    tile->view = *ps;
+    tile->view.storage_mode = PARTICLE_STORAGE_FLOAT;
+    tile->view.positions_previous = Vec2Array{tile->positions_previous[0], tile->positions_previous[1]};
+    tile->view.positions = Vec2Array{tile->positions[0], tile->positions[1]};
+    tile->view.velocities = Vec2Array{tile->velocities[0], tile->velocities[1]};
+    tile->view.forces = vec2_array_offset(&ps->forces, tile_begin);
+    tile->view.alive = ps->alive + tile_begin / BITSET_WORD_BITS;
+    tile->view.rest_steps = ps->rest_steps + tile_begin;
+    tile->view.n_active = imin(PARTICLE_STEP_TILE_SIZE, ps->n_active - tile_begin);
+}
+
+// Fused tick of particles [begin, end), with positions_previous holding current positions (see particles_step):
+// captures particles in the goal, integrates into positions (holding sleeping particles), collides with the
+// environment, clamps, counts steps at rest, counts particles in zones and resets forces to gravity. Equivalent to
+// particles_capture_in_goal, particles_update and particles_count_in_zones run one after the other.
+void particles_step_range(
+    Particles* const ps,
+    const Environment* const env,
+    EnvironmentBoundaryProperties* const boundary_hits,
+    int* const captured,
+    const ZoneHistogram* const zones,
+    unsigned* const zone_counts,
+    const int begin,
+    const int end,
+    const float dt)
+{
+    for (int tile_begin = begin; tile_begin < end; tile_begin += PARTICLE_STEP_TILE_SIZE)
+    {
+        const int tile_end = imin(tile_begin + PARTICLE_STEP_TILE_SIZE, end);
+        const int n_padded = simd_padded_count(tile_end - tile_begin);
+        Vec2Array positions_previous = vec2_array_offset(&ps->positions_previous, tile_begin);
+        Vec2Array positions = vec2_array_offset(&ps->positions, tile_begin);
+        Vec2Array velocities = vec2_array_offset(&ps->velocities, tile_begin);
+        Vec2Array forces = vec2_array_offset(&ps->forces, tile_begin);
+
+        // Stop particles which are in the goal region before this step
+        particles_capture_in_goal_range(ps, env, &ps->positions_previous, captured, tile_begin, tile_end);
+
+        // Integrate from the current positions; positions held stale values up to here
+        simd_integrate_from_n(positions.x, positions_previous.x, velocities.x, forces.x, dt, n_padded);
+        simd_integrate_from_n(positions.y, positions_previous.y, velocities.y, forces.y, dt, n_padded);
+        particles_hold_asleep_range(ps, tile_begin, tile_end);
+
+        particles_collide_range(ps, env, boundary_hits, tile_begin, tile_end);
+
+        simd_clamp_n(velocities.x, -(ps->max_velocity), ps->max_velocity, n_padded);
+        simd_clamp_n(velocities.y, -(ps->max_velocity), ps->max_velocity, n_padded);
+        simd_clamp_n(positions.x, -BOUNDARY_LIMIT, +BOUNDARY_LIMIT, n_padded);
+        simd_clamp_n(positions.y, -BOUNDARY_LIMIT, +BOUNDARY_LIMIT, n_padded);
+        particles_count_rest_range(ps, tile_begin, tile_end);
+
+        zone_histogram_count_range(zones, zone_counts, &ps->positions, tile_begin, tile_end);
+
+        simd_fill_n(forces.x, env->gravity.x, n_padded);
+        simd_fill_n(forces.y, env->gravity.y, n_padded);
+    }
+}
+
+// Same as particles_step_range, on particles in compact storage, with compact_positions_previous holding current
+// positions: each tile is decoded into float scratch, stepped there, and encoded into compact_positions
+void particles_step_compact_range(
+    Particles* const ps,
+    const Environment* const env,
+    EnvironmentBoundaryProperties* const boundary_hits,
+    int* const captured,
+    const ZoneHistogram* const zones,
+    unsigned* const zone_counts,
+    const int begin,
+    const int end,
+    const float dt)
+{
+    ParticleCompactTile tile;
+    for (int tile_begin = begin; tile_begin < end; tile_begin += PARTICLE_STEP_TILE_SIZE)
+    {
+        const int n = imin(PARTICLE_STEP_TILE_SIZE, end - tile_begin);
+        const int n_padded = simd_padded_count(n);
+        particle_compact_tile_view(&tile, ps, tile_begin);
+        Particles* const view = &tile.view;
+
+        simd_decode_i16_n(view->positions_previous.x, ps->compact_positions_previous.x + tile_begin, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+        simd_decode_i16_n(view->positions_previous.y, ps->compact_positions_previous.y + tile_begin, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+        simd_decode_i16_n(view->velocities.x, ps->compact_velocities.x + tile_begin, PARTICLE_COMPACT_VELOCITY_SCALE, n_padded);
+        simd_decode_i16_n(view->velocities.y, ps->compact_velocities.y + tile_begin, PARTICLE_COMPACT_VELOCITY_SCALE, n_padded);
+
+        particles_step_range(view, env, boundary_hits, captured, zones, zone_counts, 0, n, dt);
+
+        simd_encode_i16_n(ps->compact_positions.x + tile_begin, view->positions.x, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+        simd_encode_i16_n(ps->compact_positions.y + tile_begin, view->positions.y, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+        simd_encode_i16_n(ps->compact_velocities.x + tile_begin, view->velocities.x, PARTICLE_COMPACT_VELOCITY_SCALE, n_padded);
+        simd_encode_i16_n(ps->compact_velocities.y + tile_begin, view->velocities.y, PARTICLE_COMPACT_VELOCITY_SCALE, n_padded);
+    }
+}
+
+struct ParticlesStepTask
+{
+    Particles* ps;
+    const Environment* env;
+    WorkerAccumulators* acc;
+    ZoneHistogram* zones;
+    float dt;
+};
+
+void particles_step_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    const ParticlesStepTask* const task = (const ParticlesStepTask*)context;
+    WorkerAccumulators* const acc = task->acc;
+    const bool compact = (task->ps->storage_mode == PARTICLE_STORAGE_INT16);
+    (compact ? particles_step_compact_range : particles_step_range)(
+        task->ps,
+        task->env,
+        acc->boundary_properties[thread_index],
+        acc->captured + thread_index * WORKER_COUNTER_STRIDE,
+        task->zones,
+        zone_histogram_thread_counts(task->zones, thread_index),
+        begin,
+        end,
+        task->dt
+    );
+}
+
+// Runs all per-particle phases of a tick which follow planet gravity in a single pass over the particle arrays (see
+// particles_step_range). Counts particles in each zone of zones, and returns the number of particles newly captured in
+// the goal region.
+int particles_step(Particles* const ps, const Environment* const env, ThreadPool* const pool, WorkerAccumulators* const acc, ZoneHistogram* const zones, const float dt)
+{
+    // Current positions become the previous ones without copying; the old previous positions are overwritten
+    if (ps->storage_mode == PARTICLE_STORAGE_INT16)
+    {
+        const Vec2ArrayI16 positions_previous = ps->compact_positions_previous;
+        ps->compact_positions_previous = ps->compact_positions;
+        ps->compact_positions = positions_previous;
+    }
+    else
+    {
+        const Vec2Array positions_previous = ps->positions_previous;
+        ps->positions_previous = ps->positions;
+        ps->positions = positions_previous;
+    }
+
+    worker_accumulators_grow_boundaries(acc, env->n_max);
+    worker_accumulators_reset_counters(acc);
+    zone_histogram_reset_threads(zones);
+
+    ParticlesStepTask task{ps, env, acc, zones, dt};
+    thread_pool_run(pool, particles_step_task, &task, ps->n_active, PARTICLE_CHUNK_SIZE);
+
+    worker_accumulators_reduce_boundary_hits(acc, env);
+    zone_histogram_merge(zones);
+    return worker_accumulators_reduce_captured(acc);
+}
+
+// Gathers src[sorted_indices[s]] into dst[s], for s in [0, n)
+inline void particle_contact_grid_gather(float* const dst, const float* const src, const int* const sorted_indices, const int n)
+{
+    for (int s = 0; s < n; ++s)
+    {
+        dst[s] = src[sorted_indices[s]];
+    }
+}
+
+inline void particle_contact_grid_gather_swap(Vec2Array* const particle_array, Vec2Array* const scratch, const int* const sorted_indices, const int n)
+{
+    particle_contact_grid_gather(scratch->x, particle_array->x, sorted_indices, n);
+    particle_contact_grid_gather(scratch->y, particle_array->y, sorted_indices, n);
+    const Vec2Array sorted = *scratch;
+    *scratch = *particle_array;
+    *particle_array = sorted;
+}
+
+// Counting-sorts particles (all of their state) by contact grid cell, with temporaries in scratch
+void particles_sort_by_contact_cell(Particles* const ps, MemoryArena* const scratch)
+{
+    ParticleContactGrid* const grid = &ps->contact_grid;
+    const int n = ps->n_active;
+
+    const std::size_t scratch_mark = memory_arena_mark(scratch);
+    int* const unsorted_cells = (int*)memory_arena_push(scratch, sizeof(int) * n);
+    int* const sorted_indices = (int*)memory_arena_push(scratch, sizeof(int) * n);
+
+    // Count particles per cell, offset by one cell so that the prefix sum yields cell starts
+    std::memset(grid->cell_starts, 0, sizeof(int) * (PARTICLE_CONTACT_CELLS + 1));
+    const float scale = 0.5f * PARTICLE_CONTACT_CELLS_PER_SIDE;
+    const float cell_max = (float)(PARTICLE_CONTACT_CELLS_PER_SIDE - 1);
+    for (int i = 0; i < n; ++i)
+    {
+        float x = (ps->positions.x[i] + 1.f) * scale;
+        float y = (ps->positions.y[i] + 1.f) * scale;
+        x = (x > 0.f) ? ((x < cell_max) ? x : cell_max) : 0.f;
+        y = (y > 0.f) ? ((y < cell_max) ? y : cell_max) : 0.f;
+        const int cell = (int)y * PARTICLE_CONTACT_CELLS_PER_SIDE + (int)x;
+        unsorted_cells[i] = cell;
+        ++grid->cell_starts[cell + 1];
+    }
+    for (int c = 0; c < PARTICLE_CONTACT_CELLS; ++c)
+    {
+        grid->cell_starts[c + 1] += grid->cell_starts[c];
+    }
+
+    // Place particles, using the start of each cell as its insertion cursor; afterwards, each start is the start of
+    // the next cell, so starts are shifted back by one
+    const int n_alive_words = bitset_word_count(simd_padded_count(n));
+    std::memset(grid->alive, 0, sizeof(std::uint64_t) * n_alive_words);
+    for (int i = 0; i < n; ++i)
+    {
+        const int cell = unsorted_cells[i];
+        const int s = grid->cell_starts[cell]++;
+        sorted_indices[s] = i;
+        grid->particle_cells[s] = cell;
+        if (bitset_get(ps->alive, i))
+        {
+            bitset_set(grid->alive, s);
+        }
+    }
+    std::memmove(grid->cell_starts + 1, grid->cell_starts, sizeof(int) * PARTICLE_CONTACT_CELLS);
+    grid->cell_starts[0] = 0;
+
+    std::uint64_t* const alive = grid->alive;
+    grid->alive = ps->alive;
+    ps->alive = alive;
+
+    particle_contact_grid_gather_swap(&ps->positions_previous, &grid->positions_previous, sorted_indices, n);
+    particle_contact_grid_gather_swap(&ps->positions, &grid->positions, sorted_indices, n);
+    particle_contact_grid_gather_swap(&ps->velocities, &grid->velocities, sorted_indices, n);
+    particle_contact_grid_gather_swap(&ps->forces, &grid->forces, sorted_indices, n);
+
+    if (ps->sleep_steps > 0)
+    {
+        std::int16_t* const rest_steps = (std::int16_t*)memory_arena_push(scratch, sizeof(std::int16_t) * n);
+        for (int s = 0; s < n; ++s)
+        {
+            rest_steps[s] = ps->rest_steps[sorted_indices[s]];
+        }
+        std::memcpy(ps->rest_steps, rest_steps, sizeof(std::int16_t) * n);
+    }
+
+    memory_arena_pop_to(scratch, scratch_mark);
+}
+
+// Adds the force on particle i from particle j (which may be i itself, adding nothing) if they are in contact, given
+// their relative position and velocity (i minus j). Coincident particles are pushed apart along x, in opposite
+// directions depending on their order.
+inline void particle_contact_force(
+    Vec2* const force,
+    const float dx,
+    const float dy,
+    const float dvx,
+    const float dvy,
+    const int i,
+    const int j,
+    const float stiffness)
+{
+    const float distance_sq = dx * dx + dy * dy;
+    if (distance_sq >= PARTICLE_CONTACT_DIAMETER_SQ || i == j)
+    {
+        return;
+    }
+
+    const bool coincident = !(distance_sq > 0.f);
+    const float inv_distance = 1.f / std::sqrt(coincident ? 1.f : distance_sq);
+    const float distance = distance_sq * inv_distance;
+    const float nx = coincident ? ((i < j) ? -1.f : 1.f) : (dx * inv_distance);
+    const float ny = coincident ? 0.f : (dy * inv_distance);
+
+    // Spring on overlap, damped along the normal; contacts only ever push
+    const float normal_velocity = dvx * nx + dvy * ny;
+    const float magnitude = stiffness * (PARTICLE_CONTACT_DIAMETER - distance) - PARTICLE_CONTACT_DAMPING * normal_velocity;
+    const float applied = (magnitude > 0.f) ? magnitude : 0.f;
+    force->x += applied * nx;
+    force->y += applied * ny;
+}
+
+// Returns true if any sorted particle in [row_begins[r], row_ends[r]), for any of n_rows rows, other than i itself, is
+// in contact with particle i and moving faster than PARTICLE_SLEEP_SPEED
+inline bool particle_contact_any_moving(const Particles* const ps, const int* const row_begins, const int* const row_ends, const int n_rows, const int i)
+{
+    const float sleep_speed_sq = PARTICLE_SLEEP_SPEED * PARTICLE_SLEEP_SPEED;
+    for (int r = 0; r < n_rows; ++r)
+    {
+        for (int j = row_begins[r]; j < row_ends[r]; ++j)
+        {
+            const float dx = ps->positions.x[i] - ps->positions.x[j];
+            const float dy = ps->positions.y[i] - ps->positions.y[j];
+            const float speed_sq = ps->velocities.x[j] * ps->velocities.x[j] + ps->velocities.y[j] * ps->velocities.y[j];
+            if (j != i && dx * dx + dy * dy < PARTICLE_CONTACT_DIAMETER_SQ && speed_sq > sleep_speed_sq)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Adds contact forces to particles [begin, end), which must be sorted by contact cell. Each pair is evaluated from
+// both sides, so threads never write to the same particle. Neighbours are tested SIMD_F32_WIDTH at a time, with lanes
+// past the end of a row masked out (see PARTICLE_CONTACT_READ_PADDING); the math matches particle_contact_force.
+// Sleeping particles get no contact forces, and are woken by moving particles in contact with them.
+void particles_apply_contacts_range(Particles* const ps, const int begin, const int end)
+{
+    const ParticleContactGrid* const grid = &ps->contact_grid;
+    const float* const xs = ps->positions.x;
+    const float* const ys = ps->positions.y;
+    const float* const vxs = ps->velocities.x;
+    const float* const vys = ps->velocities.y;
+
+    const simd_f32 zero = simd_f32_set1(0.f);
+    const simd_f32 one = simd_f32_set1(1.f);
+    const simd_f32 diameter = simd_f32_set1(PARTICLE_CONTACT_DIAMETER);
+    const simd_f32 diameter_sq = simd_f32_set1(PARTICLE_CONTACT_DIAMETER_SQ);
+    const simd_f32 damping = simd_f32_set1(PARTICLE_CONTACT_DAMPING);
+    const simd_f32 stiffness = simd_f32_set1(ps->contact_stiffness);
+    const simd_f32 lanes = simd_f32_lane_indices();
+
+    // Sorted particles [row_begins[r], row_ends[r]) are in the three neighbouring cells in row r around the current
+    // cell; particles are sorted by cell, so these only change once per cell
+    int current_cell = -1;
+    int row_begins[3];
+    int row_ends[3];
+    int n_rows = 0;
+
+    for (int i = begin; i < end; ++i)
+    {
+        const int cell = grid->particle_cells[i];
+        if (cell != current_cell)
+        {
+            const int cell_x = cell % PARTICLE_CONTACT_CELLS_PER_SIDE;
+            const int cell_y = cell / PARTICLE_CONTACT_CELLS_PER_SIDE;
+            const int first_column = imax(cell_x - 1, 0);
+            const int last_column = imin(cell_x + 1, PARTICLE_CONTACT_CELLS_PER_SIDE - 1);
+            n_rows = 0;
+            for (int row = imax(cell_y - 1, 0); row <= imin(cell_y + 1, PARTICLE_CONTACT_CELLS_PER_SIDE - 1); ++row)
+            {
+                row_begins[n_rows] = grid->cell_starts[row * PARTICLE_CONTACT_CELLS_PER_SIDE + first_column];
+                row_ends[n_rows] = grid->cell_starts[row * PARTICLE_CONTACT_CELLS_PER_SIDE + last_column + 1];
+                ++n_rows;
+            }
+            current_cell = cell;
+        }
+
+        // Sleeping particles are held in place, so they only need to know whether to wake
+        if (particles_is_asleep(ps, i))
+        {
+            if (!particle_contact_any_moving(ps, row_begins, row_ends, n_rows, i))
+            {
+                continue;
+            }
+            ps->rest_steps[i] = 0;
+        }
+
+        const simd_f32 x = simd_f32_set1(xs[i]);
+        const simd_f32 y = simd_f32_set1(ys[i]);
+        const simd_f32 vx = simd_f32_set1(vxs[i]);
+        const simd_f32 vy = simd_f32_set1(vys[i]);
+        const simd_f32 index = simd_f32_set1((float)i);
+
+        simd_f32 force_x = zero;
+        simd_f32 force_y = zero;
+        for (int r = 0; r < n_rows; ++r)
+        {
+            const simd_f32 row_end = simd_f32_set1((float)row_ends[r]);
+            for (int j = row_begins[r]; j < row_ends[r]; j += SIMD_F32_WIDTH)
+            {
+                const simd_f32 dx = simd_f32_sub(x, simd_f32_loadu(xs + j));
+                const simd_f32 dy = simd_f32_sub(y, simd_f32_loadu(ys + j));
+                const simd_f32 distance_sq = simd_f32_mul_add(dx, dx, simd_f32_mul(dy, dy));
+
+                // Neighbours in the row, other than i itself, within one diameter
+                const simd_f32 neighbour = simd_f32_add(simd_f32_set1((float)j), lanes);
+                const simd_mask before = simd_f32_lt(neighbour, index);
+                const simd_mask after = simd_f32_lt(index, neighbour);
+                const simd_mask in_row = simd_mask_and(simd_f32_lt(neighbour, row_end), simd_mask_or(before, after));
+                const simd_mask touching = simd_mask_and(in_row, simd_f32_lt(distance_sq, diameter_sq));
+                if (!simd_mask_any(touching))
+                {
+                    continue;
+                }
+
+                const simd_mask separated = simd_f32_lt(zero, distance_sq);
+                const simd_f32 inv_distance = simd_f32_div(one, simd_f32_sqrt(simd_f32_select(separated, distance_sq, one)));
+                const simd_f32 distance = simd_f32_mul(distance_sq, inv_distance);
+                const simd_f32 nx = simd_f32_select(separated, simd_f32_mul(dx, inv_distance), simd_f32_select(after, simd_f32_set1(-1.f), one));
+                const simd_f32 ny = simd_f32_select(separated, simd_f32_mul(dy, inv_distance), zero);
+
+                const simd_f32 dvx = simd_f32_sub(vx, simd_f32_loadu(vxs + j));
+                const simd_f32 dvy = simd_f32_sub(vy, simd_f32_loadu(vys + j));
+                const simd_f32 normal_velocity = simd_f32_mul_add(dvx, nx, simd_f32_mul(dvy, ny));
+                const simd_f32 magnitude = simd_f32_sub(simd_f32_mul(stiffness, simd_f32_sub(diameter, distance)), simd_f32_mul(damping, normal_velocity));
+                const simd_f32 applied = simd_f32_select(simd_mask_and(touching, simd_f32_lt(zero, magnitude)), magnitude, zero);
+                force_x = simd_f32_mul_add(applied, nx, force_x);
+                force_y = simd_f32_mul_add(applied, ny, force_y);
+            }
+        }
+
+        ps->forces.x[i] += simd_f32_reduce_add(force_x);
+        ps->forces.y[i] += simd_f32_reduce_add(force_y);
+    }
+}
+
+void particles_apply_contacts_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    particles_apply_contacts_range((Particles*)context, begin, end);
+}
+
+// Adds contact forces between overlapping particles, if enabled
+void particles_apply_contacts(Particles* const ps, ThreadPool* const pool, MemoryArena* const scratch)
+{
+    if (ps->contact_mode == PARTICLE_CONTACTS_NONE)
+    {
+        return;
+    }
+
+    // Contacts work on float states, which the sort then reorders
+    const bool compact = (ps->storage_mode == PARTICLE_STORAGE_INT16);
+    if (compact)
+    {
+        particles_decode_states(ps);
+    }
+
+    particles_sort_by_contact_cell(ps, scratch);
+    thread_pool_run(pool, particles_apply_contacts_task, ps, ps->n_active, PARTICLE_CHUNK_SIZE);
+
+    if (compact)
+    {
+        particles_encode_states(ps);
+    }
+}
+
+// Reference for particles_apply_contacts, which checks every pair of particles
+void particles_apply_contacts_brute_force(Particles* const ps)
+{
+    for (int i = 0; i < ps->n_active; ++i)
+    {
+        Vec2 force{0.f, 0.f};
+        for (int j = 0; j < ps->n_active; ++j)
+        {
+            particle_contact_force(
+                &force,
+                ps->positions.x[i] - ps->positions.x[j],
+                ps->positions.y[i] - ps->positions.y[j],
+                ps->velocities.x[i] - ps->velocities.x[j],
+                ps->velocities.y[i] - ps->velocities.y[j],
+                i,
+                j,
+                ps->contact_stiffness
+            );
+        }
+        ps->forces.x[i] += force.x;
+        ps->forces.y[i] += force.y;
+    }
+}
+
+// Writes positions at fraction alpha of the way from the previous to the current tick into dst
+void particles_interpolate_positions(const Particles* const ps, Vec2Array* const dst, const float alpha)
+{
+    const int n_padded = simd_padded_count(ps->n_active);
+    simd_lerp_n(dst->x, ps->positions_previous.x, ps->positions.x, alpha, n_padded);
+    simd_lerp_n(dst->y, ps->positions_previous.y, ps->positions.y, alpha, n_padded);
+}
+
+// Same as particles_interpolate_positions, for compact storage; dst has the scale of compact positions
+void particles_interpolate_compact_positions(const Particles* const ps, Vec2ArrayI16* const dst, const float alpha)
+{
+    const int n_padded = simd_padded_count(ps->n_active);
+    simd_lerp_i16_n(dst->x, ps->compact_positions_previous.x, ps->compact_positions.x, alpha, n_padded);
+    simd_lerp_i16_n(dst->y, ps->compact_positions_previous.y, ps->compact_positions.y, alpha, n_padded);
+}
+
+void particles_destroy(Particles* const ps)
+{
+    // Contact grid arrays are in the arena too
+    memory_arena_destroy(&ps->arena);
+}
+
+// Most emitters in a ParticleEmitters
+static const int N_PARTICLE_EMITTERS_MAX = 64;
+
+// Spawns particles at a steady rate, in one batch per tick (see particle_emitters_update)
+struct ParticleEmitter
+{
+    Vec2 position;
+    Vec2 velocity;   // Initial velocity of emitted particles
+    float rate;      // Particles per second; 0 pauses the emitter
+    float spread;    // Radius of the disk around position which particles are emitted in
+    float n_pending; // Fraction of a particle carried over to the next tick
+    std::uint32_t random_state;
+};
+
+struct ParticleEmitters
+{
+    ParticleEmitter emitters[N_PARTICLE_EMITTERS_MAX];
+    int n_active;
+};
+
+void particle_emitters_initialize(ParticleEmitters* const emitters)
+{
+    emitters->n_active = 0;
+}
+
+// Returns the index of the new emitter, or -1 if there are already N_PARTICLE_EMITTERS_MAX
+int particle_emitters_add(ParticleEmitters* const emitters, const Vec2 position, const Vec2 velocity, const float rate, const float spread)
+{
+    if (emitters->n_active == N_PARTICLE_EMITTERS_MAX)
+    {
+        return -1;
+    }
+
+    ParticleEmitter* const emitter = emitters->emitters + emitters->n_active;
+    emitter->position = position;
+    emitter->velocity = velocity;
+    emitter->rate = rate;
+    emitter->spread = spread;
+    emitter->n_pending = 0.f;
+    emitter->random_state = 0x9E3779B9u * (std::uint32_t)(emitters->n_active + 1);
+    return emitters->n_active++;
+}
+
+void particle_emitters_clear(ParticleEmitters* const emitters)
+{
+    emitters->n_active = 0;
+}
+
+// Uniform in [0, 1), from a xorshift generator private to the emitter
+inline float particle_emitter_random(ParticleEmitter* const emitter)
+{
+    std::uint32_t x = emitter->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    emitter->random_state = x;
+    return (float)(x >> 8) * (1.f / 16777216.f);
+}
+
+// Spawns the particles due from each emitter over dt with particles_spawn_n, with their states generated in scratch.
+// Returns the number of particles spawned.
+int particle_emitters_update(ParticleEmitters* const emitters, Particles* const ps, MemoryArena* const scratch, const float dt)
+{
+    int n_spawned = 0;
+    for (int e = 0; e < emitters->n_active; ++e)
+    {
+        ParticleEmitter* const emitter = emitters->emitters + e;
+        emitter->n_pending += emitter->rate * dt;
+        if (emitter->n_pending < 1.f)
+        {
+            continue;
+        }
+
+        // Particles which don't fit in the pool are dropped, rather than generated and then discarded by
+        // particles_spawn_n (clamped as a float, since n_pending can be past the int range)
+        const int n = (int)std::fmin(emitter->n_pending, (float)(ps->n_reserved - ps->n_active));
+        const std::size_t scratch_mark = memory_arena_mark(scratch);
+        const Vec2Array positions{(float*)memory_arena_push(scratch, sizeof(float) * n), (float*)memory_arena_push(scratch, sizeof(float) * n)};
+        const Vec2Array velocities{(float*)memory_arena_push(scratch, sizeof(float) * n), (float*)memory_arena_push(scratch, sizeof(float) * n)};
+        if (positions.x == nullptr || positions.y == nullptr || velocities.x == nullptr || velocities.y == nullptr)
+        {
+            // Out of scratch; these are still pending next tick
+            memory_arena_pop_to(scratch, scratch_mark);
+            continue;
+        }
+        emitter->n_pending -= std::floor(emitter->n_pending);
+
+        for (int s = 0; s < n; ++s)
+        {
+            // Uniform over the disk
+            const float angle = 6.2831853f * particle_emitter_random(emitter);
+            const float radius = emitter->spread * std::sqrt(particle_emitter_random(emitter));
+            positions.x[s] = emitter->position.x + radius * std::cos(angle);
+            positions.y[s] = emitter->position.y + radius * std::sin(angle);
+        }
+        for (int s = 0; s < n; ++s)
+        {
+            velocities.x[s] = emitter->velocity.x;
+            velocities.y[s] = emitter->velocity.y;
+        }
+        n_spawned += particles_spawn_n(ps, &positions, &velocities, n);
+        memory_arena_pop_to(scratch, scratch_mark);
+    }
+    return n_spawned;
+}
+
+// TODO(debug) make this tunable?
+static const float PLANET_SURFACE_RADIUS = 0.02f;
+static const float PLANET_SURFACE_RADIUS_SQ = PLANET_SURFACE_RADIUS * PLANET_SURFACE_RADIUS;
+
+// TODO(enhancement) make tunable?
+static const float PARTICLE_MASS_GAINED = 5e-3f;
+
+// Max planets in a planet tree leaf, and max tree depth (which bounds leaves of coincident planets)
+static const int PLANET_TREE_LEAF_SIZE = 8;
+static const int PLANET_TREE_DEPTH_MAX = 24;
+static const int PLANET_TREE_STACK_SIZE = 3 * PLANET_TREE_DEPTH_MAX + 1;
+
+// Cells per side of the cached planet force field, which covers the whole [-1, 1] play area
+static const int PLANET_FIELD_CELLS_PER_SIDE = 128;
+
+// Planets are summed exactly in cells this close (in cells) to their surface, since the field is too steep there
+static const float PLANET_FIELD_NEAR_RADIUS_CELLS = 2.f;
+
+// Number of field nodes evaluated per thread pool chunk on rebuild
+static const int PLANET_FIELD_CHUNK_SIZE = 256;
+
+// Planets per block in the SIMD kernel (6 floats each, so a block is 12 KiB), and particles per tile which
+// every block is applied to; both together stay in L1
+static const int PLANET_SIMD_BLOCK_SIZE = 512;
+static const int PLANET_SIMD_PARTICLE_TILE_SIZE = 256;
+
+struct PlanetProperties
+{
+    float age;
+    float mass;
+};
+
+enum PlanetGravityMode
+{
+    PLANET_GRAVITY_DIRECT,     // Sum every planet for every particle
+    PLANET_GRAVITY_DIRECT_SIMD, // Same as above, several particles at a time
+    PLANET_GRAVITY_BARNES_HUT, // Sum near planets exactly, and far clusters of planets approximately
+    PLANET_GRAVITY_FIELD_GRID, // Interpolate a cached force field, except close to planets
+    PLANET_GRAVITY_MODE_COUNT
+};
+
+static const char* const PLANET_GRAVITY_MODE_NAMES[PLANET_GRAVITY_MODE_COUNT] = {
+    "direct",
+    "direct simd",
+    "barnes-hut",
+    "field grid",
+};
+
+// Quadtree node with aggregate (mass-weighted) planet data. Symmetric (pure attractor) and asymmetric planets
+// are aggregated separately, since the latter pull or push depending on which side of the planet a particle is on.
+struct PlanetTreeNode
+{
+    AABB bounds; // tight bounds of all planets in this node
+    int first_child; // index of the first of four children, or -1 for leaves
+    int first; // leaves: first index into PlanetTree::indices
+    int count;
+
+    float symmetric_mass;
+    Vec2 symmetric_center;
+
+    float asymmetric_mass;
+    Vec2 asymmetric_center;
+    Vec2 asymmetric_direction;
+
+    // Asymmetric planets in a node can only be lumped together when they all point the same direction
+    bool asymmetric_coherent;
+};
+
+struct PlanetTree
+{
+    PlanetTreeNode* nodes;
+    int* indices;
+    int n_nodes;
+    int n_nodes_max;      // Committed capacity
+    int n_nodes_reserved; // Most nodes the pool array can grow to
+};
+
+// Most nodes in a tree over planets_count planets. Internal nodes hold more than PLANET_TREE_LEAF_SIZE planets, and
+// those at the same depth hold different planets, so there are at most planets_count / (PLANET_TREE_LEAF_SIZE + 1)
+// of them per level; each has 4 children.
+inline int planet_tree_node_count_max(const int planets_count)
+{
+    return 1 + 4 * PLANET_TREE_DEPTH_MAX * (planets_count / (PLANET_TREE_LEAF_SIZE + 1));
+}
+
+// Planet pull sampled on a regular grid of nodes, rebuilt only when planets change
+//
+// Interpolation is poor close to planets (the pull is steep) and across the sign flip of asymmetric planets
+// (the pull is discontinuous), so each cell also keeps a list of "near" planets for which this is the case.
+// In those cells, near planets are summed exactly and only the remaining planets are interpolated.
+struct PlanetField
+{
+    // Summed pull at each of the (cells_per_side + 1)^2 grid nodes, row-major
+    Vec2Array forces;
+
+    // Per cell, near planets are near_planets[near_first[cell], near_first[cell + 1]), in index order
+    int* near_first;
+    int* near_planets;
+    int n_near_max;      // Committed capacity of near_planets
+    int n_near_reserved; // Most (cell, planet) pairs near_planets can grow to
+
+    // Per cell with near planets, pull of all other planets at its 4 corners: [cell * 4 + corner]
+    Vec2Array corner_far_forces;
+
+    // Scratch used on rebuild: the last planet added to each cell, and whether near planets are being counted (first
+    // pass) or written (second pass)
+    int* near_last;
+    bool near_counting;
+
+    Vec2 origin;
+    int cells_per_side;
+    float cell_size;
+    float inv_cell_size;
+};
+
+// Copy of planet data for the SIMD kernel, where sign_bias is -1 for symmetric planets (and their direction is
+// zeroed), so that the sign of the pull is always copysign(1, dot(delta, direction) + sign_bias)
+struct PlanetsPacked
+{
+    float* x;
+    float* y;
+    float* direction_x;
+    float* direction_y;
+    float* sign_bias;
+    float* mass;
+};
+
+// Planet capacity committed by default, and the most planets a pool can grow to
+static const int N_PLANETS_INITIAL = 1 << 6;
+static const int N_PLANETS_RESERVED = 1 << 20;
+
+// Per-planet pool arrays in Planets::arena: positions, directions, properties, wake positions and 6 packed arrays,
+// besides those of the tree and field
+static const int PLANET_ARENA_ARRAY_COUNT = 10;
+
+struct Planets
+{
+    // All pool arrays (including those of the tree, field and packed copy) are in one arena
+    MemoryArena arena;
+    Vec2* positions;
+    Vec2* directions;
+    PlanetProperties* properties;
+
+    int n_active;
+    int n_max;      // Committed capacity, which grows as planets spawn
+    int n_reserved; // Most planets the pool arrays can grow to
+
+    PlanetGravityMode gravity_mode;
+
+    // Barnes-Hut opening angle: clusters of planets with (size / distance) below this are approximated
+    float opening_angle;
+    PlanetTree tree;
+
+    PlanetField field;
+
+    PlanetsPacked packed;
+
+    // Set whenever planets spawn, move or change mass, so that the cached field is rebuilt
+    bool dirty;
+
+    // Positions of the first n_wake_positions planets as of the last particles_wake_on_changes, to find planets which
+    // spawned, moved or were removed since
+    Vec2* wake_positions;
+    int n_wake_positions;
+};
+
+inline bool planet_is_symmetric(const Vec2* const direction)
+{
+    return vec2_length_squared(direction) < 1e-4f;
+}
+
+// Arena bytes needed by planet_tree_initialize
+std::size_t planet_tree_arena_bytes(const int planets_count)
+{
+    return memory_arena_array_bytes(sizeof(PlanetTreeNode) * planet_tree_node_count_max(planets_count))
+        + memory_arena_array_bytes(sizeof(int) * planets_count);
+}
+
+// Indices are a pool array in arena of up to planets_count planets, committed by planets_grow; nodes are a pool array
+// in arena too, committed as the tree is built
+void planet_tree_initialize(PlanetTree* const tree, MemoryArena* const arena, const int planets_count)
+{
+    tree->n_nodes_reserved = planet_tree_node_count_max(planets_count);
+    tree->nodes = (PlanetTreeNode*)memory_arena_reserve_array(arena, sizeof(PlanetTreeNode) * tree->n_nodes_reserved);
+    tree->indices = (int*)memory_arena_reserve_array(arena, sizeof(int) * planets_count);
+    tree->n_nodes = 0;
+    tree->n_nodes_max = 16;
+    pool_array_commit(tree->nodes, sizeof(PlanetTreeNode) * tree->n_nodes_max);
+}
+
+// Commits node storage for at least node_count nodes (see pool_grow_count); returns false past n_nodes_reserved
+bool planet_tree_grow(PlanetTree* const tree, const int node_count)
+{
+    const int n_nodes_max = pool_grow_count(tree->n_nodes_max, node_count, tree->n_nodes_reserved);
+    if (n_nodes_max <= tree->n_nodes_max)
+    {
+        return n_nodes_max >= 0;
+    }
+    if (!pool_array_commit(tree->nodes, sizeof(PlanetTreeNode) * n_nodes_max))
+    {
+        return false;
+    }
+    tree->n_nodes_max = n_nodes_max;
+    return true;
+}
+
+void planet_tree_build_node(
+    PlanetTree* const tree,
+    const Planets* const planets,
+    const int node_index,
+    const Vec2 center,
+    const float half_size,
+    const int first,
+    const int count,
+    const int depth)
+{
+    PlanetTreeNode node;
+    node.first_child = -1;
+    node.first = first;
+    node.count = count;
+    node.symmetric_mass = 0.f;
+    node.symmetric_center = Vec2{0.f, 0.f};
+    node.asymmetric_mass = 0.f;
+    node.asymmetric_center = Vec2{0.f, 0.f};
+    node.asymmetric_direction = Vec2{0.f, 0.f};
+    node.asymmetric_coherent = true;
+    node.bounds = aabb_create(center, center);
+
+    // Aggregate masses and mass-weighted centers
+    for (int i = first; i < first + count; ++i)
+    {
+        const int p = tree->indices[i];
+        const Vec2* const position = planets->positions + p;
+        const Vec2* const direction = planets->directions + p;
+        const float mass = (planets->properties + p)->mass;
+
+        if (i == first)
+        {
+            node.bounds = aabb_create(*position, *position);
+        }
+        node.bounds.min_corner.x = std::fmin(node.bounds.min_corner.x, position->x);
+        node.bounds.min_corner.y = std::fmin(node.bounds.min_corner.y, position->y);
+        node.bounds.max_corner.x = std::fmax(node.bounds.max_corner.x, position->x);
+        node.bounds.max_corner.y = std::fmax(node.bounds.max_corner.y, position->y);
+
+        if (planet_is_symmetric(direction))
+        {
+            node.symmetric_mass += mass;
+            vec2_scale_compound_add(&node.symmetric_center, position, mass);
+        }
+        else
+        {
+            if (node.asymmetric_mass == 0.f)
+            {
+                node.asymmetric_direction = *direction;
+            }
+            else if (!vec2_near(&node.asymmetric_direction, direction, 1e-6f))
+            {
+                node.asymmetric_coherent = false;
+            }
+            node.asymmetric_mass += mass;
+            vec2_scale_compound_add(&node.asymmetric_center, position, mass);
+        }
+    }
+    if (node.symmetric_mass > 0.f)
+    {
+        vec2_scale(&node.symmetric_center, 1.f / node.symmetric_mass);
+    }
+    if (node.asymmetric_mass > 0.f)
+    {
+        vec2_scale(&node.asymmetric_center, 1.f / node.asymmetric_mass);
+    }
+
+    // Nodes which can't grow node storage stay leaves, which are summed exactly
+    if (count <= PLANET_TREE_LEAF_SIZE || depth >= PLANET_TREE_DEPTH_MAX || !planet_tree_grow(tree, tree->n_nodes + 4))
+    {
+        tree->nodes[node_index] = node;
+        return;
+    }
+
+    // Partition planets into quadrants: [x-y-, x+y-, x-y+, x+y+]
+    const Vec2* const positions = planets->positions;
+    int* const begin = tree->indices + first;
+    int* const end = begin + count;
+    int* const split_x = std::partition(begin, end, [positions, center](const int p) { return positions[p].x < center.x; });
+    int* const split_y_lower = std::partition(begin, split_x, [positions, center](const int p) { return positions[p].y < center.y; });
+    int* const split_y_upper = std::partition(split_x, end, [positions, center](const int p) { return positions[p].y < center.y; });
+    const int bounds[5] = {
+        first,
+        first + (int)(split_y_lower - begin),
+        first + (int)(split_x - begin),
+        first + (int)(split_y_upper - begin),
+        first + count
+    };
+
+    // Children are always allocated side-by-side
+    node.first_child = tree->n_nodes;
+    tree->n_nodes += 4;
+    tree->nodes[node_index] = node;
+
+    const float quarter_size = 0.5f * half_size;
+    const Vec2 child_centers[4] = {
+        Vec2{center.x - quarter_size, center.y - quarter_size},
+        Vec2{center.x + quarter_size, center.y - quarter_size},
+        Vec2{center.x - quarter_size, center.y + quarter_size},
+        Vec2{center.x + quarter_size, center.y + quarter_size},
+    };
+    const int order[4] = {0, 2, 1, 3}; // quadrant order of partitioned ranges: [x-y-, x-y+, x+y-, x+y+]
+    for (int q = 0; q < 4; ++q)
+    {
+        const int child = order[q];
+        planet_tree_build_node(
+            tree,
+            planets,
+            node.first_child + child,
+            child_centers[child],
+            quarter_size,
+            bounds[q],
+            bounds[q + 1] - bounds[q],
+            depth + 1
+        );
+    }
+}
+
+void planet_tree_build(PlanetTree* const tree, const Planets* const planets)
+{
+    tree->n_nodes = 0;
+    if (planets->n_active == 0)
+    {
+        return;
+    }
+
+    // Square root cell around all planets
+    AABB bounds = aabb_create(planets->positions[0], planets->positions[0]);
+    for (int p = 0; p < planets->n_active; ++p)
+    {
+        tree->indices[p] = p;
+        bounds.min_corner.x = std::fmin(bounds.min_corner.x, planets->positions[p].x);
+        bounds.min_corner.y = std::fmin(bounds.min_corner.y, planets->positions[p].y);
+        bounds.max_corner.x = std::fmax(bounds.max_corner.x, planets->positions[p].x);
+        bounds.max_corner.y = std::fmax(bounds.max_corner.y, planets->positions[p].y);
+    }
+    const Vec2 center{0.5f * (bounds.min_corner.x + bounds.max_corner.x), 0.5f * (bounds.min_corner.y + bounds.max_corner.y)};
+    const float half_size = 0.5f * std::fmax(bounds.max_corner.x - bounds.min_corner.x, bounds.max_corner.y - bounds.min_corner.y) + 1e-3f;
+
+    tree->n_nodes = 1;
+    planet_tree_build_node(tree, planets, 0, center, half_size, 0, planets->n_active, 0);
+}
+
+// Adds the pull of a single planet (or lumped cluster of planets) to force, where delta is particle - planet
+inline void planet_pull(Vec2* const force, const Vec2* const delta, const Vec2* const direction, const bool is_symmetric, const float mass)
+{
+    // The "direction" of a planet's field basically splits it into two-halves. On one side, its an attractor,
+    // and the other a repeller. It seems like this sort of asymmetry is needed to make the game more playable
+    // otherwise, you end up with particles cycling clusters of planets in chaos as opposed to getting "flung,"
+    // unless you are extremely careful, which is not fun IMO.
+    const float sign = (is_symmetric)*(-1.f) +
+                       (!is_symmetric)*std::copysign(1.f, vec2_dot(delta, direction));
+
+    // Squared distance between planet and particle
+    const float r_sq = vec2_length_squared(delta);
+
+    // NOTE: this is no longer consistent with the Newtonian gravitational
+    //       model, but make attractions more stable
+    vec2_scale_compound_add(force, delta, sign * (mass / (r_sq + 1e-5f)));
+}
+
+// Adds the pull of every planet on a particle to force. Returns the index of the planet which absorbs the
+// particle (the first planet whose surface it is within), or -1.
+inline int planets_pull_direct(const Planets* const planets, const Vec2* const position, Vec2* const force)
+{
+    for (int p = 0; p < planets->n_active; ++p)
+    {
+        // Force is planet_position - particle_position
+        const Vec2 delta = vec2_sub(position, planets->positions + p);
+
+        // If a prticle is too close to the planet surface, do not update and mark for death on next update
+        if (vec2_length_squared(&delta) < PLANET_SURFACE_RADIUS_SQ)
+        {
+            return p;
+        }
+
+        planet_pull(force, &delta, planets->directions + p, planet_is_symmetric(planets->directions + p), (planets->properties + p)->mass);
+    }
+    return -1;
+}
+
+// Same as planets_pull_direct, but approximates the pull of far away clusters of planets using the planet tree
+inline int planets_pull_barnes_hut(const Planets* const planets, const Vec2* const position, Vec2* const force)
+{
+    const PlanetTree* const tree = &planets->tree;
+    const float opening_angle_sq = planets->opening_angle * planets->opening_angle;
+
+    int absorbed_by = -1;
+
+    int stack[PLANET_TREE_STACK_SIZE];
+    int stack_size = 0;
+    if (tree->n_nodes > 0)
+    {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0)
+    {
+        const PlanetTreeNode* const node = tree->nodes + stack[--stack_size];
+        if (node->count == 0)
+        {
+            continue;
+        }
+
+        // Particles which might be within any planet's surface always take the exact path, so that deaths are exact
+        AABB surface_bounds = node->bounds;
+        surface_bounds.min_corner.x -= PLANET_SURFACE_RADIUS;
+        surface_bounds.min_corner.y -= PLANET_SURFACE_RADIUS;
+        surface_bounds.max_corner.x += PLANET_SURFACE_RADIUS;
+        surface_bounds.max_corner.y += PLANET_SURFACE_RADIUS;
+
+        const float size = std::fmax(node->bounds.max_corner.x - node->bounds.min_corner.x, node->bounds.max_corner.y - node->bounds.min_corner.y);
+        const float size_sq = size * size;
+        const Vec2 symmetric_delta = vec2_sub(position, &node->symmetric_center);
+        const Vec2 asymmetric_delta = vec2_sub(position, &node->asymmetric_center);
+        const bool symmetric_far = (node->symmetric_mass == 0.f) ||
+                                   (size_sq < opening_angle_sq * vec2_length_squared(&symmetric_delta));
+        const bool asymmetric_far = (node->asymmetric_mass == 0.f) ||
+                                    (node->asymmetric_coherent && size_sq < opening_angle_sq * vec2_length_squared(&asymmetric_delta));
+
+        if (symmetric_far && asymmetric_far && !aabb_within(&surface_bounds, position))
+        {
+            if (node->symmetric_mass > 0.f)
+            {
+                planet_pull(force, &symmetric_delta, &node->asymmetric_direction, true, node->symmetric_mass);
+            }
+            if (node->asymmetric_mass > 0.f)
+            {
+                planet_pull(force, &asymmetric_delta, &node->asymmetric_direction, false, node->asymmetric_mass);
+            }
+        }
+        else if (node->first_child >= 0)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                stack[stack_size++] = node->first_child + c;
+            }
+        }
+        else
+        {
+            for (int i = node->first; i < node->first + node->count; ++i)
+            {
+                const int p = tree->indices[i];
+                const Vec2 delta = vec2_sub(position, planets->positions + p);
+                if (vec2_length_squared(&delta) < PLANET_SURFACE_RADIUS_SQ)
+                {
+                    // Absorbed by the lowest-index planet, same as the direct method
+                    absorbed_by = (absorbed_by < 0) ? p : imin(absorbed_by, p);
+                }
+                else
+                {
+                    planet_pull(force, &delta, planets->directions + p, planet_is_symmetric(planets->directions + p), (planets->properties + p)->mass);
+                }
+            }
+        }
+    }
+    return absorbed_by;
+}
+
+// Most cells a single planet is near: its disk (see planet_field_build), plus up to 2 cells per column (or row) for the
+// line of an asymmetric planet, with a cell of margin for rounding in both
+inline int planet_field_near_count_max(const int cells_per_side)
+{
+    const float cell_size = 2.f / (float)cells_per_side;
+    const float near_radius = PLANET_SURFACE_RADIUS + PLANET_FIELD_NEAR_RADIUS_CELLS * cell_size;
+    const int disk_side = (int)(2.f * near_radius / cell_size) + 3;
+    return disk_side * disk_side + 3 * cells_per_side;
+}
+
+// Arena bytes needed by planet_field_initialize
+std::size_t planet_field_arena_bytes(const int cells_per_side, const int planets_count)
+{
+    const int n_cells = cells_per_side * cells_per_side;
+    const int n_nodes = (cells_per_side + 1) * (cells_per_side + 1);
+    return 2 * memory_arena_array_bytes(sizeof(float) * simd_padded_count(n_nodes))
+        + 2 * memory_arena_array_bytes(sizeof(float) * simd_padded_count(4 * n_cells))
+        + memory_arena_array_bytes(sizeof(int) * (n_cells + 1))
+        + memory_arena_array_bytes(sizeof(int) * n_cells)
+        + memory_arena_array_bytes(sizeof(int) * (std::size_t)planets_count * planet_field_near_count_max(cells_per_side));
+}
+
+// Near planet lists are a pool array in arena with room for planets_count planets, committed as the field is rebuilt
+void planet_field_initialize(PlanetField* const field, MemoryArena* const arena, const int cells_per_side, const int planets_count)
+{
+    const int n_cells = cells_per_side * cells_per_side;
+    const int n_nodes = (cells_per_side + 1) * (cells_per_side + 1);
+    vec2_array_reserve(&field->forces, arena, n_nodes);
+    vec2_array_reserve(&field->corner_far_forces, arena, 4 * n_cells);
+    vec2_array_commit(&field->forces, n_nodes);
+    vec2_array_commit(&field->corner_far_forces, 4 * n_cells);
+
+    field->near_first = (int*)memory_arena_reserve_array(arena, sizeof(int) * (n_cells + 1));
+    field->near_last = (int*)memory_arena_reserve_array(arena, sizeof(int) * n_cells);
+    pool_array_commit(field->near_first, sizeof(int) * (n_cells + 1));
+    pool_array_commit(field->near_last, sizeof(int) * n_cells);
+    field->near_counting = false;
+
+    field->n_near_reserved = planets_count * planet_field_near_count_max(cells_per_side);
+    field->near_planets = (int*)memory_arena_reserve_array(arena, sizeof(int) * (std::size_t)field->n_near_reserved);
+    field->n_near_max = 0;
+
+    field->origin = Vec2{-1.f, -1.f};
+    field->cells_per_side = cells_per_side;
+    field->cell_size = 2.f / (float)cells_per_side;
+    field->inv_cell_size = 1.f / field->cell_size;
+}
+
+inline int planet_field_cell_coord(const PlanetField* const field, const float v, const float origin)
+{
+    return imin(imax((int)std::floor((v - origin) * field->inv_cell_size), 0), field->cells_per_side - 1);
+}
+
+inline void planet_field_add_near(PlanetField* const field, const int cell, const int planet)
+{
+    // Disk and line of the same planet may overlap
+    if (field->near_last[cell] == planet)
+    {
+        return;
+    }
+    field->near_last[cell] = planet;
+
+    // Counts go one cell up, so that their prefix sum is the start of each cell. Writes use near_first[cell] as the
+    // cursor of each cell, which leaves it at the start of the next cell.
+    if (field->near_counting)
+    {
+        ++field->near_first[cell + 1];
+    }
+    else
+    {
+        field->near_planets[field->near_first[cell]++] = planet;
+    }
+}
+
+// Adds planet to cells within radius of its center
+void planet_field_add_near_disk(PlanetField* const field, const Vec2* const center, const float radius, const int planet)
+{
+    const int x_lower = planet_field_cell_coord(field, center->x - radius, field->origin.x);
+    const int x_upper = planet_field_cell_coord(field, center->x + radius, field->origin.x);
+    const int y_lower = planet_field_cell_coord(field, center->y - radius, field->origin.y);
+    const int y_upper = planet_field_cell_coord(field, center->y + radius, field->origin.y);
+    for (int cy = y_lower; cy <= y_upper; ++cy)
+    {
+        for (int cx = x_lower; cx <= x_upper; ++cx)
+        {
+            // Distance from center to the nearest point of the cell
+            const float x_min = field->origin.x + cx * field->cell_size;
+            const float y_min = field->origin.y + cy * field->cell_size;
+            const float dx = std::fmax(0.f, std::fmax(x_min - center->x, center->x - (x_min + field->cell_size)));
+            const float dy = std::fmax(0.f, std::fmax(y_min - center->y, center->y - (y_min + field->cell_size)));
+            if (dx * dx + dy * dy < radius * radius)
+            {
+                planet_field_add_near(field, cy * field->cells_per_side + cx, planet);
+            }
+        }
+    }
+}
+
+// Adds planet to cells crossed by the line through center perpendicular to direction, on which an asymmetric
+// planet's pull flips sign
+void planet_field_add_near_line(PlanetField* const field, const Vec2* const center, const Vec2* const direction, const int planet)
+{
+    // Walk along whichever axis the line is closest to, one cell column (or row) at a time
+    const bool along_x = std::abs(direction->y) >= std::abs(direction->x);
+    const float slope = along_x ? (-direction->x / direction->y) : (-direction->y / direction->x);
+    const float walk_center = along_x ? center->x : center->y;
+    const float cross_center = along_x ? center->y : center->x;
+    const float walk_origin = along_x ? field->origin.x : field->origin.y;
+    const float cross_origin = along_x ? field->origin.y : field->origin.x;
+
+    for (int w = 0; w < field->cells_per_side; ++w)
+    {
+        const float walk_lower = walk_origin + w * field->cell_size;
+        const float cross_at_lower = cross_center + (walk_lower - walk_center) * slope;
+        const float cross_at_upper = cross_at_lower + field->cell_size * slope;
+        const float cross_lower = std::fmin(cross_at_lower, cross_at_upper);
+        const float cross_upper = std::fmax(cross_at_lower, cross_at_upper);
+        if (cross_upper < cross_origin || cross_lower > cross_origin + 2.f)
+        {
+            continue;
+        }
+
+        const int c_lower = planet_field_cell_coord(field, cross_lower, cross_origin);
+        const int c_upper = planet_field_cell_coord(field, cross_upper, cross_origin);
+        for (int c = c_lower; c <= c_upper; ++c)
+        {
+            planet_field_add_near(field, along_x ? (c * field->cells_per_side + w) : (w * field->cells_per_side + c), planet);
+        }
+    }
+}
+
+struct PlanetFieldBuildTask
+{
+    const Planets* planets;
+    PlanetField* field;
+};
+
+void planet_field_build_nodes_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    const PlanetFieldBuildTask* const task = (const PlanetFieldBuildTask*)context;
+    PlanetField* const field = task->field;
+    const int n_nodes_per_side = field->cells_per_side + 1;
+    for (int i = begin; i < end; ++i)
+    {
+        const Vec2 position{
+            field->origin.x + (i % n_nodes_per_side) * field->cell_size,
+            field->origin.y + (i / n_nodes_per_side) * field->cell_size
+        };
+        Vec2 force{0.f, 0.f};
+        planets_pull_barnes_hut(task->planets, &position, &force);
+        vec2_array_set(&field->forces, i, &force);
+    }
+}
+
+void planet_field_build_corners_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    const PlanetFieldBuildTask* const task = (const PlanetFieldBuildTask*)context;
+    const Planets* const planets = task->planets;
+    PlanetField* const field = task->field;
+    const int n_nodes_per_side = field->cells_per_side + 1;
+    for (int cell = begin; cell < end; ++cell)
+    {
+        if (field->near_first[cell] == field->near_first[cell + 1])
+        {
+            continue;
+        }
+
+        const int cx = cell % field->cells_per_side;
+        const int cy = cell / field->cells_per_side;
+        for (int corner = 0; corner < 4; ++corner)
+        {
+            const int nx = cx + (corner & 1);
+            const int ny = cy + (corner >> 1);
+            const Vec2 position{field->origin.x + nx * field->cell_size, field->origin.y + ny * field->cell_size};
+
+            // Remove near planets from the summed pull
+            Vec2 near_force{0.f, 0.f};
+            for (int i = field->near_first[cell]; i < field->near_first[cell + 1]; ++i)
+            {
+                const int p = field->near_planets[i];
+                const Vec2 delta = vec2_sub(&position, planets->positions + p);
+
+                // Planets are left out of the summed pull at nodes within their surface
+                if (vec2_length_squared(&delta) >= PLANET_SURFACE_RADIUS_SQ)
+                {
+                    planet_pull(&near_force, &delta, planets->directions + p, planet_is_symmetric(planets->directions + p), (planets->properties + p)->mass);
+                }
+            }
+            const Vec2 node_force = vec2_array_get(&field->forces, ny * n_nodes_per_side + nx);
+            const Vec2 far_force = vec2_sub(&node_force, &near_force);
+            vec2_array_set(&field->corner_far_forces, 4 * cell + corner, &far_force);
+        }
+    }
+}
+
+// Rebuilds the field from the planet tree (which must be up to date)
+void planet_field_build(PlanetField* const field, const Planets* const planets, ThreadPool* const pool)
+{
+    const int n_cells = field->cells_per_side * field->cells_per_side;
+    const int n_nodes_per_side = field->cells_per_side + 1;
+
+    PlanetFieldBuildTask task{planets, field};
+    thread_pool_run(pool, planet_field_build_nodes_task, &task, n_nodes_per_side * n_nodes_per_side, PLANET_FIELD_CHUNK_SIZE);
+
+    // Counting sort of (cell, planet) pairs by cell, without storing the pairs: the first pass counts near planets
+    // per cell, and the second gathers them again and writes them out. Both go in planet index order, so each cell's
+    // planets stay in index order.
+    std::memset(field->near_first, 0, sizeof(int) * (n_cells + 1));
+    const float near_radius = PLANET_SURFACE_RADIUS + PLANET_FIELD_NEAR_RADIUS_CELLS * field->cell_size;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        field->near_counting = (pass == 0);
+        std::memset(field->near_last, 0xff, sizeof(int) * n_cells);
+        for (int p = 0; p < planets->n_active; ++p)
+        {
+            planet_field_add_near_disk(field, planets->positions + p, near_radius, p);
+            if (!planet_is_symmetric(planets->directions + p))
+            {
+                planet_field_add_near_line(field, planets->positions + p, planets->directions + p, p);
+            }
+        }
+
+        if (pass == 0)
+        {
+            for (int c = 0; c < n_cells; ++c)
+            {
+                field->near_first[c + 1] += field->near_first[c];
+            }
+
+            // Commit near planet storage (see pool_grow_count); near_count_max bounds the pairs of every planet, so this
+            // only fails if memory runs out, in which case cells are left without near planets
+            const int n_near_max = pool_grow_count(field->n_near_max, field->near_first[n_cells], field->n_near_reserved);
+            if (n_near_max != field->n_near_max)
+            {
+                if (n_near_max < 0 || !pool_array_commit(field->near_planets, sizeof(int) * (std::size_t)n_near_max))
+                {
+                    std::memset(field->near_first, 0, sizeof(int) * (n_cells + 1));
+                    break;
+                }
+                field->n_near_max = n_near_max;
+            }
+        }
+        else
+        {
+            // Cursors were left at the start of the next cell
+            std::memmove(field->near_first + 1, field->near_first, sizeof(int) * n_cells);
+            field->near_first[0] = 0;
+        }
+    }
+
+    thread_pool_run(pool, planet_field_build_corners_task, &task, n_cells, PLANET_FIELD_CHUNK_SIZE);
+}
+
+// Adds the pull of all planets at position to force, using the field. Returns false (and leaves force alone)
+// outside of the field. Otherwise, absorbed_by is set as in planets_pull_direct.
+inline bool planet_field_pull(const PlanetField* const field, const Planets* const planets, const Vec2* const position, Vec2* const force, int* const absorbed_by)
+{
+    const float fx = (position->x - field->origin.x) * field->inv_cell_size;
+    const float fy = (position->y - field->origin.y) * field->inv_cell_size;
+    if (!(fx >= 0.f && fy >= 0.f && fx < (float)field->cells_per_side && fy < (float)field->cells_per_side))
+    {
+        return false;
+    }
+
+    const int cx = (int)fx;
+    const int cy = (int)fy;
+    const int cell = cy * field->cells_per_side + cx;
+    const float tx = fx - (float)cx;
+    const float ty = fy - (float)cy;
+    const float w00 = (1.f - tx) * (1.f - ty);
+    const float w10 = tx * (1.f - ty);
+    const float w01 = (1.f - tx) * ty;
+    const float w11 = tx * ty;
+
+    *absorbed_by = -1;
+
+    if (field->near_first[cell] == field->near_first[cell + 1])
+    {
+        const int i00 = cy * (field->cells_per_side + 1) + cx;
+        const int i10 = i00 + 1;
+        const int i01 = i00 + field->cells_per_side + 1;
+        const int i11 = i01 + 1;
+        force->x += w00 * field->forces.x[i00] + w10 * field->forces.x[i10] + w01 * field->forces.x[i01] + w11 * field->forces.x[i11];
+        force->y += w00 * field->forces.y[i00] + w10 * field->forces.y[i10] + w01 * field->forces.y[i01] + w11 * field->forces.y[i11];
+        return true;
+    }
+
+    // Only near planets can be close enough to absorb the particle, and they are in index order, so the first
+    // one hit is also the one the direct method would pick
+    for (int i = field->near_first[cell]; i < field->near_first[cell + 1]; ++i)
+    {
+        const int p = field->near_planets[i];
+        const Vec2 delta = vec2_sub(position, planets->positions + p);
+        if (vec2_length_squared(&delta) < PLANET_SURFACE_RADIUS_SQ)
+        {
+            *absorbed_by = p;
+            return true;
+        }
+        planet_pull(force, &delta, planets->directions + p, planet_is_symmetric(planets->directions + p), (planets->properties + p)->mass);
+    }
+
+    const float* const far_x = field->corner_far_forces.x + 4 * cell;
+    const float* const far_y = field->corner_far_forces.y + 4 * cell;
+    force->x += w00 * far_x[0] + w10 * far_x[1] + w01 * far_x[2] + w11 * far_x[3];
+    force->y += w00 * far_y[0] + w10 * far_y[1] + w01 * far_y[2] + w11 * far_y[3];
+    return true;
+}
+
+// Reserves pool arrays in arena for up to planets_count planets, committed by planets_grow
+void planets_packed_initialize(PlanetsPacked* const packed, MemoryArena* const arena, const int planets_count)
+{
+    packed->x = (float*)memory_arena_reserve_array(arena, sizeof(float) * planets_count);
+    packed->y = (float*)memory_arena_reserve_array(arena, sizeof(float) * planets_count);
+    packed->direction_x = (float*)memory_arena_reserve_array(arena, sizeof(float) * planets_count);
+    packed->direction_y = (float*)memory_arena_reserve_array(arena, sizeof(float) * planets_count);
+    packed->sign_bias = (float*)memory_arena_reserve_array(arena, sizeof(float) * planets_count);
+    packed->mass = (float*)memory_arena_reserve_array(arena, sizeof(float) * planets_count);
+}
+
+bool planets_packed_commit(PlanetsPacked* const packed, const int planets_count)
+{
+    return pool_array_commit(packed->x, sizeof(float) * planets_count)
+        && pool_array_commit(packed->y, sizeof(float) * planets_count)
+        && pool_array_commit(packed->direction_x, sizeof(float) * planets_count)
+        && pool_array_commit(packed->direction_y, sizeof(float) * planets_count)
+        && pool_array_commit(packed->sign_bias, sizeof(float) * planets_count)
+        && pool_array_commit(packed->mass, sizeof(float) * planets_count);
+}
+
+void planets_packed_update(PlanetsPacked* const packed, const Planets* const planets)
+{
+    for (int p = 0; p < planets->n_active; ++p)
+    {
+        const bool is_symmetric = planet_is_symmetric(planets->directions + p);
+        packed->x[p] = planets->positions[p].x;
+        packed->y[p] = planets->positions[p].y;
+        packed->direction_x[p] = is_symmetric ? 0.f : planets->directions[p].x;
+        packed->direction_y[p] = is_symmetric ? 0.f : planets->directions[p].y;
+        packed->sign_bias[p] = is_symmetric ? -1.f : 0.f;
+        packed->mass[p] = planets->properties[p].mass;
+    }
+}
+
+// Commits planet storage for at least planets_count planets (see pool_grow_count); returns false past n_reserved
+bool planets_grow(Planets* const planets, const int planets_count)
+{
+    const int n_max = pool_grow_count(planets->n_max, planets_count, planets->n_reserved);
+    if (n_max <= planets->n_max)
+    {
+        return n_max >= 0;
+    }
+    const bool committed = pool_array_commit(planets->positions, sizeof(Vec2) * n_max)
+        && pool_array_commit(planets->directions, sizeof(Vec2) * n_max)
+        && pool_array_commit(planets->properties, sizeof(PlanetProperties) * n_max)
+        && pool_array_commit(planets->wake_positions, sizeof(Vec2) * n_max)
+        && pool_array_commit(planets->tree.indices, sizeof(int) * n_max)
+        && planets_packed_commit(&planets->packed, n_max);
+    if (committed)
+    {
+        planets->n_max = n_max;
+    }
+    return committed;
+}
+
+// Starts with capacity for planets_count planets, which grows on demand up to N_PLANETS_RESERVED
+void planets_initialize(Planets* const planets, const int planets_count)
+{
+    // Arrays are at most a Vec2 per planet each
+    planets->n_reserved = imax(planets_count, N_PLANETS_RESERVED);
+    memory_arena_initialize(
+        &planets->arena,
+        PLANET_ARENA_ARRAY_COUNT * memory_arena_array_bytes(sizeof(Vec2) * planets->n_reserved)
+            + planet_tree_arena_bytes(planets->n_reserved)
+            + planet_field_arena_bytes(PLANET_FIELD_CELLS_PER_SIDE, planets->n_reserved)
+    );
+    planets->positions = (Vec2*)memory_arena_reserve_array(&planets->arena, sizeof(Vec2) * planets->n_reserved);
+    planets->directions = (Vec2*)memory_arena_reserve_array(&planets->arena, sizeof(Vec2) * planets->n_reserved);
+    planets->properties = (PlanetProperties*)memory_arena_reserve_array(&planets->arena, sizeof(PlanetProperties) * planets->n_reserved);
+    planets->wake_positions = (Vec2*)memory_arena_reserve_array(&planets->arena, sizeof(Vec2) * planets->n_reserved);
+    planets->n_wake_positions = 0;
+
+    planets->n_active = 0;
+
+    planets->gravity_mode = PLANET_GRAVITY_DIRECT_SIMD;
+    planets->opening_angle = 0.5f;
+    planet_tree_initialize(&planets->tree, &planets->arena, planets->n_reserved);
+    planet_field_initialize(&planets->field, &planets->arena, PLANET_FIELD_CELLS_PER_SIDE, planets->n_reserved);
+    planets_packed_initialize(&planets->packed, &planets->arena, planets->n_reserved);
+    planets->dirty = true;
+
+    planets->n_max = 0;
+    planets_grow(planets, planets_count);
+}
+
+void planets_spawn_at(Planets* const planets, const Vec2 position, const Vec2 direction, const float mass)
+{
+    if (!planets_grow(planets, planets->n_active + 1))
+    {
+        return;
+    }
+
+    // Initialize point state
+    vec2_set(planets->positions + planets->n_active, &position);
+    vec2_set(planets->directions + planets->n_active, &direction);
+
+    // Initialize mass
+    (planets->properties + planets->n_active)->mass = mass;
+
+    // Initialize time alive
+    (planets->properties + planets->n_active)->age = 0.f;
+
+    // Increment number of active particles
+    ++planets->n_active;
+
+    planets->dirty = true;
+}
+
+void planets_update(Planets* const planets, const float dt)
+{
+    for (int i = 0; i < planets->n_active; ++i)
+    {
+        planets->properties[i].age += dt;
+    }
+}
+
+// Applies planet pull to particles [begin, end); mass absorbed by each planet is added to mass_gained
+void planets_apply_to_particles_range(const Planets* const planets, Particles* const ps, float* const mass_gained, const int begin, const int end)
+{
+    // Calc pull of each planet on each particle; add results to forces
+    for (int i = begin; i < end; ++i)
+    {
+        if (particles_is_asleep(ps, i))
+        {
+            continue;
+        }
+
+        const Vec2 position = vec2_array_get(&ps->positions, i);
+        Vec2 force = vec2_array_get(&ps->forces, i);
+
+        int absorbed_by = -1;
+        if (planets->gravity_mode == PLANET_GRAVITY_BARNES_HUT)
+        {
+            absorbed_by = planets_pull_barnes_hut(planets, &position, &force);
+        }
+        else if (planets->gravity_mode == PLANET_GRAVITY_FIELD_GRID)
+        {
+            if (!planet_field_pull(&planets->field, planets, &position, &force, &absorbed_by))
+            {
+                absorbed_by = planets_pull_barnes_hut(planets, &position, &force);
+            }
+        }
+        else
+        {
+            absorbed_by = planets_pull_direct(planets, &position, &force);
+        }
+
+        if (absorbed_by >= 0)
+        {
+            // Kill off the particle
+            bitset_clear(ps->alive, i);
+
+            // Increase the mass of the planet
+            mass_gained[absorbed_by] += PARTICLE_MASS_GAINED;
+        }
+
+        vec2_array_set(&ps->forces, i, &force);
+    }
+}
+
+// Same as planets_apply_to_particles_range in direct mode, using packed planets (which must be up to date) and
+// SIMD_F32_WIDTH particles at a time. Surface hits are tracked per lane: a lane stops accumulating pull after its
+// first hit, as in planets_pull_direct. Only groups of lanes which are all asleep are skipped; pull on the other
+// sleeping particles is ignored by the step.
+void planets_apply_to_particles_simd_range(const Planets* const planets, Particles* const ps, float* const mass_gained, const int begin, const int end)
+{
+    const PlanetsPacked* const packed = &planets->packed;
+
+    // Per particle in tile: index of the absorbing planet (exact as float), or -1
+    alignas(SIMD_ALIGNMENT_BYTES) float absorbed_by[PLANET_SIMD_PARTICLE_TILE_SIZE];
+
+    const simd_f32 surface_radius_sq = simd_f32_set1(PLANET_SURFACE_RADIUS_SQ);
+    const simd_f32 softening = simd_f32_set1(1e-5f);
+    const simd_f32 one = simd_f32_set1(1.f);
+    const simd_f32 zero = simd_f32_set1(0.f);
+
+    for (int tile_begin = begin; tile_begin < end; tile_begin += PLANET_SIMD_PARTICLE_TILE_SIZE)
+    {
+        // Particle arrays are padded, so the last tile can run over end
+        const int tile_end = imin(tile_begin + PLANET_SIMD_PARTICLE_TILE_SIZE, end);
+        const int n_tile_padded = simd_padded_count(tile_end - tile_begin);
+        float* const forces_x = ps->forces.x + tile_begin;
+        float* const forces_y = ps->forces.y + tile_begin;
+        const float* const positions_x = ps->positions.x + tile_begin;
+        const float* const positions_y = ps->positions.y + tile_begin;
+
+        simd_fill_n(absorbed_by, -1.f, n_tile_padded);
+
+        for (int block_begin = 0; block_begin < planets->n_active; block_begin += PLANET_SIMD_BLOCK_SIZE)
+        {
+            const int block_end = imin(block_begin + PLANET_SIMD_BLOCK_SIZE, planets->n_active);
+            for (int i = 0; i < n_tile_padded; i += SIMD_F32_WIDTH)
+            {
+                if (particles_are_asleep(ps, tile_begin + i, imin(tile_begin + i + SIMD_F32_WIDTH, tile_end)))
+                {
+                    continue;
+                }
+
+                const simd_f32 position_x = simd_f32_load(positions_x + i);
+                const simd_f32 position_y = simd_f32_load(positions_y + i);
+                simd_f32 force_x = simd_f32_load(forces_x + i);
+                simd_f32 force_y = simd_f32_load(forces_y + i);
+                simd_f32 absorbed = simd_f32_load(absorbed_by + i);
+                simd_mask alive = simd_f32_lt(absorbed, zero);
+
+                for (int p = block_begin; p < block_end; ++p)
+                {
+                    // Force is planet_position - particle_position
+                    const simd_f32 delta_x = simd_f32_sub(position_x, simd_f32_set1(packed->x[p]));
+                    const simd_f32 delta_y = simd_f32_sub(position_y, simd_f32_set1(packed->y[p]));
+                    const simd_f32 r_sq = simd_f32_mul_add(delta_x, delta_x, simd_f32_mul(delta_y, delta_y));
+
+                    // Surface hits mark the particle for death, and stop its pull from being updated
+                    const simd_mask hit = simd_f32_lt(r_sq, surface_radius_sq);
+                    absorbed = simd_f32_select(simd_mask_and(alive, hit), simd_f32_set1((float)p), absorbed);
+                    alive = simd_mask_and_not(alive, hit);
+
+                    const simd_f32 dot = simd_f32_mul_add(delta_x, simd_f32_set1(packed->direction_x[p]),
+                                         simd_f32_mul_add(delta_y, simd_f32_set1(packed->direction_y[p]), simd_f32_set1(packed->sign_bias[p])));
+                    const simd_f32 scale = simd_f32_div(simd_f32_mul(simd_f32_copysign(one, dot), simd_f32_set1(packed->mass[p])),
+                                                        simd_f32_add(r_sq, softening));
+                    force_x = simd_f32_select(alive, simd_f32_mul_add(delta_x, scale, force_x), force_x);
+                    force_y = simd_f32_select(alive, simd_f32_mul_add(delta_y, scale, force_y), force_y);
+                }
+
+                simd_f32_store(forces_x + i, force_x);
+                simd_f32_store(forces_y + i, force_y);
+                simd_f32_store(absorbed_by + i, absorbed);
+            }
+        }
+
+        for (int i = tile_begin; i < tile_end; ++i)
+        {
+            const float p = absorbed_by[i - tile_begin];
+            if (p >= 0.f)
+            {
+                // Kill off the particle
+                bitset_clear(ps->alive, i);
+
+                // Increase the mass of the planet
+                mass_gained[(int)p] += PARTICLE_MASS_GAINED;
+            }
+        }
+    }
+}
+
+struct PlanetsApplyToParticlesTask
+{
+    const Planets* planets;
+    Particles* ps;
+    WorkerAccumulators* acc;
+};
+
+// Applies planet pull to particles [begin, end) in float storage, with the kernel for the gravity mode
+inline void planets_apply_to_particles_any_range(const Planets* const planets, Particles* const ps, float* const mass_gained, const int begin, const int end)
+{
+    if (planets->gravity_mode == PLANET_GRAVITY_DIRECT_SIMD)
+    {
+        planets_apply_to_particles_simd_range(planets, ps, mass_gained, begin, end);
+    }
+    else
+    {
+        planets_apply_to_particles_range(planets, ps, mass_gained, begin, end);
+    }
+}
+
+// Same as planets_apply_to_particles_any_range, on particles in compact storage; positions are decoded a tile at a time
+void planets_apply_to_particles_compact_range(const Planets* const planets, Particles* const ps, float* const mass_gained, const int begin, const int end)
+{
+    ParticleCompactTile tile;
+    for (int tile_begin = begin; tile_begin < end; tile_begin += PARTICLE_STEP_TILE_SIZE)
+    {
+        const int n = imin(PARTICLE_STEP_TILE_SIZE, end - tile_begin);
+        const int n_padded = simd_padded_count(n);
+        particle_compact_tile_view(&tile, ps, tile_begin);
+        simd_decode_i16_n(tile.view.positions.x, ps->compact_positions.x + tile_begin, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+        simd_decode_i16_n(tile.view.positions.y, ps->compact_positions.y + tile_begin, PARTICLE_COMPACT_POSITION_SCALE, n_padded);
+        planets_apply_to_particles_any_range(planets, &tile.view, mass_gained, 0, n);
+    }
+}
+
+void planets_apply_to_particles_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    const PlanetsApplyToParticlesTask* const task = (const PlanetsApplyToParticlesTask*)context;
+    float* const mass_gained = task->acc->planet_mass_gained[thread_index];
+    if (task->ps->storage_mode == PARTICLE_STORAGE_INT16)
+    {
+        planets_apply_to_particles_compact_range(task->planets, task->ps, mass_gained, begin, end);
+    }
+    else
+    {
+        planets_apply_to_particles_any_range(task->planets, task->ps, mass_gained, begin, end);
+    }
+}
+
+void planets_apply_to_particles(Planets* const planets, const Environment* const env, Particles* const ps, ThreadPool* const pool, WorkerAccumulators* const acc)
+{
+    if (planets->gravity_mode == PLANET_GRAVITY_DIRECT_SIMD)
+    {
+        planets_packed_update(&planets->packed, planets);
+    }
+    else if (planets->gravity_mode == PLANET_GRAVITY_BARNES_HUT)
+    {
+        planet_tree_build(&planets->tree, planets);
+    }
+    else if (planets->gravity_mode == PLANET_GRAVITY_FIELD_GRID && planets->dirty)
+    {
+        planet_tree_build(&planets->tree, planets);
+        planet_field_build(&planets->field, planets, pool);
+        planets->dirty = false;
+    }
+
+    worker_accumulators_grow_planets(acc, planets->n_max);
+    PlanetsApplyToParticlesTask task{planets, ps, acc};
+    thread_pool_run(pool, planets_apply_to_particles_task, &task, ps->n_active, PARTICLE_CHUNK_SIZE);
+
+    // Reduce mass absorbed from particles by each planet
+    for (int t = 0; t < acc->n_threads; ++t)
+    {
+        float* const mass_gained = acc->planet_mass_gained[t];
+        for (int p = 0; p < planets->n_active; ++p)
+        {
+            (planets->properties + p)->mass += mass_gained[p];
+            planets->dirty = planets->dirty || (mass_gained[p] > 0.f);
+        }
+        std::memset(mass_gained, 0, sizeof(float) * planets->n_active);
+    }
+}
+
+// Sleeping particles are woken within the distance from a spawned or moved planet at which it pulls at least this many
+// times as hard as gravity, up to PARTICLE_WAKE_RADIUS_MAX (and within the max around planets which moved away)
+static const float PARTICLE_WAKE_PULL_RATIO = 1.f;
+static const float PARTICLE_WAKE_RADIUS_MAX = 0.5f;
+
+inline float particles_wake_radius(const Environment* const env, const float planet_mass)
+{
+    const float gravity = std::sqrt(vec2_length_squared(&env->gravity));
+    return std::fmin(PARTICLE_WAKE_RADIUS_MAX, planet_mass / (PARTICLE_WAKE_PULL_RATIO * gravity + 1e-6f));
+}
+
+// Wakes sleeping particles near planets which spawned, moved or were removed since the last call, and all particles
+// if boundaries changed. Particles in contact with moving particles are woken by contacts instead.
+void particles_wake_on_changes(Particles* const ps, const Environment* const env, Planets* const planets)
+{
+    if (env->revision != ps->environment_revision)
+    {
+        particles_wake_all(ps);
+        ps->environment_revision = env->revision;
+    }
+
+    const int n_planets = imax(planets->n_active, planets->n_wake_positions);
+    for (int p = 0; p < n_planets; ++p)
+    {
+        const bool spawned = (p >= planets->n_wake_positions);
+        const bool removed = (p >= planets->n_active);
+        if (!spawned && !removed && planets->wake_positions[p].x == planets->positions[p].x && planets->wake_positions[p].y == planets->positions[p].y)
+        {
+            continue;
+        }
+
+        if (!spawned)
+        {
+            particles_wake_near(ps, planets->wake_positions[p], PARTICLE_WAKE_RADIUS_MAX);
+        }
+        if (!removed)
+        {
+            particles_wake_near(ps, planets->positions[p], particles_wake_radius(env, (planets->properties + p)->mass));
+            planets->wake_positions[p] = planets->positions[p];
+        }
+    }
+    planets->n_wake_positions = planets->n_active;
+}
+
+struct PlanetKernelBenchmark
+{
+    int n_particles;
+    double scalar_ms;
+    double simd_ms;
+
+    // Largest difference in pull between kernels, relative to the largest scalar pull
+    float max_relative_error;
+
+    // Particles killed by one kernel but not the other
+    int n_death_mismatches;
+};
+
+// Times the scalar and SIMD direct kernels (on a single thread, best of repeats) on n_particles particles spread
+// over the play area, pulled by the current planets
+void planets_benchmark_kernels(PlanetKernelBenchmark* const result, Planets* const planets, const int n_particles, const int repeats)
+{
+    using BenchmarkClock = std::chrono::steady_clock;
+    using MillisecondsDelta = std::chrono::duration<double, std::milli>;
+
+    Particles ps;
+    particles_initialize(&ps, n_particles);
+    for (int i = 0; i < n_particles; ++i)
+    {
+        Vec2 position;
+        vec2_set_random_uniform_scaled(&position, BOUNDARY_LIMIT);
+        particles_spawn_at(&ps, position);
+    }
+
+    Vec2Array scalar_forces;
+    vec2_array_initialize(&scalar_forces, n_particles);
+    const int n_alive_words = bitset_word_count(n_particles);
+    std::uint64_t* const scalar_alive = (std::uint64_t*)std::malloc(sizeof(std::uint64_t) * n_alive_words);
+    float* const mass_gained = (float*)std::malloc(sizeof(float) * planets->n_max);
+
+    planets_packed_update(&planets->packed, planets);
+
+    result->n_particles = n_particles;
+    result->scalar_ms = 0.0;
+    result->simd_ms = 0.0;
+    for (int kernel = 0; kernel < 2; ++kernel)
+    {
+        double* const best_ms = (kernel == 0) ? &result->scalar_ms : &result->simd_ms;
+        for (int r = 0; r < repeats; ++r)
+        {
+            const Vec2 zero{0.f, 0.f};
+            vec2_array_set_n(&ps.forces, &zero, n_particles);
+            bitset_set_range(ps.alive, 0, n_particles);
+            std::memset(mass_gained, 0, sizeof(float) * planets->n_max);
+
+            const BenchmarkClock::time_point start = BenchmarkClock::now();
+            if (kernel == 0)
+            {
+                planets_apply_to_particles_range(planets, &ps, mass_gained, 0, n_particles);
+            }
+            else
+            {
+                planets_apply_to_particles_simd_range(planets, &ps, mass_gained, 0, n_particles);
+            }
+            const double ms = MillisecondsDelta{BenchmarkClock::now() - start}.count();
+            *best_ms = (r == 0) ? ms : std::fmin(*best_ms, ms);
+        }
+
+        if (kernel == 0)
+        {
+            vec2_array_copy_n(&scalar_forces, &ps.forces, n_particles);
+            std::memcpy(scalar_alive, ps.alive, sizeof(std::uint64_t) * n_alive_words);
+        }
+    }
+
+    // Compare the last SIMD run against the last scalar run
+    float max_force = 0.f;
+    float max_error = 0.f;
+    result->n_death_mismatches = 0;
+    for (int i = 0; i < n_particles; ++i)
+    {
+        if (bitset_get(scalar_alive, i) != bitset_get(ps.alive, i))
+        {
+            ++result->n_death_mismatches;
+        }
+        else if (bitset_get(scalar_alive, i))
+        {
+            max_force = std::fmax(max_force, std::fmax(std::abs(scalar_forces.x[i]), std::abs(scalar_forces.y[i])));
+            max_error = std::fmax(max_error, std::fmax(std::abs(scalar_forces.x[i] - ps.forces.x[i]), std::abs(scalar_forces.y[i] - ps.forces.y[i])));
+        }
+    }
+    result->max_relative_error = (max_force > 0.f) ? (max_error / max_force) : 0.f;
+
+    std::free(mass_gained);
+    std::free(scalar_alive);
+    vec2_array_destroy(&scalar_forces);
+    particles_destroy(&ps);
+}
+
+struct ParticleStorageAccuracy
+{
+    int n_particles;
+    int n_ticks;
+
+    // Largest and RMS differences between compact and float storage runs, over particles alive in both
+    float position_max_error;
+    float position_rms_error;
+    float velocity_max_error;
+    float velocity_rms_error;
+
+    // Particles killed or captured in one run but not the other
+    int n_alive_mismatches;
+};
+
+// Steps copies of particles n_ticks times in float and in compact storage (on a single thread, with planet pull, but
+// without contacts or sand, and without changing planets or env), from the same start state (as exactly represented
+// in compact storage), and compares the results. Planet data used by the gravity mode must be up to date.
+void particles_measure_storage_accuracy(
+    ParticleStorageAccuracy* const result,
+    const Particles* const source,
+    const Environment* const env,
+    const Planets* const planets,
+    const int n_ticks,
+    const float dt)
+{
+    const int n = source->n_active;
+    const int n_padded = simd_padded_count(n);
+    const int n_alive_words = bitset_word_count(n_padded);
+
+    Particles runs[PARTICLE_STORAGE_MODE_COUNT];
+    EnvironmentBoundaryProperties* const boundary_hits = (EnvironmentBoundaryProperties*)std::malloc(sizeof(EnvironmentBoundaryProperties) * env->n_max);
+    std::memset(boundary_hits, 0, sizeof(EnvironmentBoundaryProperties) * env->n_max);
+    float* const mass_gained = (float*)std::malloc(sizeof(float) * imax(1, planets->n_max));
+    ZoneHistogram zones;
+    zone_histogram_initialize(&zones, 1, 1, 1);
+
+    for (int mode = 0; mode < PARTICLE_STORAGE_MODE_COUNT; ++mode)
+    {
+        Particles* const ps = runs + mode;
+        particles_initialize(ps, imax(1, n));
+        ps->n_active = n;
+        ps->max_velocity = source->max_velocity;
+        ps->collision_mode = source->collision_mode;
+        ps->max_bounces = source->max_bounces;
+        std::memcpy(ps->alive, source->alive, sizeof(std::uint64_t) * n_alive_words);
+        vec2_array_copy_n(&ps->forces, &source->forces, n_padded);
+
+        // Start from the compact state in both runs
+        ps->storage_mode = PARTICLE_STORAGE_INT16;
+        if (source->storage_mode == PARTICLE_STORAGE_INT16)
+        {
+            std::memcpy(ps->compact_positions.x, source->compact_positions.x, sizeof(std::int16_t) * n_padded);
+            std::memcpy(ps->compact_positions.y, source->compact_positions.y, sizeof(std::int16_t) * n_padded);
+            std::memcpy(ps->compact_velocities.x, source->compact_velocities.x, sizeof(std::int16_t) * n_padded);
+            std::memcpy(ps->compact_velocities.y, source->compact_velocities.y, sizeof(std::int16_t) * n_padded);
+        }
+        else
+        {
+            vec2_array_copy_n(&ps->positions, &source->positions, n_padded);
+            vec2_array_copy_n(&ps->velocities, &source->velocities, n_padded);
+            particles_encode_states(ps);
+        }
+        particles_set_storage_mode(ps, (ParticleStorageMode)mode);
+
+        for (int tick = 0; tick < n_ticks; ++tick)
+        {
+            // Same phases as a simulation tick, minus the optional ones; dead particles stay in place
+            std::memset(mass_gained, 0, sizeof(float) * imax(1, planets->n_max));
+            if (mode == PARTICLE_STORAGE_INT16)
+            {
+                planets_apply_to_particles_compact_range(planets, ps, mass_gained, 0, n);
+                const Vec2ArrayI16 positions_previous = ps->compact_positions_previous;
+                ps->compact_positions_previous = ps->compact_positions;
+                ps->compact_positions = positions_previous;
+                int captured = 0;
+                particles_step_compact_range(ps, env, boundary_hits, &captured, &zones, zones.thread_counts, 0, n, dt);
+            }
+            else
+            {
+                planets_apply_to_particles_any_range(planets, ps, mass_gained, 0, n);
+                const Vec2Array positions_previous = ps->positions_previous;
+                ps->positions_previous = ps->positions;
+                ps->positions = positions_previous;
+                int captured = 0;
+                particles_step_range(ps, env, boundary_hits, &captured, &zones, zones.thread_counts, 0, n, dt);
+            }
+        }
+    }
+
+    // Compare the compact run, decoded, against the float run
+    const Particles* const reference = runs + PARTICLE_STORAGE_FLOAT;
+    Particles* const compact = runs + PARTICLE_STORAGE_INT16;
+    particles_decode_states(compact);
+
+    double position_error_sq_sum = 0.0;
+    double velocity_error_sq_sum = 0.0;
+    int n_compared = 0;
+    result->n_particles = n;
+    result->n_ticks = n_ticks;
+    result->position_max_error = 0.f;
+    result->velocity_max_error = 0.f;
+    result->n_alive_mismatches = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        if (bitset_get(reference->alive, i) != bitset_get(compact->alive, i))
+        {
+            ++result->n_alive_mismatches;
+        }
+        else if (bitset_get(reference->alive, i))
+        {
+            Vec2 position_delta{reference->positions.x[i] - compact->positions.x[i], reference->positions.y[i] - compact->positions.y[i]};
+            Vec2 velocity_delta{reference->velocities.x[i] - compact->velocities.x[i], reference->velocities.y[i] - compact->velocities.y[i]};
+            const float position_error_sq = vec2_length_squared(&position_delta);
+            const float velocity_error_sq = vec2_length_squared(&velocity_delta);
+            result->position_max_error = std::fmax(result->position_max_error, std::sqrt(position_error_sq));
+            result->velocity_max_error = std::fmax(result->velocity_max_error, std::sqrt(velocity_error_sq));
+            position_error_sq_sum += position_error_sq;
+            velocity_error_sq_sum += velocity_error_sq;
+            ++n_compared;
+        }
+    }
+    result->position_rms_error = (n_compared > 0) ? (float)std::sqrt(position_error_sq_sum / n_compared) : 0.f;
+    result->velocity_rms_error = (n_compared > 0) ? (float)std::sqrt(velocity_error_sq_sum / n_compared) : 0.f;
+
+    zone_histogram_destroy(&zones);
+    std::free(mass_gained);
+    std::free(boundary_hits);
+    for (int mode = 0; mode < PARTICLE_STORAGE_MODE_COUNT; ++mode)
+    {
+        particles_destroy(runs + mode);
+    }
+}
+
+void planets_clear(Planets* const planets)
+{
+    planets->n_active = 0;
+    planets->dirty = true;
+}
+
+void planets_destroy(Planets* const planets)
+{
+    // Tree and field storage is in the arena too
+    memory_arena_destroy(&planets->arena);
+}
+
+// Falling sand
+//
+// Settled sand lives on a grid over the play area as a cellular automaton, rather than as particles. Each cell holds
+// one material; grains fall down (or diagonally down) into empty cells. The grid is split into chunks, and each chunk
+// only updates the rectangle of cells around last tick's changes, so resting sand costs nothing to simulate.
+
+enum SandMaterial
+{
+    SAND_EMPTY,
+    SAND_GRAIN,
+    SAND_SOLID, // Rasterized environment boundaries
+};
+
+// Grains which move during an update are flagged with SAND_CELL_MOVED, so that a grain which falls into a chunk that is
+// updated later in the same tick doesn't move twice; flags are cleared once the update is done
+static const std::uint8_t SAND_CELL_MATERIAL_MASK = 0x7F;
+static const std::uint8_t SAND_CELL_MOVED = 0x80;
+
+// Cells per side of each chunk
+static const int SAND_CHUNK_SIZE = 64;
+
+// Particles slower than this, which rest on a boundary or on grains, turn into grains; any particle which lands in a
+// grain turns into a grain too (see sand_grid_find_settle_cell)
+static const float SAND_SETTLE_SPEED = 0.05f;
+
+// Boundaries are rasterized about one cell thick, but particles resting on them may be in a solid cell
+static const int SAND_SETTLE_SOLID_CELLS = 2;
+
+// Grains turn back into particles wherever a planet pulls on them SAND_RELEASE_PULL_RATIO times harder than gravity,
+// out to at most SAND_RELEASE_RADIUS_MAX from the planet
+static const float SAND_RELEASE_PULL_RATIO = 40.f;
+static const float SAND_RELEASE_RADIUS_MAX = 0.25f;
+
+// Inclusive rectangle of cells, which is empty when x_min > x_max
+struct SandRect
+{
+    int x_min;
+    int y_min;
+    int x_max;
+    int y_max;
+};
+
+inline SandRect sand_rect_empty()
+{
+    return SandRect{1 << 30, 1 << 30, -(1 << 30), -(1 << 30)};
+}
+
+inline bool sand_rect_is_empty(const SandRect* const rect)
+{
+    return rect->x_min > rect->x_max || rect->y_min > rect->y_max;
+}
+
+inline void sand_rect_add(SandRect* const rect, const int x_min, const int y_min, const int x_max, const int y_max)
+{
+    rect->x_min = imin(rect->x_min, x_min);
+    rect->y_min = imin(rect->y_min, y_min);
+    rect->x_max = imax(rect->x_max, x_max);
+    rect->y_max = imax(rect->y_max, y_max);
+}
+
+inline void sand_rect_add_intersection(SandRect* const rect, const SandRect* const lhs, const SandRect* const rhs)
+{
+    const SandRect overlap{
+        imax(lhs->x_min, rhs->x_min),
+        imax(lhs->y_min, rhs->y_min),
+        imin(lhs->x_max, rhs->x_max),
+        imin(lhs->y_max, rhs->y_max)
+    };
+    if (!sand_rect_is_empty(&overlap))
+    {
+        sand_rect_add(rect, overlap.x_min, overlap.y_min, overlap.x_max, overlap.y_max);
+    }
+}
+
+struct SandChunk
+{
+    SandRect bounds;
+    SandRect active;  // Cells to update this tick
+    SandRect changed; // Cells around changes since the last update; may spill one cell into neighbouring chunks
+};
+
+struct SandGrid
+{
+    MemoryArena arena; // Holds all of the arrays below
+    std::uint8_t* cells; // [cells_per_side * cells_per_side], row-major from the bottom left corner of the play area
+    int cells_per_side;
+    float cell_size;
+    float inv_cell_size;
+
+    SandChunk* chunks; // [chunks_per_side * chunks_per_side], row-major
+    int chunks_per_side;
+    int n_active_chunks;
+
+    // Active chunks of the checkerboard phase being updated
+    int* phase_chunks;
+    int n_phase_chunks;
+
+    // Bitset of particles which are to settle into grains, see sand_grid_exchange_particles; committed for the first
+    // n_settling_max particles
+    std::uint64_t* settling;
+    int n_settling_max;
+
+    unsigned tick;
+    bool enabled;
+};
+
+// The grid covers the play area with cells_per_side cells per side (e.g. one per pixel of window height), and exchanges
+// grains with particles in pools of up to particle_count particles (or N_PARTICLES_RESERVED, as for Particles)
+void sand_grid_initialize(SandGrid* const grid, const int cells_per_side, const int particle_count)
+{
+    grid->cells_per_side = cells_per_side;
+    grid->cell_size = 2.f / cells_per_side;
+    grid->inv_cell_size = cells_per_side / 2.f;
+    grid->chunks_per_side = (cells_per_side + SAND_CHUNK_SIZE - 1) / SAND_CHUNK_SIZE;
+
+    const std::size_t cell_bytes = sizeof(std::uint8_t) * cells_per_side * cells_per_side;
+    const int n_chunks = grid->chunks_per_side * grid->chunks_per_side;
+    const int n_settling_reserved = imax(particle_count, N_PARTICLES_RESERVED);
+    const std::size_t settling_bytes = sizeof(std::uint64_t) * bitset_word_count(simd_padded_count(n_settling_reserved));
+    memory_arena_initialize(
+        &grid->arena,
+        memory_arena_array_bytes(cell_bytes)
+            + memory_arena_array_bytes(sizeof(SandChunk) * n_chunks)
+            + memory_arena_array_bytes(sizeof(int) * n_chunks)
+            + memory_arena_array_bytes(settling_bytes)
+    );
+
+    grid->cells = (std::uint8_t*)memory_arena_reserve_array(&grid->arena, cell_bytes);
+    pool_array_commit(grid->cells, cell_bytes);
+    std::memset(grid->cells, SAND_EMPTY, cell_bytes);
+
+    grid->chunks = (SandChunk*)memory_arena_reserve_array(&grid->arena, sizeof(SandChunk) * n_chunks);
+    pool_array_commit(grid->chunks, sizeof(SandChunk) * n_chunks);
+    for (int c = 0; c < n_chunks; ++c)
+    {
+        SandChunk* const chunk = grid->chunks + c;
+        const int x_min = (c % grid->chunks_per_side) * SAND_CHUNK_SIZE;
+        const int y_min = (c / grid->chunks_per_side) * SAND_CHUNK_SIZE;
+        chunk->bounds = SandRect{x_min, y_min, imin(x_min + SAND_CHUNK_SIZE, cells_per_side) - 1, imin(y_min + SAND_CHUNK_SIZE, cells_per_side) - 1};
+        chunk->active = sand_rect_empty();
+        chunk->changed = sand_rect_empty();
+    }
+    grid->n_active_chunks = 0;
+
+    grid->phase_chunks = (int*)memory_arena_reserve_array(&grid->arena, sizeof(int) * n_chunks);
+    pool_array_commit(grid->phase_chunks, sizeof(int) * n_chunks);
+    grid->n_phase_chunks = 0;
+
+    grid->settling = (std::uint64_t*)memory_arena_reserve_array(&grid->arena, settling_bytes);
+    grid->n_settling_max = 0;
+
+    grid->tick = 0;
+    grid->enabled = false;
+}
+
+inline int sand_grid_cell_coord(const SandGrid* const grid, const float v)
+{
+    const int c = (int)((v + 1.f) * grid->inv_cell_size);
+    return imax(0, imin(grid->cells_per_side - 1, c));
+}
+
+inline Vec2 sand_grid_cell_center(const SandGrid* const grid, const int x, const int y)
+{
+    return Vec2{(x + 0.5f) * grid->cell_size - 1.f, (y + 0.5f) * grid->cell_size - 1.f};
+}
+
+inline std::uint8_t sand_grid_material(const SandGrid* const grid, const int x, const int y)
+{
+    return grid->cells[y * grid->cells_per_side + x] & SAND_CELL_MATERIAL_MASK;
+}
+
+// Marks the cells around (x, y) for update on the next tick
+inline void sand_grid_wake(SandGrid* const grid, const int x, const int y)
+{
+    const int chunk = (y / SAND_CHUNK_SIZE) * grid->chunks_per_side + (x / SAND_CHUNK_SIZE);
+    sand_rect_add(&(grid->chunks + chunk)->changed, x - 1, y - 1, x + 1, y + 1);
+}
+
+inline void sand_grid_set(SandGrid* const grid, const int x, const int y, const SandMaterial material)
+{
+    grid->cells[y * grid->cells_per_side + x] = (std::uint8_t)material;
+    sand_grid_wake(grid, x, y);
+}
+
+void sand_grid_wake_all(SandGrid* const grid)
+{
+    for (int c = 0; c < grid->chunks_per_side * grid->chunks_per_side; ++c)
+    {
+        (grid->chunks + c)->changed = (grid->chunks + c)->bounds;
+    }
+}
+
+// Replaces all solid cells with the current environment boundaries
+void sand_grid_rasterize_environment(SandGrid* const grid, const Environment* const env)
+{
+    const int n_cells = grid->cells_per_side * grid->cells_per_side;
+    for (int i = 0; i < n_cells; ++i)
+    {
+        grid->cells[i] = ((grid->cells[i] & SAND_CELL_MATERIAL_MASK) == SAND_SOLID) ? (std::uint8_t)SAND_EMPTY : grid->cells[i];
+    }
+
+    // Boundaries are walked in steps of half a cell, so that they are 8-connected; grains never move diagonally past a
+    // side neighbour, so this is enough to hold them
+    for (int l = 0; l < env->n_boundaries; ++l)
+    {
+        const Line* const line = env->boundaries + l;
+        const Vec2 delta = env->directions[l];
+        const int n_steps = 1 + (int)(2.f * std::sqrt(env->lengths_squared[l]) * grid->inv_cell_size);
+        for (int s = 0; s <= n_steps; ++s)
+        {
+            const float t = (float)s / n_steps;
+            const int x = sand_grid_cell_coord(grid, line->tail.x + t * delta.x);
+            const int y = sand_grid_cell_coord(grid, line->tail.y + t * delta.y);
+            grid->cells[y * grid->cells_per_side + x] = SAND_SOLID;
+        }
+    }
+
+    // Grains may have been resting on boundaries which are gone
+    sand_grid_wake_all(grid);
+}
+
+void sand_grid_clear_grains(SandGrid* const grid)
+{
+    const int n_cells = grid->cells_per_side * grid->cells_per_side;
+    for (int i = 0; i < n_cells; ++i)
+    {
+        grid->cells[i] = ((grid->cells[i] & SAND_CELL_MATERIAL_MASK) == SAND_GRAIN) ? (std::uint8_t)SAND_EMPTY : grid->cells[i];
+    }
+}
+
+int sand_grid_count_grains(const SandGrid* const grid)
+{
+    int count = 0;
+    const int n_cells = grid->cells_per_side * grid->cells_per_side;
+    for (int i = 0; i < n_cells; ++i)
+    {
+        count += ((grid->cells[i] & SAND_CELL_MATERIAL_MASK) == SAND_GRAIN);
+    }
+    return count;
+}
+
+// Moves grains in the active cells of a chunk one cell down, or diagonally down. Rows are swept bottom up, in
+// alternating directions on alternating ticks so that piles don't lean. Grains may move one cell into neighbouring
+// chunks; chunks in the same checkerboard phase are a chunk apart, so they never touch the same cells.
+void sand_grid_update_chunk(SandGrid* const grid, SandChunk* const chunk)
+{
+    const SandRect active = chunk->active;
+    const int n = grid->cells_per_side;
+    const bool leftwards = (grid->tick & 1) != 0;
+    std::uint8_t* const cells = grid->cells;
+
+    for (int y = imax(active.y_min, 1); y <= active.y_max; ++y)
+    {
+        for (int k = 0; k <= active.x_max - active.x_min; ++k)
+        {
+            const int x = leftwards ? (active.x_max - k) : (active.x_min + k);
+            std::uint8_t* const cell = cells + y * n + x;
+            if (*cell != SAND_GRAIN)
+            {
+                continue;
+            }
+
+            std::uint8_t* target = cell - n;
+            if (*target != SAND_EMPTY)
+            {
+                // Slide diagonally, trying an alternating side first; a grain never squeezes between two cells
+                const int d = ((x + y + grid->tick) & 1) ? 1 : -1;
+                if (x + d >= 0 && x + d < n && cell[d] == SAND_EMPTY && cell[d - n] == SAND_EMPTY)
+                {
+                    target = cell + d - n;
+                }
+                else if (x - d >= 0 && x - d < n && cell[-d] == SAND_EMPTY && cell[-d - n] == SAND_EMPTY)
+                {
+                    target = cell - d - n;
+                }
+                else
+                {
+                    continue;
+                }
+            }
+
+            *target = SAND_GRAIN | SAND_CELL_MOVED;
+            *cell = SAND_EMPTY;
+            sand_rect_add(&chunk->changed, x - 1, y - 1, x + 1, y + 1);
+        }
+    }
+}
+
+void sand_grid_update_chunks_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    SandGrid* const grid = (SandGrid*)context;
+    for (int i = begin; i < end; ++i)
+    {
+        sand_grid_update_chunk(grid, grid->chunks + grid->phase_chunks[i]);
+    }
+}
+
+// Runs one tick of the automaton, if enabled. Chunks are updated in four checkerboard phases (by chunk x and y parity),
+// in parallel within each phase.
+void sand_grid_update(SandGrid* const grid, ThreadPool* const pool)
+{
+    if (!grid->enabled)
+    {
+        return;
+    }
+
+    // Each chunk updates the cells changed (within its bounds) by itself or its neighbours
+    const int n_chunks_per_side = grid->chunks_per_side;
+    grid->n_active_chunks = 0;
+    for (int cy = 0; cy < n_chunks_per_side; ++cy)
+    {
+        for (int cx = 0; cx < n_chunks_per_side; ++cx)
+        {
+            SandChunk* const chunk = grid->chunks + cy * n_chunks_per_side + cx;
+            chunk->active = sand_rect_empty();
+            for (int ny = imax(cy - 1, 0); ny <= imin(cy + 1, n_chunks_per_side - 1); ++ny)
+            {
+                for (int nx = imax(cx - 1, 0); nx <= imin(cx + 1, n_chunks_per_side - 1); ++nx)
+                {
+                    sand_rect_add_intersection(&chunk->active, &chunk->bounds, &(grid->chunks + ny * n_chunks_per_side + nx)->changed);
+                }
+            }
+            grid->n_active_chunks += !sand_rect_is_empty(&chunk->active);
+        }
+    }
+    for (int c = 0; c < n_chunks_per_side * n_chunks_per_side; ++c)
+    {
+        (grid->chunks + c)->changed = sand_rect_empty();
+    }
+
+    for (int phase = 0; phase < 4; ++phase)
+    {
+        grid->n_phase_chunks = 0;
+        for (int cy = (phase >> 1); cy < n_chunks_per_side; cy += 2)
+        {
+            for (int cx = (phase & 1); cx < n_chunks_per_side; cx += 2)
+            {
+                const int c = cy * n_chunks_per_side + cx;
+                if (!sand_rect_is_empty(&(grid->chunks + c)->active))
+                {
+                    grid->phase_chunks[grid->n_phase_chunks++] = c;
+                }
+            }
+        }
+        thread_pool_run(pool, sand_grid_update_chunks_task, grid, grid->n_phase_chunks, 1);
+    }
+
+    // Moved grains are all within the changed rectangles
+    const int n = grid->cells_per_side;
+    for (int c = 0; c < n_chunks_per_side * n_chunks_per_side; ++c)
+    {
+        const SandRect* const changed = &(grid->chunks + c)->changed;
+        for (int y = imax(changed->y_min, 0); y <= imin(changed->y_max, n - 1); ++y)
+        {
+            for (int x = imax(changed->x_min, 0); x <= imin(changed->x_max, n - 1); ++x)
+            {
+                grid->cells[y * n + x] &= SAND_CELL_MATERIAL_MASK;
+            }
+        }
+    }
+
+    ++grid->tick;
+}
+
+// Empty cell at or above (x, y) for a settling particle, going up through at most SAND_SETTLE_SOLID_CELLS solid cells
+// (the boundary the particle rests on) and then through any number of grains (the pile the particle landed in).
+// Returns the cell's y, or -1 if there is none.
+inline int sand_grid_find_settle_cell(const SandGrid* const grid, const int x, int y)
+{
+    const int n = grid->cells_per_side;
+    const int y_solid_end = imin(y + SAND_SETTLE_SOLID_CELLS, n);
+    while (y < y_solid_end && sand_grid_material(grid, x, y) == SAND_SOLID)
+    {
+        ++y;
+    }
+    while (y < n && sand_grid_material(grid, x, y) == SAND_GRAIN)
+    {
+        ++y;
+    }
+    return (y < n && sand_grid_material(grid, x, y) == SAND_EMPTY) ? y : -1;
+}
+
+// Distance from a planet within which grains are released as particles
+inline float sand_release_radius(const Environment* const env, const float planet_mass)
+{
+    const float gravity = std::sqrt(vec2_length_squared(&env->gravity));
+    return std::fmin(SAND_RELEASE_RADIUS_MAX, planet_mass / (SAND_RELEASE_PULL_RATIO * gravity + 1e-6f));
+}
+
+inline bool sand_is_released_at(const Environment* const env, const Planets* const planets, const Vec2* const position)
+{
+    for (int p = 0; p < planets->n_active; ++p)
+    {
+        const Vec2 delta = vec2_sub(position, planets->positions + p);
+        const float radius = sand_release_radius(env, (planets->properties + p)->mass);
+        if (vec2_length_squared(&delta) < radius * radius)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct SandExchangeTask
+{
+    SandGrid* grid;
+    const Particles* ps;
+};
+
+// Flags particles [begin, end) which have come to rest on boundaries or grains, or which have landed in grains, in
+// SandGrid::settling; chunks of particles own whole bitset words (see PARTICLE_CHUNK_SIZE)
+void sand_grid_flag_settling_task(void* const context, const int begin, const int end, const int thread_index)
+{
+    SandGrid* const grid = ((SandExchangeTask*)context)->grid;
+    const Particles* const ps = ((SandExchangeTask*)context)->ps;
+    const float settle_speed_sq = SAND_SETTLE_SPEED * SAND_SETTLE_SPEED;
+
+    // Whole words, so that no flags from a previous exchange with more particles are left past end
+    bitset_clear_range(grid->settling, begin, bitset_word_count(end) * BITSET_WORD_BITS);
+    for (int i = begin; i < end; ++i)
+    {
+        const int x = sand_grid_cell_coord(grid, ps->positions.x[i]);
+        const int y = sand_grid_cell_coord(grid, ps->positions.y[i]);
+        const std::uint8_t material = sand_grid_material(grid, x, y);
+        const float speed_sq = ps->velocities.x[i] * ps->velocities.x[i] + ps->velocities.y[i] * ps->velocities.y[i];
+        const bool resting = speed_sq < settle_speed_sq && (material != SAND_EMPTY || (y > 0 && sand_grid_material(grid, x, y - 1) != SAND_EMPTY));
+        if ((material == SAND_GRAIN || resting) && bitset_get(ps->alive, i))
+        {
+            bitset_set(grid->settling, i);
+        }
+    }
+}
+
+// Turns particles which have come to rest on boundaries or grains (or which have landed in grains) into grains, and
+// grains near planets back into particles, if the grid is enabled. Converted particles are killed, and removed by the
+// next prune. Settling particles are found in parallel, and then placed one at a time.
+void sand_grid_exchange_particles(SandGrid* const grid, const Environment* const env, Particles* const ps, const Planets* const planets, ThreadPool* const pool)
+{
+    if (!grid->enabled)
+    {
+        return;
+    }
+
+    // Settling is decided on float states
+    if (ps->storage_mode == PARTICLE_STORAGE_INT16)
+    {
+        particles_decode_states(ps);
+    }
+
+    // Keep up with particle pool growth
+    if (ps->n_max > grid->n_settling_max)
+    {
+        pool_array_commit(grid->settling, sizeof(std::uint64_t) * bitset_word_count(simd_padded_count(ps->n_max)));
+        grid->n_settling_max = ps->n_max;
+    }
+
+    SandExchangeTask task{grid, ps};
+    thread_pool_run(pool, sand_grid_flag_settling_task, &task, ps->n_active, PARTICLE_CHUNK_SIZE);
+
+    const int n = grid->cells_per_side;
+    const int n_words = bitset_word_count(ps->n_active);
+    for (int w = 0; w < n_words; ++w)
+    {
+        for (std::uint64_t bits = grid->settling[w]; bits != 0; bits &= bits - 1)
+        {
+            const int i = w * BITSET_WORD_BITS + bitset_word_lowest_set(bits);
+            const int x = sand_grid_cell_coord(grid, ps->positions.x[i]);
+            const int y = sand_grid_cell_coord(grid, ps->positions.y[i]);
+
+            // Particles against walls are in the wall's column, so neighbouring columns are tried too
+            int settle_x = -1;
+            int settle_y = -1;
+            for (int dx = 0; dx <= 2 && settle_y < 0; ++dx)
+            {
+                settle_x = x + ((dx == 2) ? -1 : dx);
+                settle_y = (settle_x >= 0 && settle_x < n) ? sand_grid_find_settle_cell(grid, settle_x, y) : -1;
+            }
+            if (settle_y < 0)
+            {
+                continue;
+            }
+
+            const Vec2 position = sand_grid_cell_center(grid, settle_x, settle_y);
+            if (sand_is_released_at(env, planets, &position))
+            {
+                continue;
+            }
+
+            sand_grid_set(grid, settle_x, settle_y, SAND_GRAIN);
+            bitset_clear(ps->alive, i);
+        }
+    }
+
+    for (int p = 0; p < planets->n_active; ++p)
+    {
+        const Vec2 center = planets->positions[p];
+        const float radius = sand_release_radius(env, (planets->properties + p)->mass);
+        const int x_min = sand_grid_cell_coord(grid, center.x - radius);
+        const int x_max = sand_grid_cell_coord(grid, center.x + radius);
+        const int y_min = sand_grid_cell_coord(grid, center.y - radius);
+        const int y_max = sand_grid_cell_coord(grid, center.y + radius);
+        for (int y = y_min; y <= y_max; ++y)
+        {
+            for (int x = x_min; x <= x_max; ++x)
+            {
+                if (sand_grid_material(grid, x, y) != SAND_GRAIN)
+                {
+                    continue;
+                }
+
+                const Vec2 position = sand_grid_cell_center(grid, x, y);
+                const Vec2 delta = vec2_sub(&position, &center);
+                if (vec2_length_squared(&delta) >= radius * radius || !particles_grow(ps, ps->n_active + 1))
+                {
+                    continue;
+                }
+
+                sand_grid_set(grid, x, y, SAND_EMPTY);
+                particles_spawn_at(ps, position);
+            }
+        }
+    }
+}
+
+void sand_grid_destroy(SandGrid* const grid)
+{
+    memory_arena_destroy(&grid->arena);
+}
+
+// Size of the scratch arena for temporaries of a tick; the largest are the contact sort's, at 8 bytes per particle
+static const std::size_t SIMULATION_SCRATCH_BYTES = std::size_t(1) << 30;
+
+// Runs one fixed simulation tick, and counts particles in each zone of zones. Returns the number of particles captured
+// in the goal region. Temporaries are pushed onto scratch (see SIMULATION_SCRATCH_BYTES), and popped before returning.
+int simulation_tick(
+    Environment* const env,
+    Particles* const particles,
+    ParticleEmitters* const emitters,
+    Planets* const planets,
+    SandGrid* const sand,
+    ThreadPool* const pool,
+    WorkerAccumulators* const acc,
+    ZoneHistogram* const zones,
+    MemoryArena* const scratch,
+    const float dt)
+{
+    // Update/reset environment state
+    environment_update(env, dt);
+
+    // Settle resting particles into sand, and release sand near planets
+    sand_grid_exchange_particles(sand, env, particles, planets, pool);
+
+    // Prune dead particles
+    particles_prune_dead(particles);
+
+    // Spawn particles from emitters
+    particle_emitters_update(emitters, particles, scratch, dt);
+
+    // Wake sleeping particles disturbed by planets or boundaries
+    particles_wake_on_changes(particles, env, planets);
+
+    // Apply planet gravity to particles
+    planets_apply_to_particles(planets, env, particles, pool, acc);
+
+    // Push overlapping particles apart
+    particles_apply_contacts(particles, pool, scratch);
+
+    // Do planet update
+    planets_update(planets, dt);
+
+    // Do particle update, capturing particles in the goal region and counting particles in zones on the way
+    const int captured = particles_step(particles, env, pool, acc, zones, dt);
+
+    // Let sand fall
+    sand_grid_update(sand, pool);
+    return captured;
+}
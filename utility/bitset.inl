@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+// Packed bitsets: element i is bit (i % 64) of word (i / 64). Bits past the last element of the final word are
+// don't-cares for all of the helpers below.
+
+static const int BITSET_WORD_BITS = 64;
+
+static const std::uint64_t BITSET_WORD_ALL = ~std::uint64_t(0);
+
+
+inline int bitset_word_count(const int n)
+{
+    return (n + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+}
+
+inline int bitset_word_popcount(const std::uint64_t word)
+{
+#if defined(_MSC_VER)
+    return (int)__popcnt64(word);
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+// Index of the lowest set bit; word must be non-zero
+inline int bitset_word_lowest_set(const std::uint64_t word)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+// Bits [begin, end) of a single word, with 0 <= begin <= end <= 64
+inline std::uint64_t bitset_word_range(const int begin, const int end)
+{
+    const std::uint64_t below_end = (end >= BITSET_WORD_BITS) ? BITSET_WORD_ALL : ((std::uint64_t(1) << end) - 1);
+    return below_end & (BITSET_WORD_ALL << begin);
+}
+
+inline bool bitset_get(const std::uint64_t* const bits, const int i)
+{
+    return (bits[i / BITSET_WORD_BITS] >> (i % BITSET_WORD_BITS)) & 1;
+}
+
+inline void bitset_set(std::uint64_t* const bits, const int i)
+{
+    bits[i / BITSET_WORD_BITS] |= std::uint64_t(1) << (i % BITSET_WORD_BITS);
+}
+
+inline void bitset_clear(std::uint64_t* const bits, const int i)
+{
+    bits[i / BITSET_WORD_BITS] &= ~(std::uint64_t(1) << (i % BITSET_WORD_BITS));
+}
+
+// Sets (value = true) or clears bits [begin, end), touching partial words at either end only once
+inline void bitset_assign_range(std::uint64_t* const bits, const int begin, const int end, const bool value)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+
+    const int first_word = begin / BITSET_WORD_BITS;
+    const int last_word = (end - 1) / BITSET_WORD_BITS;
+    for (int w = first_word; w <= last_word; ++w)
+    {
+        const int word_begin = (w == first_word) ? (begin % BITSET_WORD_BITS) : 0;
+        const int word_end = (w == last_word) ? (end - w * BITSET_WORD_BITS) : BITSET_WORD_BITS;
+        const std::uint64_t range = bitset_word_range(word_begin, word_end);
+        bits[w] = value ? (bits[w] | range) : (bits[w] & ~range);
+    }
+}
+
+inline void bitset_set_range(std::uint64_t* const bits, const int begin, const int end)
+{
+    bitset_assign_range(bits, begin, end, true);
+}
+
+inline void bitset_clear_range(std::uint64_t* const bits, const int begin, const int end)
+{
+    bitset_assign_range(bits, begin, end, false);
+}
+
+// Index of the first clear bit in [begin, n), or n if they are all set
+inline int bitset_find_next_clear(const std::uint64_t* const bits, const int begin, const int n)
+{
+    if (begin >= n)
+    {
+        return n;
+    }
+
+    int w = begin / BITSET_WORD_BITS;
+    std::uint64_t clear = ~bits[w] & (BITSET_WORD_ALL << (begin % BITSET_WORD_BITS));
+    const int last_word = (n - 1) / BITSET_WORD_BITS;
+    while (clear == 0 && w < last_word)
+    {
+        clear = ~bits[++w];
+    }
+    if (clear == 0)
+    {
+        return n;
+    }
+
+    const int i = w * BITSET_WORD_BITS + bitset_word_lowest_set(clear);
+    return (i < n) ? i : n;
+}
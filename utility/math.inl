@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
@@ -86,6 +87,63 @@ inline void vec2_copy_n(Vec2* const dst, const Vec2* const src, const int n)
     std::memcpy(dst, src, sizeof(Vec2) * n);
 }
 
+// Structure-of-arrays storage for many Vec2s; x and y components live in separate arrays
+struct Vec2Array
+{
+    float* x;
+    float* y;
+};
+
+// View of the same arrays starting at element offset
+inline Vec2Array vec2_array_offset(const Vec2Array* const array, const int offset)
+{
+    return Vec2Array{array->x + offset, array->y + offset};
+}
+
+// Same as Vec2Array, with components stored as int16 fixed point (see simd_decode_i16_n)
+struct Vec2ArrayI16
+{
+    std::int16_t* x;
+    std::int16_t* y;
+};
+
+inline Vec2 vec2_array_get(const Vec2Array* const array, const int i)
+{
+    return Vec2{array->x[i], array->y[i]};
+}
+
+inline void vec2_array_set(Vec2Array* const array, const int i, const Vec2* const value)
+{
+    array->x[i] = value->x;
+    array->y[i] = value->y;
+}
+
+inline void vec2_array_set_zero(Vec2Array* const array, const int i)
+{
+    array->x[i] = 0.f;
+    array->y[i] = 0.f;
+}
+
+inline void vec2_array_set_n(Vec2Array* const dst, const Vec2* const set_value, const int n)
+{
+    const float x = set_value->x;
+    const float y = set_value->y;
+    for (int i = 0; i < n; ++i)
+    {
+        dst->x[i] = x;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        dst->y[i] = y;
+    }
+}
+
+inline void vec2_array_copy_n(Vec2Array* const dst, const Vec2Array* const src, const int n)
+{
+    std::memcpy(dst->x, src->x, sizeof(float) * n);
+    std::memcpy(dst->y, src->y, sizeof(float) * n);
+}
+
 inline void vec2_set_random_uniform_unit(Vec2* const dst)
 {
     #define MAX_RAND_I 10000
@@ -118,7 +176,7 @@ inline Vec2 vec2_lerp(const Vec2* const lhs, const Vec2* const rhs, const float
     return Vec2{lhs->x * alpha + rhs->x * beta, lhs->y * alpha + rhs->y * beta};
 }
 
-inline float vec2_length_squared(Vec2* const src)
+inline float vec2_length_squared(const Vec2* const src)
 {
     return vec2_dot(src, src);
 }
@@ -135,7 +193,7 @@ inline float vec2_dist_squared(Vec2* const lhs, Vec2* const rhs)
     return dx * dx + dy * dy;
 }
 
-inline float vec2_near(Vec2* const lhs, Vec2* const rhs, const float tol)
+inline float vec2_near(const Vec2* const lhs, const Vec2* const rhs, const float tol)
 {
     const float dx = lhs->x - rhs->x;
     const float dy = lhs->y - rhs->y;
@@ -176,16 +234,17 @@ inline float vec2_cross_product(const Vec2* const lhs, const Vec2* const rhs)
     return (lhs->x * rhs->y) - (lhs->y * rhs->x);
 }
 
-inline bool vec2_segment_segment_intercept(
-    Vec2* intercept,
+// Checks if segments p -> p_head and q -> q_head (given as its direction s = q_head - q, e.g. cached) cross, and if so
+// gives the fraction t along p -> p_head at which they do
+inline bool vec2_segment_direction_intercept_param(
+    float* t_out,
     const Vec2* const p,
     const Vec2* const p_head,
     const Vec2* const q,
-    const Vec2* const q_head)
+    const Vec2* const s)
 {
     const Vec2 r{p_head->x - p->x, p_head->y - p->y};
-    const Vec2 s{q_head->x - q->x, q_head->y - q->y};
-    const float r_cross_s = vec2_cross_product(&r, &s);
+    const float r_cross_s = vec2_cross_product(&r, s);
 
     // Parallel case
     if (std::abs(r_cross_s) > 0.f)
@@ -193,13 +252,12 @@ inline bool vec2_segment_segment_intercept(
       const Vec2 q_m_p{q->x - p->x, q->y - p->y};
       const float q_m_p_cross_r = vec2_cross_product(&q_m_p, &r);
       const float u = q_m_p_cross_r / r_cross_s;
-      const float t = vec2_cross_product(&q_m_p, &s) / r_cross_s;
+      const float t = vec2_cross_product(&q_m_p, s) / r_cross_s;
 
       // Intersection on segment
       if (0 <= u && u <= 1 && 0 <= t && t <= 1)
       {
-          intercept->x = p->x + t * r.x;
-          intercept->y = p->y + t * r.y;
+          *t_out = t;
           return true;
       }
     }
@@ -208,30 +266,46 @@ inline bool vec2_segment_segment_intercept(
     return false;
 }
 
-inline bool vec2_segment_segment_intercept_check(
+// Same as vec2_segment_direction_intercept_param, but gives the point at which the segments cross
+inline bool vec2_segment_direction_intercept(
+    Vec2* intercept,
     const Vec2* const p,
     const Vec2* const p_head,
     const Vec2* const q,
-    const Vec2* const q_head)
+    const Vec2* const s)
 {
-    const Vec2 r{p_head->x - p->x, p_head->y - p->y};
-    const Vec2 s{q_head->x - q->x, q_head->y - q->y};
-    const float r_cross_s = vec2_cross_product(&r, &s);
-
-    // Parallel case
-    if (std::abs(r_cross_s) > 0.f)
+    float t;
+    if (vec2_segment_direction_intercept_param(&t, p, p_head, q, s))
     {
-      const Vec2 q_m_p{q->x - p->x, q->y - p->y};
-      const float q_m_p_cross_r = vec2_cross_product(&q_m_p, &r);
-      const float u = q_m_p_cross_r / r_cross_s;
-      const float t = vec2_cross_product(&q_m_p, &s) / r_cross_s;
-      return 0 <= u && u <= 1 && 0 <= t && t <= 1;
+        intercept->x = p->x + t * (p_head->x - p->x);
+        intercept->y = p->y + t * (p_head->y - p->y);
+        return true;
     }
-
-    // Intersection off segment
     return false;
 }
 
+inline bool vec2_segment_segment_intercept(
+    Vec2* intercept,
+    const Vec2* const p,
+    const Vec2* const p_head,
+    const Vec2* const q,
+    const Vec2* const q_head)
+{
+    const Vec2 s{q_head->x - q->x, q_head->y - q->y};
+    return vec2_segment_direction_intercept(intercept, p, p_head, q, &s);
+}
+
+inline bool vec2_segment_segment_intercept_check(
+    const Vec2* const p,
+    const Vec2* const p_head,
+    const Vec2* const q,
+    const Vec2* const q_head)
+{
+    const Vec2 s{q_head->x - q->x, q_head->y - q->y};
+    float t;
+    return vec2_segment_direction_intercept_param(&t, p, p_head, q, &s);
+}
+
 inline bool vec2_within_aabb(const Vec2* const top, const Vec2* const bot, const Vec2* const point, const float tolerance)
 {
     const float min_x = std::fmin(top->x, bot->x);
@@ -325,4 +399,32 @@ inline bool aabb_within(const AABB* const aabb, const Vec2* const point)
            (point->y > aabb->min_corner.y) &&
            (point->x < aabb->max_corner.x) &&
            (point->y < aabb->max_corner.y);
-}
\ No newline at end of file
+}
+
+inline bool aabb_overlaps(const AABB* const lhs, const AABB* const rhs)
+{
+    return (lhs->min_corner.x <= rhs->max_corner.x) &&
+           (lhs->min_corner.y <= rhs->max_corner.y) &&
+           (rhs->min_corner.x <= lhs->max_corner.x) &&
+           (rhs->min_corner.y <= lhs->max_corner.y);
+}
+
+// Checks if a line segment touches an AABB (separating axis test over the AABB axes and the line normal)
+inline bool aabb_intersects_segment(const AABB* const aabb, const Line* const line)
+{
+    const AABB line_aabb = aabb_create(line->tail, line->head);
+    if (!aabb_overlaps(aabb, &line_aabb))
+    {
+        return false;
+    }
+
+    // Box corners must not all be strictly on one side of the line
+    const float nx = -(line->head.y - line->tail.y);
+    const float ny = line->head.x - line->tail.x;
+    const float d0 = nx * (aabb->min_corner.x - line->tail.x) + ny * (aabb->min_corner.y - line->tail.y);
+    const float d1 = nx * (aabb->max_corner.x - line->tail.x) + ny * (aabb->min_corner.y - line->tail.y);
+    const float d2 = nx * (aabb->min_corner.x - line->tail.x) + ny * (aabb->max_corner.y - line->tail.y);
+    const float d3 = nx * (aabb->max_corner.x - line->tail.x) + ny * (aabb->max_corner.y - line->tail.y);
+    return !((d0 > 0.f && d1 > 0.f && d2 > 0.f && d3 > 0.f) ||
+             (d0 < 0.f && d1 < 0.f && d2 < 0.f && d3 < 0.f));
+}
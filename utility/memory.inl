@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(PLATFORM_WINDOWS)
+#include <malloc.h>
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "math.inl"
+
+
+// Alignment of all SIMD-friendly buffers (one cache line, which also covers 512-bit vectors)
+static const int SIMD_ALIGNMENT_BYTES = 64;
+
+// Number of floats in one SIMD_ALIGNMENT_BYTES block; arrays are padded to a multiple of this
+static const int SIMD_PADDING_FLOATS = SIMD_ALIGNMENT_BYTES / sizeof(float);
+
+
+inline int simd_padded_count(const int n)
+{
+    return ((n + SIMD_PADDING_FLOATS - 1) / SIMD_PADDING_FLOATS) * SIMD_PADDING_FLOATS;
+}
+
+inline void* aligned_malloc(const std::size_t bytes)
+{
+    // Size must be a multiple of the alignment for std::aligned_alloc
+    const std::size_t padded_bytes = ((bytes + SIMD_ALIGNMENT_BYTES - 1) / SIMD_ALIGNMENT_BYTES) * SIMD_ALIGNMENT_BYTES;
+#if defined(PLATFORM_WINDOWS)
+    return _aligned_malloc(padded_bytes, SIMD_ALIGNMENT_BYTES);
+#else
+    return std::aligned_alloc(SIMD_ALIGNMENT_BYTES, padded_bytes);
+#endif
+}
+
+inline void aligned_free(void* const ptr)
+{
+#if defined(PLATFORM_WINDOWS)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+// Allocates x and y arrays for at least n elements, padded to the SIMD width, and zeroes them
+inline void vec2_array_initialize(Vec2Array* const array, const int n)
+{
+    const int n_padded = simd_padded_count(n);
+    array->x = (float*)aligned_malloc(sizeof(float) * n_padded);
+    array->y = (float*)aligned_malloc(sizeof(float) * n_padded);
+    std::memset(array->x, 0, sizeof(float) * n_padded);
+    std::memset(array->y, 0, sizeof(float) * n_padded);
+}
+
+inline void vec2_array_destroy(Vec2Array* const array)
+{
+    aligned_free(array->x);
+    aligned_free(array->y);
+}
+
+// Virtual memory: address space is reserved without backing memory, and committed (readable and writable, and zeroed)
+// separately. Committed memory only takes physical memory once it is touched.
+
+inline void* virtual_reserve(const std::size_t bytes)
+{
+#if defined(PLATFORM_WINDOWS)
+    return VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void* const mapping = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return (mapping == MAP_FAILED) ? nullptr : mapping;
+#endif
+}
+
+// Commits the pages covering [ptr, ptr + bytes); committing already committed pages keeps their contents
+inline bool virtual_commit(void* const ptr, const std::size_t bytes)
+{
+#if defined(PLATFORM_WINDOWS)
+    return VirtualAlloc(ptr, bytes, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+    return mprotect(ptr, bytes, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+// Releases a whole reservation, given the pointer and size it was reserved with
+inline void virtual_release(void* const ptr, const std::size_t bytes)
+{
+#if defined(PLATFORM_WINDOWS)
+    (void)bytes;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, bytes);
+#endif
+}
+
+inline std::size_t round_up_bytes(const std::size_t bytes, const std::size_t alignment)
+{
+    return ((bytes + alignment - 1) / alignment) * alignment;
+}
+
+// Growable pool arrays
+//
+// A pool array reserves address space for its largest size up front, and commits memory only as the pool grows, so it
+// never moves and growth never copies. A header in front of the array (one alignment block, so the array stays
+// aligned) holds the reserved size, and the granularity of commits.
+
+struct PoolArrayHeader
+{
+    std::size_t reserved_bytes;
+    std::size_t commit_granularity;
+};
+
+static const std::size_t POOL_ARRAY_HEADER_BYTES = SIMD_ALIGNMENT_BYTES;
+static_assert(sizeof(PoolArrayHeader) <= POOL_ARRAY_HEADER_BYTES, "pool array header must fit before the array");
+
+inline PoolArrayHeader* pool_array_header(const void* const array)
+{
+    return (PoolArrayHeader*)((char*)array - POOL_ARRAY_HEADER_BYTES);
+}
+
+// Sets up a pool array at the start of an already reserved block of POOL_ARRAY_HEADER_BYTES + bytes
+inline void* pool_array_place(char* const block, const std::size_t bytes, const std::size_t commit_granularity)
+{
+    if (block == nullptr || !virtual_commit(block, POOL_ARRAY_HEADER_BYTES))
+    {
+        return nullptr;
+    }
+    ((PoolArrayHeader*)block)->reserved_bytes = bytes;
+    ((PoolArrayHeader*)block)->commit_granularity = commit_granularity;
+    return block + POOL_ARRAY_HEADER_BYTES;
+}
+
+// Reserves a pool array of up to bytes in its own reservation, with nothing committed; returns nullptr on failure.
+// See memory_arena_reserve_array for pool arrays which share one reservation.
+inline void* pool_array_reserve(const std::size_t bytes)
+{
+    return pool_array_place((char*)virtual_reserve(POOL_ARRAY_HEADER_BYTES + bytes), bytes, 1);
+}
+
+// Commits the first bytes of a pool array, which read as zero until written. Already committed memory is kept as is,
+// so this only ever grows the array. Returns false if bytes exceeds the reservation, or memory could not be committed.
+inline bool pool_array_commit(void* const array, const std::size_t bytes)
+{
+    const PoolArrayHeader* const header = pool_array_header(array);
+    if (bytes > header->reserved_bytes)
+    {
+        return false;
+    }
+    const std::size_t committed_bytes = round_up_bytes(POOL_ARRAY_HEADER_BYTES + bytes, header->commit_granularity);
+    return virtual_commit((char*)header, std::min(committed_bytes, POOL_ARRAY_HEADER_BYTES + header->reserved_bytes));
+}
+
+// Number of elements a pool array holding current elements should grow to, to hold at least requested elements: current
+// if that is already enough, otherwise at least double it (to amortize growth), up to reserved. Returns -1 if requested
+// is more than reserved. Capacities start at 0, so callers grow when the result is more than current.
+inline int pool_grow_count(const int current, const int requested, const int reserved)
+{
+    if (requested <= current)
+    {
+        return current;
+    }
+    else if (requested > reserved)
+    {
+        return -1;
+    }
+    return std::min(reserved, std::max(requested, 2 * current));
+}
+
+// Releases a pool array from pool_array_reserve; arrays in an arena are released along with it
+inline void pool_array_release(void* const array)
+{
+    if (array == nullptr)
+    {
+        return;
+    }
+    virtual_release(pool_array_header(array), POOL_ARRAY_HEADER_BYTES + pool_array_header(array)->reserved_bytes);
+}
+
+// Memory arenas
+//
+// An arena is a single reservation, used either for pool arrays or for scratch memory:
+//
+//  - memory_arena_reserve_array lays out pool arrays one after another, each starting on a MEMORY_ARENA_ALIGNMENT
+//    boundary and committed in multiples of it. With SNAD_HUGE_PAGES, the arena is backed by transparent huge pages
+//    (where the OS supports them), so each array's committed memory can be mapped with few TLB entries.
+//  - memory_arena_push hands out temporaries (aligned to SIMD_ALIGNMENT_BYTES, and not zeroed) from a stack, which
+//    memory_arena_pop_to unwinds. Memory stays committed once pushed, so steady-state use makes no system calls.
+//
+// Arenas are not thread-safe.
+
+#if defined(SNAD_HUGE_PAGES)
+static const std::size_t MEMORY_ARENA_ALIGNMENT = std::size_t(2) << 20;
+#else
+static const std::size_t MEMORY_ARENA_ALIGNMENT = std::size_t(4) << 10;
+#endif
+
+struct MemoryArena
+{
+    char* base;                    // Aligned to MEMORY_ARENA_ALIGNMENT
+    std::size_t n_bytes_reserved;  // From base
+    std::size_t n_bytes_used;
+    std::size_t n_bytes_committed; // Scratch use only
+    void* reservation;             // Including padding for alignment
+    std::size_t n_reservation_bytes;
+};
+
+// Arena bytes taken by a pool array of up to bytes
+inline std::size_t memory_arena_array_bytes(const std::size_t bytes)
+{
+    return round_up_bytes(POOL_ARRAY_HEADER_BYTES + bytes, MEMORY_ARENA_ALIGNMENT);
+}
+
+inline void memory_arena_initialize(MemoryArena* const arena, const std::size_t bytes)
+{
+    arena->n_bytes_reserved = round_up_bytes(bytes, MEMORY_ARENA_ALIGNMENT);
+    arena->n_bytes_used = 0;
+    arena->n_bytes_committed = 0;
+    arena->n_reservation_bytes = arena->n_bytes_reserved + MEMORY_ARENA_ALIGNMENT;
+    arena->reservation = virtual_reserve(arena->n_reservation_bytes);
+    if (arena->reservation == nullptr)
+    {
+        arena->base = nullptr;
+        arena->n_bytes_reserved = 0;
+        return;
+    }
+    arena->base = (char*)round_up_bytes((std::size_t)arena->reservation, MEMORY_ARENA_ALIGNMENT);
+#if defined(SNAD_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+    madvise(arena->base, arena->n_bytes_reserved, MADV_HUGEPAGE);
+#endif
+}
+
+inline void memory_arena_destroy(MemoryArena* const arena)
+{
+    if (arena->reservation != nullptr)
+    {
+        virtual_release(arena->reservation, arena->n_reservation_bytes);
+    }
+}
+
+// Reserves a pool array of up to bytes in the arena (see pool_array_commit); returns nullptr if the arena is full
+inline void* memory_arena_reserve_array(MemoryArena* const arena, const std::size_t bytes)
+{
+    const std::size_t n_bytes = memory_arena_array_bytes(bytes);
+    if (arena->n_bytes_used + n_bytes > arena->n_bytes_reserved)
+    {
+        return nullptr;
+    }
+    char* const block = arena->base + arena->n_bytes_used;
+    arena->n_bytes_used += n_bytes;
+    return pool_array_place(block, n_bytes - POOL_ARRAY_HEADER_BYTES, MEMORY_ARENA_ALIGNMENT);
+}
+
+// Pushes bytes of scratch memory; returns nullptr if the arena is full
+inline void* memory_arena_push(MemoryArena* const arena, const std::size_t bytes)
+{
+    const std::size_t offset = round_up_bytes(arena->n_bytes_used, SIMD_ALIGNMENT_BYTES);
+    if (offset + bytes > arena->n_bytes_reserved)
+    {
+        return nullptr;
+    }
+    else if (offset + bytes > arena->n_bytes_committed)
+    {
+        const std::size_t n_bytes_committed = std::min(arena->n_bytes_reserved, round_up_bytes(offset + bytes, MEMORY_ARENA_ALIGNMENT));
+        if (!virtual_commit(arena->base, n_bytes_committed))
+        {
+            return nullptr;
+        }
+        arena->n_bytes_committed = n_bytes_committed;
+    }
+    arena->n_bytes_used = offset + bytes;
+    return arena->base + offset;
+}
+
+// Position of the top of the scratch stack, for memory_arena_pop_to
+inline std::size_t memory_arena_mark(const MemoryArena* const arena)
+{
+    return arena->n_bytes_used;
+}
+
+// Frees everything pushed since mark was taken
+inline void memory_arena_pop_to(MemoryArena* const arena, const std::size_t mark)
+{
+    arena->n_bytes_used = mark;
+}
+
+// Reserves x and y pool arrays for up to n elements (padded to the SIMD width) in arena, or in their own reservations
+// if arena is nullptr
+inline void vec2_array_reserve(Vec2Array* const array, MemoryArena* const arena, const int n)
+{
+    const std::size_t bytes = sizeof(float) * simd_padded_count(n);
+    array->x = (float*)((arena != nullptr) ? memory_arena_reserve_array(arena, bytes) : pool_array_reserve(bytes));
+    array->y = (float*)((arena != nullptr) ? memory_arena_reserve_array(arena, bytes) : pool_array_reserve(bytes));
+}
+
+// Commits the first n elements (padded to the SIMD width) of a reserved array
+inline bool vec2_array_commit(Vec2Array* const array, const int n)
+{
+    const int n_padded = simd_padded_count(n);
+    const bool x_committed = pool_array_commit(array->x, sizeof(float) * n_padded);
+    const bool y_committed = pool_array_commit(array->y, sizeof(float) * n_padded);
+    return x_committed && y_committed;
+}
+
+// Releases an array reserved without an arena
+inline void vec2_array_release(Vec2Array* const array)
+{
+    pool_array_release(array->x);
+    pool_array_release(array->y);
+}
+
+// Same as vec2_array_reserve, for int16 components
+inline void vec2_array_i16_reserve(Vec2ArrayI16* const array, MemoryArena* const arena, const int n)
+{
+    const std::size_t bytes = sizeof(std::int16_t) * simd_padded_count(n);
+    array->x = (std::int16_t*)((arena != nullptr) ? memory_arena_reserve_array(arena, bytes) : pool_array_reserve(bytes));
+    array->y = (std::int16_t*)((arena != nullptr) ? memory_arena_reserve_array(arena, bytes) : pool_array_reserve(bytes));
+}
+
+inline bool vec2_array_i16_commit(Vec2ArrayI16* const array, const int n)
+{
+    const int n_padded = simd_padded_count(n);
+    const bool x_committed = pool_array_commit(array->x, sizeof(std::int16_t) * n_padded);
+    const bool y_committed = pool_array_commit(array->y, sizeof(std::int16_t) * n_padded);
+    return x_committed && y_committed;
+}
+
+inline void vec2_array_i16_release(Vec2ArrayI16* const array)
+{
+    pool_array_release(array->x);
+    pool_array_release(array->y);
+}
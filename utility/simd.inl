@@ -0,0 +1,448 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "bitset.inl"
+
+// Picks the widest available instruction set at compile time. SSE2 is always available on x86-64; wider
+// paths need to be enabled explicitly (see SIMD option in Makefile). Define SNAD_NO_SIMD to force the
+// scalar fallback.
+#if !defined(SNAD_NO_SIMD) && defined(__AVX512F__)
+    #define SNAD_SIMD_AVX512
+    #include <immintrin.h>
+#elif !defined(SNAD_NO_SIMD) && defined(__AVX2__)
+    #define SNAD_SIMD_AVX2
+    #include <immintrin.h>
+#elif !defined(SNAD_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+    #define SNAD_SIMD_SSE2
+    #include <emmintrin.h>
+#else
+    #define SNAD_SIMD_SCALAR
+#endif
+
+
+// Each path defines simd_f32 (SIMD_F32_WIDTH floats) and simd_mask (one flag per lane, from comparisons)
+#if defined(SNAD_SIMD_AVX512)
+
+static const int SIMD_F32_WIDTH = 16;
+static const char* const SIMD_NAME = "AVX-512";
+typedef __m512 simd_f32;
+
+inline simd_f32 simd_f32_load(const float* const src) { return _mm512_load_ps(src); }
+inline simd_f32 simd_f32_loadu(const float* const src) { return _mm512_loadu_ps(src); }
+inline void simd_f32_store(float* const dst, const simd_f32 v) { _mm512_store_ps(dst, v); }
+inline simd_f32 simd_f32_set1(const float v) { return _mm512_set1_ps(v); }
+inline simd_f32 simd_f32_add(const simd_f32 lhs, const simd_f32 rhs) { return _mm512_add_ps(lhs, rhs); }
+inline simd_f32 simd_f32_sub(const simd_f32 lhs, const simd_f32 rhs) { return _mm512_sub_ps(lhs, rhs); }
+inline simd_f32 simd_f32_mul(const simd_f32 lhs, const simd_f32 rhs) { return _mm512_mul_ps(lhs, rhs); }
+inline simd_f32 simd_f32_min(const simd_f32 lhs, const simd_f32 rhs) { return _mm512_min_ps(lhs, rhs); }
+inline simd_f32 simd_f32_max(const simd_f32 lhs, const simd_f32 rhs) { return _mm512_max_ps(lhs, rhs); }
+inline simd_f32 simd_f32_mul_add(const simd_f32 a, const simd_f32 b, const simd_f32 c) { return _mm512_fmadd_ps(a, b, c); }
+inline simd_f32 simd_f32_div(const simd_f32 lhs, const simd_f32 rhs) { return _mm512_div_ps(lhs, rhs); }
+inline simd_f32 simd_f32_sqrt(const simd_f32 v) { return _mm512_sqrt_ps(v); }
+inline float simd_f32_reduce_add(const simd_f32 v) { return _mm512_reduce_add_ps(v); }
+inline float simd_f32_reduce_min(const simd_f32 v) { return _mm512_reduce_min_ps(v); }
+inline simd_f32 simd_f32_copysign(const simd_f32 magnitude, const simd_f32 sign)
+{
+    const __m512i sign_bit = _mm512_set1_epi32(0x80000000);
+    return _mm512_castsi512_ps(_mm512_or_si512(_mm512_andnot_si512(sign_bit, _mm512_castps_si512(magnitude)),
+                                               _mm512_and_si512(sign_bit, _mm512_castps_si512(sign))));
+}
+
+typedef __mmask16 simd_mask;
+
+inline simd_mask simd_f32_lt(const simd_f32 lhs, const simd_f32 rhs) { return _mm512_cmp_ps_mask(lhs, rhs, _CMP_LT_OQ); }
+inline simd_mask simd_f32_le(const simd_f32 lhs, const simd_f32 rhs) { return _mm512_cmp_ps_mask(lhs, rhs, _CMP_LE_OQ); }
+inline simd_f32 simd_f32_select(const simd_mask mask, const simd_f32 if_true, const simd_f32 if_false) { return _mm512_mask_blend_ps(mask, if_false, if_true); }
+inline simd_mask simd_mask_and(const simd_mask lhs, const simd_mask rhs) { return lhs & rhs; }
+inline simd_mask simd_mask_or(const simd_mask lhs, const simd_mask rhs) { return lhs | rhs; }
+inline simd_mask simd_mask_and_not(const simd_mask lhs, const simd_mask rhs) { return lhs & ~rhs; }
+inline bool simd_mask_any(const simd_mask mask) { return mask != 0; }
+
+// int16 lanes, widened to floats; and floats rounded to the nearest int16, saturating
+inline simd_f32 simd_f32_load_i16(const std::int16_t* const src) { return _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_load_si256((const __m256i*)src))); }
+inline void simd_f32_store_i16(std::int16_t* const dst, const simd_f32 v) { _mm256_store_si256((__m256i*)dst, _mm512_cvtsepi32_epi16(_mm512_cvtps_epi32(v))); }
+
+#elif defined(SNAD_SIMD_AVX2)
+
+static const int SIMD_F32_WIDTH = 8;
+static const char* const SIMD_NAME = "AVX2";
+typedef __m256 simd_f32;
+
+inline simd_f32 simd_f32_load(const float* const src) { return _mm256_load_ps(src); }
+inline simd_f32 simd_f32_loadu(const float* const src) { return _mm256_loadu_ps(src); }
+inline void simd_f32_store(float* const dst, const simd_f32 v) { _mm256_store_ps(dst, v); }
+inline simd_f32 simd_f32_set1(const float v) { return _mm256_set1_ps(v); }
+inline simd_f32 simd_f32_add(const simd_f32 lhs, const simd_f32 rhs) { return _mm256_add_ps(lhs, rhs); }
+inline simd_f32 simd_f32_sub(const simd_f32 lhs, const simd_f32 rhs) { return _mm256_sub_ps(lhs, rhs); }
+inline simd_f32 simd_f32_mul(const simd_f32 lhs, const simd_f32 rhs) { return _mm256_mul_ps(lhs, rhs); }
+inline simd_f32 simd_f32_min(const simd_f32 lhs, const simd_f32 rhs) { return _mm256_min_ps(lhs, rhs); }
+inline simd_f32 simd_f32_max(const simd_f32 lhs, const simd_f32 rhs) { return _mm256_max_ps(lhs, rhs); }
+#if defined(__FMA__)
+inline simd_f32 simd_f32_mul_add(const simd_f32 a, const simd_f32 b, const simd_f32 c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+inline simd_f32 simd_f32_mul_add(const simd_f32 a, const simd_f32 b, const simd_f32 c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+inline simd_f32 simd_f32_div(const simd_f32 lhs, const simd_f32 rhs) { return _mm256_div_ps(lhs, rhs); }
+inline simd_f32 simd_f32_sqrt(const simd_f32 v) { return _mm256_sqrt_ps(v); }
+inline float simd_f32_reduce_add(const simd_f32 v)
+{
+    const __m128 quad = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 pair = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+    return _mm_cvtss_f32(_mm_add_ss(pair, _mm_shuffle_ps(pair, pair, 1)));
+}
+inline float simd_f32_reduce_min(const simd_f32 v)
+{
+    const __m128 quad = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 pair = _mm_min_ps(quad, _mm_movehl_ps(quad, quad));
+    return _mm_cvtss_f32(_mm_min_ss(pair, _mm_shuffle_ps(pair, pair, 1)));
+}
+inline simd_f32 simd_f32_copysign(const simd_f32 magnitude, const simd_f32 sign)
+{
+    const __m256 sign_bit = _mm256_set1_ps(-0.f);
+    return _mm256_or_ps(_mm256_andnot_ps(sign_bit, magnitude), _mm256_and_ps(sign_bit, sign));
+}
+
+typedef __m256 simd_mask;
+
+inline simd_mask simd_f32_lt(const simd_f32 lhs, const simd_f32 rhs) { return _mm256_cmp_ps(lhs, rhs, _CMP_LT_OQ); }
+inline simd_mask simd_f32_le(const simd_f32 lhs, const simd_f32 rhs) { return _mm256_cmp_ps(lhs, rhs, _CMP_LE_OQ); }
+inline simd_f32 simd_f32_select(const simd_mask mask, const simd_f32 if_true, const simd_f32 if_false) { return _mm256_blendv_ps(if_false, if_true, mask); }
+inline simd_mask simd_mask_and(const simd_mask lhs, const simd_mask rhs) { return _mm256_and_ps(lhs, rhs); }
+inline simd_mask simd_mask_or(const simd_mask lhs, const simd_mask rhs) { return _mm256_or_ps(lhs, rhs); }
+inline simd_mask simd_mask_and_not(const simd_mask lhs, const simd_mask rhs) { return _mm256_andnot_ps(rhs, lhs); }
+inline bool simd_mask_any(const simd_mask mask) { return _mm256_movemask_ps(mask) != 0; }
+
+inline simd_f32 simd_f32_load_i16(const std::int16_t* const src) { return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_load_si128((const __m128i*)src))); }
+inline void simd_f32_store_i16(std::int16_t* const dst, const simd_f32 v)
+{
+    const __m256i v_i32 = _mm256_cvtps_epi32(v);
+    _mm_store_si128((__m128i*)dst, _mm_packs_epi32(_mm256_castsi256_si128(v_i32), _mm256_extracti128_si256(v_i32, 1)));
+}
+
+#elif defined(SNAD_SIMD_SSE2)
+
+static const int SIMD_F32_WIDTH = 4;
+static const char* const SIMD_NAME = "SSE2";
+typedef __m128 simd_f32;
+
+inline simd_f32 simd_f32_load(const float* const src) { return _mm_load_ps(src); }
+inline simd_f32 simd_f32_loadu(const float* const src) { return _mm_loadu_ps(src); }
+inline void simd_f32_store(float* const dst, const simd_f32 v) { _mm_store_ps(dst, v); }
+inline simd_f32 simd_f32_set1(const float v) { return _mm_set1_ps(v); }
+inline simd_f32 simd_f32_add(const simd_f32 lhs, const simd_f32 rhs) { return _mm_add_ps(lhs, rhs); }
+inline simd_f32 simd_f32_sub(const simd_f32 lhs, const simd_f32 rhs) { return _mm_sub_ps(lhs, rhs); }
+inline simd_f32 simd_f32_mul(const simd_f32 lhs, const simd_f32 rhs) { return _mm_mul_ps(lhs, rhs); }
+inline simd_f32 simd_f32_min(const simd_f32 lhs, const simd_f32 rhs) { return _mm_min_ps(lhs, rhs); }
+inline simd_f32 simd_f32_max(const simd_f32 lhs, const simd_f32 rhs) { return _mm_max_ps(lhs, rhs); }
+inline simd_f32 simd_f32_mul_add(const simd_f32 a, const simd_f32 b, const simd_f32 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+inline simd_f32 simd_f32_div(const simd_f32 lhs, const simd_f32 rhs) { return _mm_div_ps(lhs, rhs); }
+inline simd_f32 simd_f32_sqrt(const simd_f32 v) { return _mm_sqrt_ps(v); }
+inline float simd_f32_reduce_add(const simd_f32 v)
+{
+    const __m128 pair = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(pair, _mm_shuffle_ps(pair, pair, 1)));
+}
+inline float simd_f32_reduce_min(const simd_f32 v)
+{
+    const __m128 pair = _mm_min_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_min_ss(pair, _mm_shuffle_ps(pair, pair, 1)));
+}
+inline simd_f32 simd_f32_copysign(const simd_f32 magnitude, const simd_f32 sign)
+{
+    const __m128 sign_bit = _mm_set1_ps(-0.f);
+    return _mm_or_ps(_mm_andnot_ps(sign_bit, magnitude), _mm_and_ps(sign_bit, sign));
+}
+
+typedef __m128 simd_mask;
+
+inline simd_mask simd_f32_lt(const simd_f32 lhs, const simd_f32 rhs) { return _mm_cmplt_ps(lhs, rhs); }
+inline simd_mask simd_f32_le(const simd_f32 lhs, const simd_f32 rhs) { return _mm_cmple_ps(lhs, rhs); }
+inline simd_f32 simd_f32_select(const simd_mask mask, const simd_f32 if_true, const simd_f32 if_false) { return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false)); }
+inline simd_mask simd_mask_and(const simd_mask lhs, const simd_mask rhs) { return _mm_and_ps(lhs, rhs); }
+inline simd_mask simd_mask_or(const simd_mask lhs, const simd_mask rhs) { return _mm_or_ps(lhs, rhs); }
+inline simd_mask simd_mask_and_not(const simd_mask lhs, const simd_mask rhs) { return _mm_andnot_ps(rhs, lhs); }
+inline bool simd_mask_any(const simd_mask mask) { return _mm_movemask_ps(mask) != 0; }
+
+inline simd_f32 simd_f32_load_i16(const std::int16_t* const src)
+{
+    // Sign-extend by placing each int16 in the upper half of its lane
+    const __m128i v_i16 = _mm_loadl_epi64((const __m128i*)src);
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v_i16, v_i16), 16));
+}
+inline void simd_f32_store_i16(std::int16_t* const dst, const simd_f32 v)
+{
+    const __m128i v_i32 = _mm_cvtps_epi32(v);
+    _mm_storel_epi64((__m128i*)dst, _mm_packs_epi32(v_i32, v_i32));
+}
+
+#else
+
+static const int SIMD_F32_WIDTH = 1;
+static const char* const SIMD_NAME = "scalar";
+typedef float simd_f32;
+
+inline simd_f32 simd_f32_load(const float* const src) { return *src; }
+inline simd_f32 simd_f32_loadu(const float* const src) { return *src; }
+inline void simd_f32_store(float* const dst, const simd_f32 v) { *dst = v; }
+inline simd_f32 simd_f32_set1(const float v) { return v; }
+inline simd_f32 simd_f32_add(const simd_f32 lhs, const simd_f32 rhs) { return lhs + rhs; }
+inline simd_f32 simd_f32_sub(const simd_f32 lhs, const simd_f32 rhs) { return lhs - rhs; }
+inline simd_f32 simd_f32_mul(const simd_f32 lhs, const simd_f32 rhs) { return lhs * rhs; }
+inline simd_f32 simd_f32_min(const simd_f32 lhs, const simd_f32 rhs) { return std::fmin(lhs, rhs); }
+inline simd_f32 simd_f32_max(const simd_f32 lhs, const simd_f32 rhs) { return std::fmax(lhs, rhs); }
+inline simd_f32 simd_f32_mul_add(const simd_f32 a, const simd_f32 b, const simd_f32 c) { return a * b + c; }
+inline simd_f32 simd_f32_div(const simd_f32 lhs, const simd_f32 rhs) { return lhs / rhs; }
+inline simd_f32 simd_f32_sqrt(const simd_f32 v) { return std::sqrt(v); }
+inline float simd_f32_reduce_add(const simd_f32 v) { return v; }
+inline float simd_f32_reduce_min(const simd_f32 v) { return v; }
+inline simd_f32 simd_f32_copysign(const simd_f32 magnitude, const simd_f32 sign) { return std::copysign(magnitude, sign); }
+
+typedef bool simd_mask;
+
+inline simd_mask simd_f32_lt(const simd_f32 lhs, const simd_f32 rhs) { return lhs < rhs; }
+inline simd_mask simd_f32_le(const simd_f32 lhs, const simd_f32 rhs) { return lhs <= rhs; }
+inline simd_f32 simd_f32_select(const simd_mask mask, const simd_f32 if_true, const simd_f32 if_false) { return mask ? if_true : if_false; }
+inline simd_mask simd_mask_and(const simd_mask lhs, const simd_mask rhs) { return lhs && rhs; }
+inline simd_mask simd_mask_or(const simd_mask lhs, const simd_mask rhs) { return lhs || rhs; }
+inline simd_mask simd_mask_and_not(const simd_mask lhs, const simd_mask rhs) { return lhs && !rhs; }
+inline bool simd_mask_any(const simd_mask mask) { return mask; }
+
+inline simd_f32 simd_f32_load_i16(const std::int16_t* const src) { return (float)*src; }
+inline void simd_f32_store_i16(std::int16_t* const dst, const simd_f32 v) { *dst = (std::int16_t)std::lrint(std::fmax(-32768.f, std::fmin(v, 32767.f))); }
+
+#endif
+
+// Lane l holds (float)l
+inline simd_f32 simd_f32_lane_indices()
+{
+    static const float LANE_INDICES[16] = {0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f};
+    return simd_f32_loadu(LANE_INDICES);
+}
+
+
+// Array kernels
+//
+// All arrays must be aligned to SIMD_ALIGNMENT_BYTES and n must be a multiple of SIMD_F32_WIDTH, which is
+// the case for anything allocated with vec2_array_initialize or vec2_array_reserve (see simd_padded_count)
+
+// v += a * dt, then x += v * dt
+inline void simd_integrate_n(float* const x, float* const v, const float* const a, const float dt, const int n)
+{
+    const simd_f32 dt_v = simd_f32_set1(dt);
+    for (int i = 0; i < n; i += SIMD_F32_WIDTH)
+    {
+        const simd_f32 v_next = simd_f32_mul_add(simd_f32_load(a + i), dt_v, simd_f32_load(v + i));
+        simd_f32_store(v + i, v_next);
+        simd_f32_store(x + i, simd_f32_mul_add(v_next, dt_v, simd_f32_load(x + i)));
+    }
+}
+
+// Same as simd_integrate_n, but integrates from x_previous into x (which may not alias)
+inline void simd_integrate_from_n(float* const x, const float* const x_previous, float* const v, const float* const a, const float dt, const int n)
+{
+    const simd_f32 dt_v = simd_f32_set1(dt);
+    for (int i = 0; i < n; i += SIMD_F32_WIDTH)
+    {
+        const simd_f32 v_next = simd_f32_mul_add(simd_f32_load(a + i), dt_v, simd_f32_load(v + i));
+        simd_f32_store(v + i, v_next);
+        simd_f32_store(x + i, simd_f32_mul_add(v_next, dt_v, simd_f32_load(x_previous + i)));
+    }
+}
+
+inline void simd_clamp_n(float* const x, const float vmin, const float vmax, const int n)
+{
+    const simd_f32 vmin_v = simd_f32_set1(vmin);
+    const simd_f32 vmax_v = simd_f32_set1(vmax);
+    for (int i = 0; i < n; i += SIMD_F32_WIDTH)
+    {
+        simd_f32_store(x + i, simd_f32_max(simd_f32_min(simd_f32_load(x + i), vmax_v), vmin_v));
+    }
+}
+
+inline void simd_fill_n(float* const x, const float value, const int n)
+{
+    const simd_f32 value_v = simd_f32_set1(value);
+    for (int i = 0; i < n; i += SIMD_F32_WIDTH)
+    {
+        simd_f32_store(x + i, value_v);
+    }
+}
+
+// dst = lhs + (rhs - lhs) * t
+inline void simd_lerp_n(float* const dst, const float* const lhs, const float* const rhs, const float t, const int n)
+{
+    const simd_f32 t_v = simd_f32_set1(t);
+    for (int i = 0; i < n; i += SIMD_F32_WIDTH)
+    {
+        const simd_f32 lhs_v = simd_f32_load(lhs + i);
+        simd_f32_store(dst + i, simd_f32_mul_add(simd_f32_sub(simd_f32_load(rhs + i), lhs_v), t_v, lhs_v));
+    }
+}
+
+
+// Conversions between floats and int16 fixed point, where an int16 q stands for q * scale. Values out of range
+// saturate; int16 arrays are allocated with vec2_array_i16_reserve.
+
+// dst = src * scale
+inline void simd_decode_i16_n(float* const dst, const std::int16_t* const src, const float scale, const int n)
+{
+    const simd_f32 scale_v = simd_f32_set1(scale);
+    for (int i = 0; i < n; i += SIMD_F32_WIDTH)
+    {
+        simd_f32_store(dst + i, simd_f32_mul(simd_f32_load_i16(src + i), scale_v));
+    }
+}
+
+// dst = src / scale, rounded to nearest
+inline void simd_encode_i16_n(std::int16_t* const dst, const float* const src, const float scale, const int n)
+{
+    const simd_f32 inv_scale_v = simd_f32_set1(1.f / scale);
+    for (int i = 0; i < n; i += SIMD_F32_WIDTH)
+    {
+        simd_f32_store_i16(dst + i, simd_f32_mul(simd_f32_load(src + i), inv_scale_v));
+    }
+}
+
+// Same as simd_lerp_n, on int16 values (with the same scale)
+inline void simd_lerp_i16_n(std::int16_t* const dst, const std::int16_t* const lhs, const std::int16_t* const rhs, const float t, const int n)
+{
+    const simd_f32 t_v = simd_f32_set1(t);
+    for (int i = 0; i < n; i += SIMD_F32_WIDTH)
+    {
+        const simd_f32 lhs_v = simd_f32_load_i16(lhs + i);
+        simd_f32_store_i16(dst + i, simd_f32_mul_add(simd_f32_sub(simd_f32_load_i16(rhs + i), lhs_v), t_v, lhs_v));
+    }
+}
+
+
+// Stream compaction
+//
+// Moves elements i of each of the n_arrays arrays for which bit i of the keep bitset is set to the front of the array
+// (in order, in place), all in a single pass over [0, n). Returns the number of elements kept. Arrays must be aligned
+// and padded as above.
+
+#if defined(SNAD_SIMD_AVX2)
+
+// Per 8-bit keep mask, lane indices which move kept lanes to the front
+struct SimdCompactTable
+{
+    alignas(32) int indices[256][8];
+};
+
+inline SimdCompactTable simd_compact_table_create()
+{
+    SimdCompactTable table;
+    for (int mask = 0; mask < 256; ++mask)
+    {
+        int n_kept = 0;
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            if (mask & (1 << lane))
+            {
+                table.indices[mask][n_kept++] = lane;
+            }
+        }
+        for (int lane = n_kept; lane < 8; ++lane)
+        {
+            table.indices[mask][lane] = 0;
+        }
+    }
+    return table;
+}
+
+inline const SimdCompactTable* simd_compact_table()
+{
+    static const SimdCompactTable table = simd_compact_table_create();
+    return &table;
+}
+
+#endif
+
+inline int simd_compact_n(float* const* const arrays, const int n_arrays, const std::uint64_t* const keep, const int n)
+{
+    // Everything before the first dropped element stays where it is; start from the word holding it
+    int i = bitset_find_next_clear(keep, 0, n) / BITSET_WORD_BITS * BITSET_WORD_BITS;
+    int n_kept = i;
+
+#if defined(SNAD_SIMD_AVX2)
+    const SimdCompactTable* const table = simd_compact_table();
+#endif
+
+    for (; i < n; i += BITSET_WORD_BITS)
+    {
+        const int word_size = (n - i < BITSET_WORD_BITS) ? (n - i) : BITSET_WORD_BITS;
+        const std::uint64_t word = keep[i / BITSET_WORD_BITS] & bitset_word_range(0, word_size);
+
+        // Nothing to move out of a fully dropped word
+        if (word == 0)
+        {
+            continue;
+        }
+
+#if defined(SNAD_SIMD_AVX512)
+        // Lanes past n are masked off, and loads stay inside the padding
+        for (int j = 0; j < word_size; j += 16)
+        {
+            const __mmask16 mask = (__mmask16)(word >> j);
+            for (int a = 0; a < n_arrays; ++a)
+            {
+                _mm512_mask_compressstoreu_ps(arrays[a] + n_kept, mask, _mm512_load_ps(arrays[a] + i + j));
+            }
+            n_kept += bitset_word_popcount(mask);
+        }
+#elif defined(SNAD_SIMD_AVX2)
+        for (int j = 0; j < word_size; j += 8)
+        {
+            const int mask = (int)(word >> j) & 0xFF;
+            const __m256i permutation = _mm256_load_si256((const __m256i*)table->indices[mask]);
+
+            // Full-width stores are fine: they never reach past elements which have already been loaded
+            for (int a = 0; a < n_arrays; ++a)
+            {
+                _mm256_storeu_ps(arrays[a] + n_kept, _mm256_permutevar8x32_ps(_mm256_load_ps(arrays[a] + i + j), permutation));
+            }
+            n_kept += bitset_word_popcount((std::uint64_t)mask);
+        }
+#else
+        // No lane permute on these paths; branch-free, since kept/dropped is unpredictable
+        for (int j = 0; j < word_size; ++j)
+        {
+            for (int a = 0; a < n_arrays; ++a)
+            {
+                arrays[a][n_kept] = arrays[a][i + j];
+            }
+            n_kept += (int)((word >> j) & 1);
+        }
+#endif
+    }
+    return n_kept;
+}
+
+// Same as simd_compact_n, for int16 arrays; there is no lane permute for these, so this is branch-free scalar code
+// on all paths
+inline int simd_compact_i16_n(std::int16_t* const* const arrays, const int n_arrays, const std::uint64_t* const keep, const int n)
+{
+    int i = bitset_find_next_clear(keep, 0, n) / BITSET_WORD_BITS * BITSET_WORD_BITS;
+    int n_kept = i;
+    for (; i < n; i += BITSET_WORD_BITS)
+    {
+        const int word_size = (n - i < BITSET_WORD_BITS) ? (n - i) : BITSET_WORD_BITS;
+        const std::uint64_t word = keep[i / BITSET_WORD_BITS] & bitset_word_range(0, word_size);
+        if (word == 0)
+        {
+            continue;
+        }
+
+        for (int j = 0; j < word_size; ++j)
+        {
+            for (int a = 0; a < n_arrays; ++a)
+            {
+                arrays[a][n_kept] = arrays[a][i + j];
+            }
+            n_kept += (int)((word >> j) & 1);
+        }
+    }
+    return n_kept;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+
+// Work function run over the item range [begin, end) by the thread with index thread_index, where
+// thread_index is in [0, thread_pool_thread_count(pool)). Index 0 is always the thread calling thread_pool_run.
+typedef void (*ThreadPoolTask)(void* context, int begin, int end, int thread_index);
+
+// Persistent set of worker threads which split an index range into chunks. Workers sleep between jobs.
+struct ThreadPool
+{
+    std::thread* workers;
+    int n_workers;
+
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+
+    // Current job
+    ThreadPoolTask task;
+    void* context;
+    int n_items;
+    int chunk_size;
+    std::atomic<int> next_chunk;
+    int n_workers_busy;
+    unsigned job_id;
+    bool shutdown;
+};
+
+inline int thread_pool_thread_count(const ThreadPool* const pool)
+{
+    return pool->n_workers + 1;
+}
+
+inline void thread_pool_work_on_job(ThreadPool* const pool, const int thread_index)
+{
+    const int n_chunks = (pool->n_items + pool->chunk_size - 1) / pool->chunk_size;
+    for (int chunk = pool->next_chunk.fetch_add(1); chunk < n_chunks; chunk = pool->next_chunk.fetch_add(1))
+    {
+        const int begin = chunk * pool->chunk_size;
+        const int end = (begin + pool->chunk_size < pool->n_items) ? (begin + pool->chunk_size) : pool->n_items;
+        pool->task(pool->context, begin, end, thread_index);
+    }
+}
+
+inline void thread_pool_worker_loop(ThreadPool* const pool, const int thread_index)
+{
+    unsigned last_job_id = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock{pool->mutex};
+            pool->work_ready.wait(lock, [pool, last_job_id] { return pool->shutdown || pool->job_id != last_job_id; });
+            if (pool->shutdown)
+            {
+                return;
+            }
+            last_job_id = pool->job_id;
+        }
+
+        thread_pool_work_on_job(pool, thread_index);
+
+        {
+            std::unique_lock<std::mutex> lock{pool->mutex};
+            if (--pool->n_workers_busy == 0)
+            {
+                pool->work_done.notify_one();
+            }
+        }
+    }
+}
+
+// Starts thread_count - 1 workers (the calling thread does work too); thread_count <= 0 uses all hardware threads
+inline void thread_pool_initialize(ThreadPool* const pool, const int thread_count)
+{
+    const int n_threads = (thread_count > 0) ? thread_count : (int)std::thread::hardware_concurrency();
+    pool->n_workers = (n_threads > 1) ? (n_threads - 1) : 0;
+    pool->task = nullptr;
+    pool->context = nullptr;
+    pool->n_items = 0;
+    pool->chunk_size = 1;
+    pool->next_chunk = 0;
+    pool->n_workers_busy = 0;
+    pool->job_id = 0;
+    pool->shutdown = false;
+
+    pool->workers = new std::thread[pool->n_workers];
+    for (int w = 0; w < pool->n_workers; ++w)
+    {
+        pool->workers[w] = std::thread{thread_pool_worker_loop, pool, w + 1};
+    }
+}
+
+// Runs task over [0, n_items) in chunks of chunk_size items, and blocks until all chunks are done
+inline void thread_pool_run(ThreadPool* const pool, ThreadPoolTask task, void* const context, const int n_items, const int chunk_size)
+{
+    if (n_items <= 0)
+    {
+        return;
+    }
+
+    // Not worth waking anybody up for a single chunk
+    if (pool->n_workers == 0 || n_items <= chunk_size)
+    {
+        task(context, 0, n_items, 0);
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock{pool->mutex};
+        pool->task = task;
+        pool->context = context;
+        pool->n_items = n_items;
+        pool->chunk_size = chunk_size;
+        pool->next_chunk = 0;
+        pool->n_workers_busy = pool->n_workers;
+        ++pool->job_id;
+    }
+    pool->work_ready.notify_all();
+
+    thread_pool_work_on_job(pool, 0);
+
+    std::unique_lock<std::mutex> lock{pool->mutex};
+    pool->work_done.wait(lock, [pool] { return pool->n_workers_busy == 0; });
+}
+
+inline void thread_pool_destroy(ThreadPool* const pool)
+{
+    {
+        std::unique_lock<std::mutex> lock{pool->mutex};
+        pool->shutdown = true;
+    }
+    pool->work_ready.notify_all();
+    for (int w = 0; w < pool->n_workers; ++w)
+    {
+        pool->workers[w].join();
+    }
+    delete[] pool->workers;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cmath>
+
+
+// Accumulates frame time and hands it out as whole fixed-size simulation ticks
+struct FixedTimestep
+{
+    // Simulation ticks per second
+    float tick_rate;
+
+    // Max ticks run per frame; time beyond that is dropped, so that slow frames can't snowball into slower ones
+    int max_substeps;
+
+    // Frame time not yet simulated, always less than one tick after fixed_timestep_advance
+    float accumulator;
+};
+
+inline void fixed_timestep_initialize(FixedTimestep* const timestep, const float tick_rate, const int max_substeps)
+{
+    timestep->tick_rate = tick_rate;
+    timestep->max_substeps = max_substeps;
+    timestep->accumulator = 0.f;
+}
+
+inline float fixed_timestep_dt(const FixedTimestep* const timestep)
+{
+    return 1.f / timestep->tick_rate;
+}
+
+// Adds frame_dt of elapsed time, and returns the number of ticks to run for this frame
+inline int fixed_timestep_advance(FixedTimestep* const timestep, const float frame_dt)
+{
+    const float dt = fixed_timestep_dt(timestep);
+    timestep->accumulator += std::fmax(0.f, frame_dt);
+
+    int n_ticks = (int)(timestep->accumulator * timestep->tick_rate);
+    if (n_ticks > timestep->max_substeps)
+    {
+        n_ticks = timestep->max_substeps;
+        timestep->accumulator = 0.f;
+    }
+    else
+    {
+        timestep->accumulator = std::fmax(0.f, timestep->accumulator - n_ticks * dt);
+    }
+    return n_ticks;
+}
+
+// Fraction of a tick between the last simulated state and the current time, for render interpolation
+inline float fixed_timestep_alpha(const FixedTimestep* const timestep)
+{
+    return std::fmin(1.f, timestep->accumulator * timestep->tick_rate);
+}